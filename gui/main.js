@@ -6,6 +6,8 @@ const dialog = electron.dialog;
 // This function will output the lines from the script 
 // and will return the full combined output
 // as well as exit code when it's done (using the callback).
+// Pass --progress lines in args to get 'mainprocess-progress' events:
+// { bytes, total, packets, packets_total, rate, eta, final }
 function run_script(command, args, callback) {
     var child = child_process.spawn(command, args, {
         encoding: 'utf8',
@@ -28,14 +30,40 @@ function run_script(command, args, callback) {
     });
 
     child.stderr.setEncoding('utf8');
+    var pending = '';
     child.stderr.on('data', (data) => {
-        // Return some data to the renderer process with the mainprocess-response ID
-        mainWindow.webContents.send('mainprocess-response', data);
-        //Here is the output from the command
-        console.log(data);  
+        // Progress lines become progress events, the rest goes to the
+        // renderer process with the mainprocess-response ID
+        pending += data;
+        var lines = pending.split('\n');
+        pending = lines.pop();
+        lines.forEach(send_line);
     });
 
+    function send_line(line) {
+        if (line.startsWith('progress {')) {
+            var event = null;
+            try {
+                event = JSON.parse(line.slice(9));
+            } catch (e) {
+                // Not a whole progress line: shown like any other output
+            }
+            if (event !== null) {
+                mainWindow.webContents.send('mainprocess-progress', event);
+                return;
+            }
+        }
+        mainWindow.webContents.send('mainprocess-response', line);
+        //Here is the output from the command
+        console.log(line);
+    }
+
     child.on('close', (code) => {
+        // Output after the last newline
+        if (pending !== '') {
+            send_line(pending);
+            pending = '';
+        }
         //Here you can get the exit code of the script  
         switch (code) {
             case 0:
@@ -51,3 +79,79 @@ function run_script(command, args, callback) {
     if (typeof callback === 'function')
         callback();
 }
+
+// Same idea as run_script, but talks to a running pktcored over its
+// Unix socket instead of spawning pktcore for every action.
+// request is an object like { op: 'split', file: 'a.iso' },
+// on_event gets every progress event and finally the result.
+const net = require('net');
+const os = require('os');
+const path = require('path');
+var rpc_id = 0;
+
+function pktcored_socket() {
+    if (process.env.XDG_RUNTIME_DIR)
+        return path.join(process.env.XDG_RUNTIME_DIR, 'pktcored.sock');
+    return '/tmp/pktcored-' + os.userInfo().uid + '.sock';
+}
+
+// pktcore command line doing what a request asks, null for requests only
+// the daemon answers (list, status, shutdown)
+function rpc_command(request) {
+    var quote = (arg) => "'" + String(arg).replace(/'/g, "'\\''") + "'";
+    var args;
+    if (request.op === 'split' && request.splits)
+        args = ['split', request.file, request.splits];
+    else if (request.op === 'split')
+        args = ['split', request.file, '--packet-size',
+                request.packet_size || 1048576];
+    else if (request.op === 'combine')
+        args = ['combine', request.name, '-o',
+                request.output || request.name];
+    else
+        return null;
+    if (request.op === 'split' && request.name)
+        args.push('--name', request.name);
+    args.push('--progress', 'lines');
+    return args.map(quote);
+}
+
+function run_rpc(request, on_event) {
+    request.id = ++rpc_id;
+    var connected = false;
+    var client = net.createConnection(pktcored_socket(), () => {
+        connected = true;
+        client.write(JSON.stringify(request) + '\n');
+    });
+    var pending = '';
+
+    client.on('error', (error) => {
+        console.log('pktcored unavailable: ' + error);
+        // No daemon running: fall back to spawning pktcore
+        var args = connected ? null : rpc_command(request);
+        if (args)
+            run_script('pktcore', args);
+    });
+
+    client.setEncoding('utf8');
+    client.on('data', (data) => {
+        pending += data;
+        var lines = pending.split('\n');
+        pending = lines.pop();
+        lines.forEach((line) => {
+            var event;
+            try {
+                event = JSON.parse(line);
+            } catch (error) {
+                console.log('bad pktcored line: ' + line);
+                return;
+            }
+            if (typeof on_event === 'function')
+                on_event(event);
+            if (event.event === 'progress')
+                mainWindow.webContents.send('mainprocess-response', line);
+            if (event.event === 'result')
+                client.end();
+        });
+    });
+}
@@ -0,0 +1,372 @@
+#pragma once
+#include "combiner.h"
+#include "full_header.h"
+#include "manifest.h"
+#include "pkt_utils.h"
+#include "progress.h"
+#include "scheduler.h"
+#include "splitter.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Batch module namespace: splits or combines many files in one process.
+ * Every file, and every range of packets inside a big file, becomes a task
+ * on one shared work-stealing pool, so small files keep idle workers busy
+ * while big files are cut by several workers at once.
+ */
+namespace batch {
+
+/*
+ * Progress of one queued job, called from worker threads after every task:
+ * packets finished so far, packets in total and whether all went well.
+ * The last call is the one where done == total.
+ */
+using Job_Callback = std::function<void(uint64_t done, uint64_t total, bool ok)>;
+
+/*
+ * Queues the split of one file into packets of packet_size bytes, written to
+ * the current directory.
+ * - @pool        : pool that runs the tasks
+ * - @path        : file to split
+ * - @name        : filename stored in the full header
+ * - @packet_size : payload bytes per packet
+ * - @on_progress : optional progress callback
+ */
+inline void Queue_Split_File(sched::Work_Stealing_Pool &pool,
+                             const std::string &path, const std::string &name,
+                             uint32_t packet_size,
+                             Job_Callback on_progress = nullptr);
+
+/*
+ * Queues the combine of one complete packet set into output.
+ * - @full   : full header of the set
+ * - @parts  : part number -> packet file, parts 1..packets must be present
+ * - @output : file to create
+ */
+inline bool Queue_Combine_Set(sched::Work_Stealing_Pool &pool,
+                              const header::Full_Header &full,
+                              std::map<uint32_t, std::string> parts,
+                              const std::string &output,
+                              Job_Callback on_progress = nullptr);
+
+/*
+ * Splits every regular file below a directory into packets of packet_size
+ * bytes, written to the current directory.
+ * - @dir         : directory to walk (recursively)
+ * - @packet_size : payload bytes per packet
+ * - @threads     : workers, 0 for one per hardware thread
+ */
+inline bool SPLIT_ALL(const std::string &dir, uint32_t packet_size,
+                      size_t threads = 0);
+
+/*
+ * Combines every complete packet set found in the current directory.
+ * - @threads : workers, 0 for one per hardware thread
+ */
+inline bool COMBINE_ALL(size_t threads = 0);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+
+// A task covers at least this many payload bytes, so tiny packets are not
+// scheduled one by one
+constexpr uint64_t TASK_BYTES = 8 * 1024 * 1024;
+
+inline uint32_t Packets_Per_Task(uint64_t packet_size) {
+    uint64_t per_task = packet_size == 0 ? 1 : TASK_BYTES / packet_size;
+    return static_cast<uint32_t>(per_task == 0 ? 1 : per_task);
+}
+
+/*
+ * Shared by the tasks of one job to report progress exactly once per task.
+ */
+struct Job_State {
+    std::atomic<uint64_t> done{0};
+    std::atomic<bool> failed{false};
+    uint64_t total = 0;
+    Job_Callback on_progress;
+
+    void Finished(uint64_t packets, bool ok) {
+        if (!ok)
+            failed = true;
+        uint64_t now = done.fetch_add(packets) + packets;
+        if (on_progress)
+            on_progress(now, total, !failed.load());
+    }
+};
+
+inline void Queue_Split_File(sched::Work_Stealing_Pool &pool,
+                             const std::string &path, const std::string &name,
+                             uint32_t packet_size, Job_Callback on_progress) {
+    pool.Submit([&pool, path, name, packet_size, on_progress] {
+        auto job = std::make_shared<Job_State>();
+        job->on_progress = on_progress;
+
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(path, ec);
+        if (ec) {
+            std::cerr << "Could not open file: " << path << "\n";
+            job->Finished(0, false);
+            return;
+        }
+
+        auto file_id = utils::Genrate_File_ID();
+        job->total = (size + packet_size - 1) / packet_size;
+        progress::Expect(size, job->total);
+
+        // The full header and the manifest go out once the last task is
+        // done, with the checksums of every packet
+        header::Full_Header full = header::FULL_HEADER(
+            file_id, 0, job->total, 0, packet_size, size, name);
+        auto crcs = std::make_shared<std::vector<uint32_t>>(job->total + 1, 0);
+        job->on_progress = [full, name, crcs, on_progress](
+                               uint64_t done, uint64_t total, bool ok) {
+            if (done == total && ok) {
+                std::string fname =
+                    utils::CREATE_EMPTY_HEADER_FILE(full.file_id, 0);
+                ok = !fname.empty() &&
+                     manifest::WRITE_MANIFEST(
+                         fname, full, manifest::Build(full, name, *crcs));
+            }
+            if (on_progress)
+                on_progress(done, total, ok);
+        };
+        if (job->total == 0) {
+            job->Finished(0, true);
+            return;
+        }
+
+        uint32_t per_task = Packets_Per_Task(packet_size);
+        for (uint64_t first = 1; first <= job->total; first += per_task) {
+            uint64_t last = std::min<uint64_t>(first + per_task - 1, job->total);
+            pool.Submit([job, crcs, path, size, packet_size, file_id, first,
+                         last] {
+                bool ok = true;
+                for (uint64_t i = first; ok && i <= last; i++) {
+                    uint64_t start = (i - 1) * packet_size;
+                    uint64_t end = std::min<uint64_t>(start + packet_size, size);
+                    ok = splitter::create_packet(path, file_id, i, start, end,
+                                                 &(*crcs)[i]);
+                    progress::Add(end - start, 1);
+                }
+                job->Finished(last - first + 1, ok);
+            });
+        }
+    });
+}
+
+inline bool Queue_Combine_Set(sched::Work_Stealing_Pool &pool,
+                              const header::Full_Header &full,
+                              std::map<uint32_t, std::string> parts,
+                              const std::string &output,
+                              Job_Callback on_progress) {
+    std::filesystem::path out_path(output);
+    std::error_code ec;
+    if (out_path.has_parent_path())
+        std::filesystem::create_directories(out_path.parent_path(), ec);
+
+    int out_fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        0644);
+    if (out_fd < 0 || ::ftruncate(out_fd, header::File_Size_Of(full))) {
+        std::cerr << "Failed to create file: " << output << "\n";
+        if (out_fd >= 0)
+            ::close(out_fd);
+        return false;
+    }
+    ::close(out_fd);
+
+    auto job = std::make_shared<Job_State>();
+    job->on_progress = on_progress;
+    job->total = header::Packets_Of(full);
+    progress::Expect(header::File_Size_Of(full), job->total);
+    if (job->total == 0) {
+        job->Finished(0, true);
+        return true;
+    }
+
+    auto shared_parts =
+        std::make_shared<const std::map<uint32_t, std::string>>(std::move(parts));
+    uint32_t per_task = Packets_Per_Task(header::Payload_Size_Of(full));
+    for (uint64_t first = 1; first <= job->total; first += per_task) {
+        uint32_t last = std::min<uint64_t>(first + per_task - 1, job->total);
+        pool.Submit([job, shared_parts, full, output, first, last] {
+            bool ok = true;
+            int fd = ::open(output.c_str(), O_WRONLY | O_CLOEXEC);
+            for (uint32_t i = first; fd >= 0 && i <= last; i++) {
+                const std::string &packet = shared_parts->at(i);
+                int in_fd = ::open(packet.c_str(), O_RDONLY | O_CLOEXEC);
+                uint64_t start = header::Packet_Start(full, i);
+                uint64_t len = header::Packet_Start(full, i + 1) - start;
+                // Hole packets: the output was truncated to size, their
+                // range is a hole already
+                header::Packet_Info info;
+                bool hole = in_fd >= 0 &&
+                            (full.flags[0] & header::FLAG_SPARSE) &&
+                            header::Read_Packet_Header(in_fd, info) &&
+                            (info.flag & header::PACKET_HOLE);
+                if (in_fd < 0 ||
+                    (!hole && !Copy_To_Offset(
+                                  in_fd, header::Packet_Header_Size(full, i),
+                                  len, fd, start))) {
+                    std::cerr << "Failed to copy packet: " << packet << "\n";
+                    ok = false;
+                }
+                if (in_fd >= 0)
+                    ::close(in_fd);
+                progress::Add(len, 1);
+            }
+            if (fd < 0)
+                ok = false;
+            else
+                ::close(fd);
+            job->Finished(last - first + 1, ok);
+        });
+    }
+    return true;
+}
+
+inline bool SPLIT_ALL(const std::string &dir, uint32_t packet_size,
+                      size_t threads) {
+    if (packet_size == 0) {
+        std::cerr << "Packet size must be greater than zero\n";
+        return false;
+    }
+
+    struct Input {
+        std::string path;
+        std::string name; // stored in the full header
+        uint64_t size;
+    };
+    std::vector<Input> inputs;
+    std::error_code ec;
+    for (const auto &entry :
+         std::filesystem::recursive_directory_iterator(dir, ec)) {
+        if (!entry.is_regular_file())
+            continue;
+        inputs.push_back({entry.path().string(),
+                          entry.path().lexically_relative(dir).string(),
+                          static_cast<uint64_t>(entry.file_size())});
+    }
+    if (ec) {
+        std::cerr << "Could not read directory: " << dir << "\n";
+        return false;
+    }
+
+    // Biggest first: they get cut into the most tasks, and the small files
+    // queued behind them fill in the gaps at the end
+    std::sort(inputs.begin(), inputs.end(),
+              [](const Input &a, const Input &b) { return a.size > b.size; });
+
+    std::atomic<uint64_t> packets_done{0};
+    std::atomic<bool> failed{false};
+    sched::Work_Stealing_Pool pool(threads);
+    for (const auto &input : inputs) {
+        Queue_Split_File(pool, input.path, input.name, packet_size,
+                         [&](uint64_t done, uint64_t total, bool ok) {
+                             if (done == total) {
+                                 packets_done += total;
+                                 if (!ok)
+                                     failed = true;
+                             }
+                         });
+    }
+    pool.Wait();
+
+    std::cout << "split " << inputs.size() << " files into "
+              << packets_done.load() << " packets on " << pool.Size()
+              << " threads\n";
+    return !failed.load();
+}
+
+inline bool COMBINE_ALL(size_t threads) {
+    sched::Work_Stealing_Pool pool(threads);
+
+    // One shared scan instead of one per file: headers are read in parallel
+    // and every packet is filed under its set
+    std::vector<std::string> files = layout::Files();
+    std::map<std::string, std::map<uint32_t, std::string>> sets;
+    std::mutex sets_lock;
+
+    const size_t scan_chunk = 256;
+    for (size_t first = 0; first < files.size(); first += scan_chunk) {
+        pool.Submit([&, first] {
+            std::vector<std::pair<std::string, std::pair<uint32_t, size_t>>>
+                found;
+            size_t last = std::min(first + scan_chunk, files.size());
+            for (size_t i = first; i < last; i++) {
+                std::string file_id;
+                uint32_t split_no;
+                if (Read_Packet_Tag(files[i], file_id, split_no))
+                    found.push_back({file_id, {split_no, i}});
+            }
+            std::lock_guard<std::mutex> guard(sets_lock);
+            for (const auto &f : found)
+                sets[f.first][f.second.first] = files[f.second.second];
+        });
+    }
+    pool.Wait();
+
+    std::atomic<size_t> combined{0};
+    std::atomic<bool> failed{false};
+    for (auto &set : sets) {
+        auto &parts = set.second;
+        header::Full_Header full;
+        if (parts.count(0) == 0 || !header::READ_FULL_HEADER(parts[0], full)) {
+            std::cerr << "Skipping packets without a full header: "
+                      << utils::Packet_File_Name(set.first, 0) << "\n";
+            failed = true;
+            continue;
+        }
+        uint32_t packets = header::Packets_Of(full);
+        if (parts.size() != static_cast<size_t>(packets) + 1) {
+            std::cerr << "Skipping incomplete set "
+                      << utils::Packet_File_Name(set.first, 0) << ": "
+                      << parts.size() - 1 << " of " << packets
+                      << " packets\n";
+            failed = true;
+            continue;
+        }
+
+        // The manifest has the whole name; older sets only the first 19
+        // bytes. Sets come from uploads and the network, so only the last
+        // component of the name is used and files land in the working
+        // directory.
+        std::string stored;
+        if (!manifest::READ_NAME(parts[0], full, stored))
+            stored = header::Name_Of(full);
+        std::string name = utils::Safe_File_Name(stored);
+        if (name.empty()) {
+            std::cerr << "Skipping set with no usable file name "
+                      << utils::Packet_File_Name(set.first, 0) << ": \""
+                      << stored << "\"\n";
+            failed = true;
+            continue;
+        }
+        if (!Queue_Combine_Set(pool, full, std::move(parts), name,
+                               [&](uint64_t done, uint64_t total, bool ok) {
+                                   if (done == total && !ok)
+                                       failed = true;
+                               })) {
+            failed = true;
+            continue;
+        }
+        combined++;
+    }
+    pool.Wait();
+
+    std::cout << "combined " << combined.load() << " files on " << pool.Size()
+              << " threads\n";
+    return !failed.load();
+}
+} // namespace batch
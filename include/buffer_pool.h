@@ -0,0 +1,273 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Buffers module namespace: page aligned I/O buffers that are reused instead
+ * of allocated per packet, and the helpers for O_DIRECT I/O built on them.
+ * Buffers are mapped once, never zero-filled again, and handed back to their
+ * pool when a job is done, so the split/combine hot path does not touch the
+ * allocator. Large buffers ask for transparent huge pages.
+ */
+namespace buffers {
+
+/*
+ * O_DIRECT needs offsets, lengths and addresses aligned to the logical block
+ * size; 4 KiB covers every common device.
+ */
+constexpr size_t DIRECT_ALIGN = 4096;
+
+/*
+ * Room a buffer needs on top of its payload for an aligned read that starts
+ * and ends inside a block.
+ */
+constexpr size_t DIRECT_SLACK = 2 * DIRECT_ALIGN;
+
+inline uint64_t Align_Down(uint64_t value) { return value & ~(DIRECT_ALIGN - 1); }
+inline uint64_t Align_Up(uint64_t value) {
+    return (value + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1);
+}
+
+/*
+ * Buffer_Pool: fixed size, page aligned buffers. Thread safe.
+ */
+class Buffer_Pool {
+  public:
+    explicit Buffer_Pool(size_t buffer_bytes)
+        : buffer_bytes_(Align_Up(buffer_bytes)) {}
+    ~Buffer_Pool();
+
+    Buffer_Pool(const Buffer_Pool &) = delete;
+    Buffer_Pool &operator=(const Buffer_Pool &) = delete;
+
+    /*
+     * Returns a free buffer, mapping a new one only when none is free.
+     * - @return : nullptr if memory could not be mapped
+     */
+    uint8_t *Acquire();
+
+    void Release(uint8_t *buffer);
+
+    size_t Buffer_Bytes() const { return buffer_bytes_; }
+
+  private:
+    size_t buffer_bytes_;
+    std::mutex lock_;
+    std::vector<uint8_t *> free_;
+    std::vector<uint8_t *> all_;
+};
+
+/*
+ * Process wide pool for one buffer size, shared by the split and combine
+ * engines so repeated jobs (batch, daemon, http) reuse the same memory.
+ */
+inline Buffer_Pool &Shared_Pool(size_t buffer_bytes);
+
+/*
+ * Opens a file for O_DIRECT I/O. Filesystems without O_DIRECT (tmpfs, some
+ * network filesystems) get a normal descriptor; callers then drop the pages
+ * they touched with Drop_Cache so the page cache is still left alone.
+ */
+inline int Open_Direct(const std::string &path, int flags, mode_t mode = 0644);
+
+/*
+ * Tells the kernel the cached pages of a range will not be needed again.
+ */
+inline void Drop_Cache(int fd, uint64_t offset = 0, uint64_t len = 0);
+
+/*
+ * Reads [offset, offset + len) with block aligned offset and length.
+ * - @buf    : aligned buffer of at least len + DIRECT_SLACK bytes
+ * - @skip   : where the requested byte `offset` landed inside buf
+ * - @return : false if fewer than len bytes could be read
+ */
+inline bool Read_Aligned(int fd, uint64_t offset, size_t len, uint8_t *buf,
+                         size_t &skip);
+
+/*
+ * Direct_Writer: turns a stream of unaligned writes into block aligned
+ * pwrites through a pooled staging buffer. Finish() pads the tail block with
+ * zeros for the device and truncates the file back to its real length.
+ */
+class Direct_Writer {
+  public:
+    explicit Direct_Writer(Buffer_Pool &pool)
+        : pool_(pool), buf_(pool.Acquire()) {}
+    ~Direct_Writer() {
+        if (buf_)
+            pool_.Release(buf_);
+    }
+
+    Direct_Writer(const Direct_Writer &) = delete;
+    Direct_Writer &operator=(const Direct_Writer &) = delete;
+
+    /*
+     * Starts writing a new file at offset 0.
+     */
+    void Open(int fd) {
+        fd_ = fd;
+        fill_ = 0;
+        offset_ = 0;
+    }
+
+    bool Write(const void *data, size_t len);
+    bool Finish();
+
+  private:
+    bool Flush_Blocks();
+
+    Buffer_Pool &pool_;
+    uint8_t *buf_;
+    int fd_ = -1;
+    size_t fill_ = 0;     // staged bytes not yet written
+    uint64_t offset_ = 0; // file offset of buf_[0]
+};
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+inline Buffer_Pool::~Buffer_Pool() {
+    for (uint8_t *buffer : all_)
+        ::munmap(buffer, buffer_bytes_);
+}
+
+inline uint8_t *Buffer_Pool::Acquire() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (!free_.empty()) {
+            uint8_t *buffer = free_.back();
+            free_.pop_back();
+            return buffer;
+        }
+    }
+
+    // Anonymous mappings are page aligned and already zero
+    void *p = ::mmap(nullptr, buffer_bytes_, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        std::cerr << "Could not map a " << buffer_bytes_ << " byte buffer\n";
+        return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    if (buffer_bytes_ >= 2 * 1024 * 1024)
+        ::madvise(p, buffer_bytes_, MADV_HUGEPAGE);
+#endif
+    std::lock_guard<std::mutex> guard(lock_);
+    all_.push_back(static_cast<uint8_t *>(p));
+    return static_cast<uint8_t *>(p);
+}
+
+inline void Buffer_Pool::Release(uint8_t *buffer) {
+    if (!buffer)
+        return;
+    std::lock_guard<std::mutex> guard(lock_);
+    free_.push_back(buffer);
+}
+
+inline Buffer_Pool &Shared_Pool(size_t buffer_bytes) {
+    static std::mutex lock;
+    static std::map<size_t, std::unique_ptr<Buffer_Pool>> pools;
+    std::lock_guard<std::mutex> guard(lock);
+    auto &pool = pools[Align_Up(buffer_bytes)];
+    if (!pool)
+        pool = std::make_unique<Buffer_Pool>(buffer_bytes);
+    return *pool;
+}
+
+inline int Open_Direct(const std::string &path, int flags, mode_t mode) {
+    int fd = -1;
+#ifdef O_DIRECT
+    fd = ::open(path.c_str(), flags | O_DIRECT | O_CLOEXEC, mode);
+    if (fd >= 0 || errno != EINVAL)
+        return fd;
+#endif
+    return ::open(path.c_str(), flags | O_CLOEXEC, mode);
+}
+
+inline void Drop_Cache(int fd, uint64_t offset, uint64_t len) {
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+#endif
+}
+
+inline bool Read_Aligned(int fd, uint64_t offset, size_t len, uint8_t *buf,
+                         size_t &skip) {
+    uint64_t first = Align_Down(offset);
+    uint64_t last = Align_Up(offset + len);
+    skip = static_cast<size_t>(offset - first);
+
+    size_t want = static_cast<size_t>(last - first), got = 0;
+    while (got < skip + len) {
+        // The end of the file is not aligned: a short read there is fine
+        ssize_t n = ::pread(fd, buf + got, want - got, first + got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        got += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool Direct_Writer::Flush_Blocks() {
+    size_t whole = static_cast<size_t>(Align_Down(fill_));
+    size_t done = 0;
+    while (done < whole) {
+        ssize_t n = ::pwrite(fd_, buf_ + done, whole - done, offset_ + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += static_cast<size_t>(n);
+    }
+    std::memmove(buf_, buf_ + whole, fill_ - whole);
+    fill_ -= whole;
+    offset_ += whole;
+    return true;
+}
+
+inline bool Direct_Writer::Write(const void *data, size_t len) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    if (!buf_)
+        return false;
+    while (len > 0) {
+        size_t n = std::min(len, pool_.Buffer_Bytes() - fill_);
+        std::memcpy(buf_ + fill_, p, n);
+        fill_ += n;
+        p += n;
+        len -= n;
+        if (fill_ >= DIRECT_ALIGN && !Flush_Blocks())
+            return false;
+    }
+    return true;
+}
+
+inline bool Direct_Writer::Finish() {
+    if (!buf_)
+        return false;
+    uint64_t size = offset_ + fill_;
+    if (fill_ > 0) {
+        size_t padded = static_cast<size_t>(Align_Up(fill_));
+        std::memset(buf_ + fill_, 0, padded - fill_);
+        fill_ = padded;
+        if (!Flush_Blocks())
+            return false;
+    }
+    bool ok = ::ftruncate(fd_, size) == 0;
+    Drop_Cache(fd_);
+    fill_ = 0;
+    return ok;
+}
+} // namespace buffers
@@ -0,0 +1,559 @@
+#pragma once
+#include "combiner.h"
+#include "full_header.h"
+#include "layout.h"
+#include "manifest.h"
+#include "mini_header.h"
+#include "pkt_utils.h"
+#include "throttle.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/*
+ * Carve module namespace: recovers packets from a blob they were
+ * concatenated into (a tar of a spool, a raw capture, a disk image).
+ * The blob is mapped and scanned for the "PCORE" magic, several chunks at
+ * once with a vectorized search (AVX2 or NEON, memchr elsewhere). Every hit
+ * is validated as a packet or a full header before it is taken, and the
+ * payload length in the header tells where the packet ends. Compact packets
+ * carry a one byte magic only, so they are searched for in a second pass as
+ * magic + file_id, once the full header of their set was found.
+ * Recovered packets are written back as packet files, or combined straight
+ * from the blob without being copied out first.
+ */
+namespace carve {
+
+// A scan thread takes this many bytes at a time
+constexpr uint64_t SCAN_CHUNK = 64 * 1024 * 1024;
+
+/*
+ * A packet found in the blob.
+ */
+struct Found {
+    uint64_t offset;     // of its header
+    uint64_t header_len; // the payload starts at offset + header_len
+    uint64_t payload_len;
+    bool hole = false; // hole packet: payload_len bytes of zeros, none stored
+
+    uint64_t Stored() const { return hole ? 0 : payload_len; }
+};
+
+/*
+ * Everything found for one file_id. Parts may be found more than once
+ * (several copies in an image); candidates are kept in blob order.
+ */
+struct Carved_Set {
+    std::array<uint8_t, 5> file_id{};
+    bool has_header = false;
+    uint64_t header_offset = 0;
+    header::Full_Header full{};
+    manifest::Manifest table;      // version 1 when no manifest was found
+    uint64_t manifest_offset = 0;  // raw manifest bytes in the blob
+    uint64_t manifest_len = 0;
+    std::map<uint32_t, std::vector<Found>> parts;
+};
+
+/*
+ * Mapped_Blob: a read only mapping of the whole input.
+ */
+class Mapped_Blob {
+  public:
+    Mapped_Blob() = default;
+    ~Mapped_Blob();
+
+    Mapped_Blob(const Mapped_Blob &) = delete;
+    Mapped_Blob &operator=(const Mapped_Blob &) = delete;
+
+    bool Open(const std::string &path);
+
+    const uint8_t *Data() const { return data_; }
+    uint64_t Size() const { return size_; }
+
+  private:
+    int fd_ = -1;
+    uint8_t *data_ = nullptr;
+    uint64_t size_ = 0;
+};
+
+/*
+ * Every position p in [begin, end) where needle starts. Needles may run up
+ * to n - 1 bytes past end: chunks overlap by that much, so a match that
+ * straddles two chunks is found by the chunk it starts in.
+ * - @n : needle length, at least 2
+ */
+inline void Find_All(const uint8_t *data, uint64_t size, uint64_t begin,
+                     uint64_t end, const uint8_t *needle, size_t n,
+                     std::vector<uint64_t> &hits);
+
+/*
+ * Scans the whole blob for needle, one chunk per thread at a time.
+ * - @return : matches in blob order
+ */
+inline std::vector<uint64_t> Scan(const Mapped_Blob &blob,
+                                  const uint8_t *needle, size_t n,
+                                  size_t threads);
+
+/*
+ * Finds and validates every packet and full header in the blob.
+ * - @sets : file_id -> what was found for it
+ */
+inline void SCAN_BLOB(const Mapped_Blob &blob,
+                      std::map<std::string, Carved_Set> &sets,
+                      size_t threads = 0);
+
+/*
+ * Carves a blob: reports every packet set found in it, then writes the
+ * packets back as packet files, or with combine set rebuilds every
+ * complete set straight from the blob.
+ * - @blob    : file to scan
+ * - @combine : rebuild the original files instead of writing packets
+ * - @threads : scan threads, 0 for one per hardware thread
+ * - @return  : false if the blob can't be read, a write failed, or a set
+ *              could not be combined
+ */
+inline bool CARVE(const std::string &blob, bool combine = false,
+                  size_t threads = 0);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+inline Mapped_Blob::~Mapped_Blob() {
+    if (data_)
+        ::munmap(data_, size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+inline bool Mapped_Blob::Open(const std::string &path) {
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd_ < 0 || fstat(fd_, &st) != 0) {
+        std::cerr << "Could not open file: " << path << "\n";
+        return false;
+    }
+    size_ = static_cast<uint64_t>(st.st_size);
+    if (size_ == 0)
+        return true;
+    void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (p == MAP_FAILED) {
+        std::cerr << "Could not map file: " << path << "\n";
+        size_ = 0;
+        return false;
+    }
+    data_ = static_cast<uint8_t *>(p);
+    ::madvise(data_, size_, MADV_SEQUENTIAL);
+    return true;
+}
+
+/*
+ * Memchr for the first byte, then a compare: the tail of every chunk and
+ * the whole scan where no vector unit is used.
+ */
+inline void Find_Scalar(const uint8_t *data, uint64_t from, uint64_t stop,
+                        const uint8_t *needle, size_t n,
+                        std::vector<uint64_t> &hits) {
+    const uint8_t *p = data + from;
+    const uint8_t *last = data + stop;
+    while (p < last) {
+        p = static_cast<const uint8_t *>(std::memchr(p, needle[0], last - p));
+        if (!p)
+            break;
+        if (std::memcmp(p, needle, n) == 0)
+            hits.push_back(static_cast<uint64_t>(p - data));
+        p++;
+    }
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+/*
+ * 32 positions per step: compare the first and the last needle byte at
+ * once, and only check the middle of positions where both match.
+ * - @return : first position left for the scalar tail
+ */
+__attribute__((target("avx2"))) inline uint64_t
+Find_Avx2(const uint8_t *data, uint64_t from, uint64_t stop,
+          const uint8_t *needle, size_t n, std::vector<uint64_t> &hits) {
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(needle[0]));
+    const __m256i last = _mm256_set1_epi8(static_cast<char>(needle[n - 1]));
+    uint64_t p = from;
+    for (; p + 32 <= stop; p += 32) {
+        __m256i a =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + p));
+        __m256i b = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(data + p + n - 1));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                             _mm256_cmpeq_epi8(b, last))));
+        while (mask) {
+            uint64_t at = p + __builtin_ctz(mask);
+            if (std::memcmp(data + at + 1, needle + 1, n - 2) == 0)
+                hits.push_back(at);
+            mask &= mask - 1;
+        }
+    }
+    return p;
+}
+#elif defined(__aarch64__)
+/*
+ * 16 positions per step, as Find_Avx2. The compare mask is narrowed to one
+ * nibble per byte to get it out of the vector register.
+ */
+inline uint64_t Find_Neon(const uint8_t *data, uint64_t from, uint64_t stop,
+                          const uint8_t *needle, size_t n,
+                          std::vector<uint64_t> &hits) {
+    const uint8x16_t first = vdupq_n_u8(needle[0]);
+    const uint8x16_t last = vdupq_n_u8(needle[n - 1]);
+    uint64_t p = from;
+    for (; p + 16 <= stop; p += 16) {
+        uint8x16_t eq = vandq_u8(vceqq_u8(vld1q_u8(data + p), first),
+                                 vceqq_u8(vld1q_u8(data + p + n - 1), last));
+        uint64_t mask = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        while (mask) {
+            int bit = __builtin_ctzll(mask);
+            uint64_t at = p + (bit >> 2);
+            if (std::memcmp(data + at + 1, needle + 1, n - 2) == 0)
+                hits.push_back(at);
+            mask &= ~(0xFULL << (bit & ~3));
+        }
+    }
+    return p;
+}
+#endif
+
+inline void Find_All(const uint8_t *data, uint64_t size, uint64_t begin,
+                     uint64_t end, const uint8_t *needle, size_t n,
+                     std::vector<uint64_t> &hits) {
+    if (n < 2 || size < n)
+        return;
+    uint64_t stop = std::min<uint64_t>(end, size - n + 1);
+    if (begin >= stop)
+        return;
+    uint64_t p = begin;
+#if defined(__x86_64__) && defined(__GNUC__)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2)
+        p = Find_Avx2(data, p, stop, needle, n, hits);
+#elif defined(__aarch64__)
+    p = Find_Neon(data, p, stop, needle, n, hits);
+#endif
+    Find_Scalar(data, p, stop, needle, n, hits);
+}
+
+inline std::vector<uint64_t> Scan(const Mapped_Blob &blob,
+                                  const uint8_t *needle, size_t n,
+                                  size_t threads) {
+    uint64_t chunks = (blob.Size() + SCAN_CHUNK - 1) / SCAN_CHUNK;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<size_t>(std::min<uint64_t>(threads, chunks));
+
+    std::vector<uint64_t> hits;
+    std::mutex lock;
+    std::atomic<uint64_t> next{0};
+    auto worker = [&] {
+        std::vector<uint64_t> found;
+        for (uint64_t c = next++; c < chunks; c = next++) {
+            uint64_t begin = c * SCAN_CHUNK;
+            uint64_t end = std::min(begin + SCAN_CHUNK, blob.Size());
+            // Ask for the chunk up front instead of faulting it in page by
+            // page
+            ::madvise(const_cast<uint8_t *>(blob.Data()) +
+                          (begin & ~uint64_t(4095)),
+                      end - (begin & ~uint64_t(4095)), MADV_WILLNEED);
+            Find_All(blob.Data(), blob.Size(), begin, end, needle, n, found);
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        hits.insert(hits.end(), found.begin(), found.end());
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threads; i++)
+        pool.emplace_back(worker);
+    if (threads > 0)
+        worker();
+    for (auto &t : pool)
+        t.join();
+    std::sort(hits.begin(), hits.end());
+    return hits;
+}
+
+/*
+ * File IDs are generated alphanumeric: a cheap check against random hits.
+ */
+inline bool Is_File_ID(const std::array<uint8_t, 5> &id) {
+    return std::all_of(id.begin(), id.end(),
+                       [](uint8_t c) { return std::isalnum(c) != 0; });
+}
+
+/*
+ * Takes a full header at offset p, and the manifest behind it if it is
+ * whole. A damaged manifest is dropped and the header read as version 1.
+ */
+inline void Take_Full_Header(const Mapped_Blob &blob, uint64_t p,
+                             Carved_Set &set) {
+    const uint8_t *h = blob.Data() + p;
+    uint64_t avail = blob.Size() - p;
+    std::memcpy(&set.full, h, header::FULL_HEADER_SIZE);
+    set.has_header = true;
+    set.header_offset = p;
+    set.manifest_len = 0;
+
+    if (set.full.flags[0] & header::FLAG_MANIFEST) {
+        const uint8_t *m = h + header::FULL_HEADER_SIZE;
+        size_t len = manifest::Measure(m, avail - header::FULL_HEADER_SIZE);
+        if (len > 0 && manifest::Decode(m, len, set.table) &&
+            set.table.packets.size() == header::Packets_Of(set.full)) {
+            set.manifest_offset = p + header::FULL_HEADER_SIZE;
+            set.manifest_len = len;
+            return;
+        }
+        set.full.flags[0] &= ~header::FLAG_MANIFEST;
+    }
+    set.table = manifest::Build(set.full, header::Name_Of(set.full), {});
+}
+
+inline void SCAN_BLOB(const Mapped_Blob &blob,
+                      std::map<std::string, Carved_Set> &sets,
+                      size_t threads) {
+    const uint8_t *data = blob.Data();
+    uint64_t size = blob.Size();
+
+    // Standard packet headers and full headers
+    for (uint64_t p : Scan(blob, reinterpret_cast<const uint8_t *>("PCORE"),
+                           5, threads)) {
+        header::Packet_Info info;
+        uint64_t avail = size - p;
+        if (!header::Parse_Packet_Header(
+                data + p, std::min<uint64_t>(avail, header::MAX_PACKET_HEADER),
+                info) ||
+            info.compact || !Is_File_ID(info.file_id))
+            continue;
+        std::string id(info.file_id.begin(), info.file_id.end());
+        if (info.part == 0) {
+            if (avail >= header::FULL_HEADER_SIZE && !sets[id].has_header) {
+                sets[id].file_id = info.file_id;
+                Take_Full_Header(blob, p, sets[id]);
+            }
+            continue;
+        }
+        Found found{p, info.header_len, info.payload_len,
+                    (info.flag & header::PACKET_HOLE) != 0};
+        if (found.Stored() > avail - info.header_len)
+            continue; // cut off by the end of the blob
+        sets[id].file_id = info.file_id;
+        sets[id].parts[info.part].push_back(found);
+    }
+
+    // Compact packets: magic + file_id of every set known to use them
+    for (auto &entry : sets) {
+        Carved_Set &set = entry.second;
+        if (!set.has_header || !(set.full.flags[0] & header::FLAG_COMPACT))
+            continue;
+        uint8_t needle[1 + 5] = {header::COMPACT_MAGIC};
+        std::memcpy(needle + 1, set.file_id.data(), 5);
+        for (uint64_t p : Scan(blob, needle, sizeof(needle), threads)) {
+            header::Packet_Info info;
+            uint64_t avail = size - p;
+            if (!header::Parse_Packet_Header(
+                    data + p,
+                    std::min<uint64_t>(avail, header::MAX_PACKET_HEADER),
+                    info) ||
+                info.part == 0 || info.part > set.table.packets.size())
+                continue;
+            Found found{p, info.header_len,
+                        set.table.packets[info.part - 1].payload,
+                        (info.flag & header::PACKET_HOLE) != 0};
+            if (found.Stored() > avail - info.header_len)
+                continue;
+            set.parts[info.part].push_back(found);
+        }
+    }
+
+    // With a full header, parts it does not describe are stray hits
+    for (auto &entry : sets) {
+        Carved_Set &set = entry.second;
+        if (!set.has_header)
+            continue;
+        for (auto it = set.parts.begin(); it != set.parts.end();) {
+            if (it->first > set.table.packets.size())
+                it = set.parts.erase(it);
+            else
+                ++it;
+        }
+    }
+}
+
+/*
+ * The copy of a part to use: the first one of the expected length and, when
+ * there are several and the manifest has checksums, the first intact one.
+ */
+inline const Found *Pick(const Mapped_Blob &blob, const Carved_Set &set,
+                         uint32_t part) {
+    auto it = set.parts.find(part);
+    if (it == set.parts.end())
+        return nullptr;
+    const manifest::Packet *record =
+        set.has_header ? &set.table.packets[part - 1] : nullptr;
+    const Found *fallback = nullptr;
+    for (const Found &found : it->second) {
+        if (record && found.payload_len != record->payload)
+            continue;
+        if (!fallback)
+            fallback = &found;
+        if (it->second.size() == 1 || !record ||
+            set.table.version < manifest::VERSION || found.hole)
+            return fallback;
+        if (manifest::Crc32c(blob.Data() + found.offset + found.header_len,
+                             found.payload_len) == record->crc)
+            return &found;
+    }
+    return fallback;
+}
+
+inline bool Write_File(const std::string &path,
+                       const std::vector<std::pair<const uint8_t *, uint64_t>>
+                           &pieces) {
+    int fd = -1;
+    if (layout::Prepare(path))
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    bool ok = fd >= 0;
+    for (const auto &piece : pieces) {
+        uint64_t done = 0;
+        while (ok && done < piece.second) {
+            size_t step = throttle::Active().Slice(
+                static_cast<size_t>(piece.second - done));
+            throttle::Charge(step);
+            ssize_t w = ::write(fd, piece.first + done, step);
+            if (w < 0 && errno == EINTR)
+                continue;
+            ok = w > 0;
+            done += ok ? static_cast<uint64_t>(w) : 0;
+        }
+    }
+    if (fd >= 0)
+        ::close(fd);
+    if (!ok)
+        std::cerr << "Failed to write: " << path << "\n";
+    return ok;
+}
+
+inline bool CARVE(const std::string &blob_path, bool combine, size_t threads) {
+    Mapped_Blob blob;
+    if (!blob.Open(blob_path))
+        return false;
+
+    std::map<std::string, Carved_Set> sets;
+    SCAN_BLOB(blob, sets, threads);
+
+    bool ok = true;
+    uint64_t carved = 0;
+    for (auto &entry : sets) {
+        const std::string &id = entry.first;
+        Carved_Set &set = entry.second;
+        uint32_t total = set.has_header ? header::Packets_Of(set.full) : 0;
+        std::vector<const Found *> picked;
+        uint32_t found = 0;
+        for (const auto &part : set.parts) {
+            const Found *copy = Pick(blob, set, part.first);
+            picked.push_back(copy);
+            found += copy ? 1 : 0;
+        }
+        bool complete = set.has_header && found == total;
+
+        if (set.has_header)
+            std::cout << set.table.name << " (" << id << "): " << found
+                      << " of " << total << " packets"
+                      << (complete ? "" : ", incomplete") << "\n";
+        else
+            std::cout << "(no full header) " << id << ": " << found
+                      << " packets\n";
+
+        if (combine) {
+            if (!complete) {
+                ok = false;
+                continue;
+            }
+            // Combine reads the payloads where they sit in the blob. The
+            // name comes from the blob, so only its last component is used
+            // and the output lands in the working directory.
+            combiner::Combine_Plan plan;
+            plan.output = utils::Safe_File_Name(set.table.name);
+            if (plan.output.empty())
+                plan.output = id;
+            std::error_code ec;
+            if (std::filesystem::equivalent(plan.output, blob_path, ec)) {
+                std::cerr << "Not combining " << id
+                          << " over the blob it was carved from\n";
+                ok = false;
+                continue;
+            }
+            size_t i = 0;
+            for (const auto &part : set.parts) {
+                const Found *copy = picked[i++];
+                const manifest::Packet &record =
+                    set.table.packets[part.first - 1];
+                plan.packets.push_back(blob_path);
+                plan.heads.push_back(copy->offset + copy->header_len);
+                plan.sizes.push_back(copy->payload_len);
+                plan.offsets.push_back(record.offset);
+                plan.roots.push_back(0);
+                plan.flags.push_back(copy->hole ? header::PACKET_HOLE : 0);
+                if (set.table.version >= manifest::VERSION)
+                    plan.crcs.push_back(record.crc);
+            }
+            if (!combiner::RUN_COMBINE(plan, 16, false, !plan.crcs.empty()))
+                ok = false;
+            carved += found;
+            continue;
+        }
+
+        size_t i = 0;
+        for (const auto &part : set.parts) {
+            const Found *copy = picked[i++];
+            if (!copy)
+                continue;
+            if (!Write_File(utils::Packet_Path(id, part.first),
+                            {{blob.Data() + copy->offset,
+                              copy->header_len + copy->Stored()}}))
+                ok = false;
+            carved++;
+        }
+        // The full header last: the set is only found once its packets are
+        if (set.has_header &&
+            !Write_File(utils::Packet_Path(id, 0),
+                        {{header::Bytes_Of(set.full), header::FULL_HEADER_SIZE},
+                         {blob.Data() + set.manifest_offset,
+                          set.manifest_len}}))
+            ok = false;
+    }
+
+    std::cout << (combine ? "combined " : "carved ") << carved
+              << " packets of " << sets.size() << " sets from " << blob_path
+              << "\n";
+    return ok;
+}
+} // namespace carve
@@ -0,0 +1,161 @@
+#pragma once
+#include "combiner.h"
+#include "full_header.h"
+#include "layout.h"
+#include "manifest.h"
+#include "pkt_utils.h"
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Catalog module namespace: an in-memory index of the packets in a directory.
+ * A cold scan opens every file to read its PCORE tag; the catalog remembers
+ * what it read and on Refresh() only opens files that are new or changed, so
+ * a long running process (the daemon) answers lookups without rescanning.
+ * Fanned out packet directories are refreshed one shard per thread.
+ */
+namespace catalog {
+
+/*
+ * Packet_Set: everything known about one file_id.
+ */
+struct Packet_Set {
+    std::string file_id;
+    std::string name;        // original filename, empty without a full header
+    bool has_header = false; // split 0 was found
+    header::Full_Header full{};
+    std::map<uint32_t, std::string> parts; // part number -> packet file
+
+    bool Complete() const {
+        return has_header &&
+               parts.size() == static_cast<size_t>(header::Packets_Of(full)) + 1;
+    }
+};
+
+class Catalog {
+  public:
+    explicit Catalog(const layout::Layout &where = layout::Active())
+        : where_(where) {}
+
+    /*
+     * Brings the index up to date with the directory.
+     * - @return : number of files whose tag had to be (re)read
+     */
+    size_t Refresh();
+
+    /*
+     * Snapshot of every packet set currently indexed.
+     */
+    std::vector<Packet_Set> Sets();
+
+    /*
+     * Looks a packet set up by its original filename.
+     */
+    bool Find(const std::string &name, Packet_Set &set);
+
+    size_t Files();
+
+  private:
+    struct Tag {
+        std::filesystem::file_time_type mtime;
+        uintmax_t size = 0;
+        bool is_packet = false;
+        std::string file_id;
+        uint32_t split_no = 0;
+        header::Full_Header full{}; // only for split 0
+        std::string name;           // only for split 0
+    };
+
+    layout::Layout where_;
+    std::mutex lock_;
+    std::map<std::string, Tag> files_; // path -> tag
+};
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+inline size_t Catalog::Refresh() {
+    std::map<std::string, Tag> fresh;
+    size_t read = 0;
+    std::mutex fresh_lock;
+
+    std::lock_guard<std::mutex> guard(lock_);
+    // files_ is only read while the shards are walked
+    layout::For_Each_File(
+        [&](const std::string &path) {
+            std::error_code ec;
+            auto mtime = std::filesystem::last_write_time(path, ec);
+            auto size = std::filesystem::file_size(path, ec);
+            if (ec)
+                return;
+
+            auto old = files_.find(path);
+            if (old != files_.end() && old->second.mtime == mtime &&
+                old->second.size == size) {
+                std::lock_guard<std::mutex> fresh_guard(fresh_lock);
+                fresh.emplace(path, old->second);
+                return;
+            }
+
+            Tag tag;
+            tag.mtime = mtime;
+            tag.size = size;
+            tag.is_packet = Read_Packet_Tag(path, tag.file_id, tag.split_no);
+            if (tag.is_packet && tag.split_no == 0) {
+                tag.is_packet =
+                    manifest::READ_NAME(path, tag.full, tag.name);
+            }
+            std::lock_guard<std::mutex> fresh_guard(fresh_lock);
+            fresh.emplace(path, std::move(tag));
+            read++;
+        },
+        where_);
+    files_.swap(fresh);
+    return read;
+}
+
+inline std::vector<Packet_Set> Catalog::Sets() {
+    std::map<std::string, Packet_Set> sets;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (const auto &file : files_) {
+            const Tag &tag = file.second;
+            if (!tag.is_packet)
+                continue;
+            Packet_Set &set = sets[tag.file_id];
+            set.file_id = tag.file_id;
+            set.parts[tag.split_no] = file.first;
+            if (tag.split_no == 0) {
+                set.has_header = true;
+                set.full = tag.full;
+                set.name = tag.name;
+            }
+        }
+    }
+
+    std::vector<Packet_Set> result;
+    for (auto &set : sets)
+        result.push_back(std::move(set.second));
+    return result;
+}
+
+inline bool Catalog::Find(const std::string &name, Packet_Set &set) {
+    for (auto &candidate : Sets()) {
+        if (candidate.has_header && candidate.name == name) {
+            set = std::move(candidate);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline size_t Catalog::Files() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return files_.size();
+}
+} // namespace catalog
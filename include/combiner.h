@@ -1,10 +1,34 @@
+#pragma once
+#include "buffer_pool.h"
 #include "explorer.h"
+#include "full_header.h"
+#include "journal.h"
+#include "manifest.h"
+#include "mini_header.h"
+#include "page_cache.h"
+#include "pipeline.h"
 #include "pkt_utils.h"
+#include "progress.h"
+#include "sparse.h"
+#include "throttle.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 /*
  * local functions
@@ -24,37 +48,203 @@ struct CompareSplitNo {
 };
 
 /*
- * global functions
+ * Reads the tag at the start of a file: file_id and part number, from a
+ * standard or a compact packet header. Returns false for files that are not
+ * packets; a one byte magic is weak, so compact packets must also carry
+ * their own packet file name.
  */
-namespace combiner {
+inline bool Read_Packet_Tag(const std::string &path, std::string &file_id,
+                            uint32_t &split_no) {
+    header::Packet_Info info;
+    if (!header::Read_Packet_Header(path, info))
+        return false;
+    if (info.compact && std::filesystem::path(path).filename() !=
+                            utils::Packet_File_Name(info.file_id, info.part))
+        return false;
+    file_id.assign(info.file_id.begin(), info.file_id.end());
+    split_no = info.part;
+    return true;
+}
 
-inline std::vector<std::string> SHOW_PCORE_FILES() {
-    std::vector<std::string> file_names;
-    int count = 0;
-    for (const auto &file : utils::FETCH_FILES(".")) {
-        std::ifstream current(file, std::ios::binary);
+/*
+ * A packet found by a scan of the packet directory.
+ */
+struct Packet_Tag {
+    std::string path;
+    std::string file_id;
+    uint32_t split_no;
+};
+
+/*
+ * Reads the tag of every file in the packet directory. Shards are scanned
+ * in parallel; the result is sorted by path.
+ * - @headers_only : only open files named like a 0th split file, for
+ *                   lookups by name that never need the packets themselves
+ */
+inline std::vector<Packet_Tag> Scan_Packets(bool headers_only = false) {
+    std::vector<Packet_Tag> found;
+    std::mutex lock;
+    layout::For_Each_File([&](const std::string &path) {
+        if (headers_only && (path.size() < 2 ||
+                             path.compare(path.size() - 2, 2, "_0") != 0))
+            return;
+        Packet_Tag tag{path, "", 0};
+        if (!Read_Packet_Tag(path, tag.file_id, tag.split_no))
+            return;
+        std::lock_guard<std::mutex> guard(lock);
+        found.push_back(std::move(tag));
+    });
+    std::sort(found.begin(), found.end(),
+              [](const Packet_Tag &a, const Packet_Tag &b) {
+                  return a.path < b.path;
+              });
+    return found;
+}
+
+/*
+ * Original filename of a packet set: the whole name from the manifest, or
+ * the first 19 bytes kept in the full header of older sets (split 0).
+ */
+inline std::string Read_Real_Name(const std::string &path) {
+    header::Full_Header full;
+    std::string name;
+    return manifest::READ_NAME(path, full, name) ? name : "";
+}
+
+/*
+ * Copies len bytes starting at offset of in_fd to the end of out_fd.
+ * Uses splice when the output is a pipe and sendfile otherwise, so payloads
+ * are not copied through user space; falls back to read/write.
+ */
+inline bool Copy_Range(int in_fd, off_t offset, size_t len, int out_fd,
+                       bool out_is_pipe);
 
-        char ext[6] = {0};
-        current.read(ext, 5);
-        if (std::string(ext) != "PCORE") {
+/*
+ * Appends len zero bytes standing for a hole to out_fd: sought over when
+ * seek is set (a regular output, truncated to size at the end), written
+ * otherwise.
+ */
+inline bool Write_Hole(int out_fd, uint64_t len, bool seek) {
+    if (seek)
+        return ::lseek(out_fd, static_cast<off_t>(len), SEEK_CUR) >= 0;
+    static const uint8_t zeros[64 * 1024] = {};
+    while (len > 0) {
+        ssize_t w = ::write(out_fd, zeros,
+                            static_cast<size_t>(
+                                std::min<uint64_t>(len, sizeof(zeros))));
+        if (w < 0 && errno == EINTR)
             continue;
-        }
+        if (w <= 0)
+            return false;
+        len -= static_cast<uint64_t>(w);
+    }
+    return true;
+}
 
-        char file_id_buf[6] = {0};
-        current.read(file_id_buf, 5);
-        std::string file_id(file_id_buf);
+inline bool Copy_Range(int in_fd, off_t offset, size_t len, int out_fd,
+                       bool out_is_pipe) {
+#ifdef __linux__
+    while (len > 0) {
+        size_t step = throttle::Active().Slice(len);
+        throttle::Charge(step);
+        ssize_t moved;
+        if (out_is_pipe) {
+            loff_t off = offset;
+            moved = splice(in_fd, &off, out_fd, nullptr, step,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+        } else {
+            off_t off = offset;
+            moved = sendfile(out_fd, in_fd, &off, step);
+        }
+        if (moved < 0 && errno == EINTR)
+            continue;
+        if (moved <= 0)
+            break; // not supported for this pair, finish with read/write
+        offset += moved;
+        len -= static_cast<size_t>(moved);
+    }
+#else
+    (void)out_is_pipe;
+#endif
+    std::vector<uint8_t> buffer(len < 1024 * 1024 ? len : 1024 * 1024);
+    while (len > 0) {
+        size_t want = len < buffer.size() ? len : buffer.size();
+        throttle::Charge(want, 2);
+        ssize_t got = ::pread(in_fd, buffer.data(), want, offset);
+        if (got <= 0)
+            return false;
+        for (ssize_t done = 0; done < got;) {
+            ssize_t w = ::write(out_fd, buffer.data() + done, got - done);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            done += w;
+        }
+        offset += got;
+        len -= static_cast<size_t>(got);
+    }
+    return true;
+}
 
-        uint32_t split_no;
-        current.read(reinterpret_cast<char *>(&split_no), 4);
+/*
+ * Copies len bytes from in_off of in_fd to out_off of out_fd, leaving both
+ * file positions alone, so several threads can fill one output file.
+ * Uses copy_file_range (in-kernel, reflinks where the filesystem can) and
+ * falls back to pread/pwrite.
+ */
+inline bool Copy_To_Offset(int in_fd, off_t in_off, size_t len, int out_fd,
+                           off_t out_off) {
+#ifdef __linux__
+    while (len > 0) {
+        size_t step = throttle::Active().Slice(len);
+        throttle::Charge(step);
+        loff_t src = in_off, dst = out_off;
+        ssize_t moved = copy_file_range(in_fd, &src, out_fd, &dst, step, 0);
+        if (moved < 0 && errno == EINTR)
+            continue;
+        if (moved <= 0)
+            break;
+        in_off += moved;
+        out_off += moved;
+        len -= static_cast<size_t>(moved);
+    }
+#endif
+    std::vector<uint8_t> buffer(len < 1024 * 1024 ? len : 1024 * 1024);
+    while (len > 0) {
+        size_t want = len < buffer.size() ? len : buffer.size();
+        throttle::Charge(want, 2);
+        ssize_t got = ::pread(in_fd, buffer.data(), want, in_off);
+        if (got <= 0)
+            return false;
+        for (ssize_t done = 0; done < got;) {
+            ssize_t w = ::pwrite(out_fd, buffer.data() + done, got - done,
+                                 out_off + done);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            done += w;
+        }
+        in_off += got;
+        out_off += got;
+        len -= static_cast<size_t>(got);
+    }
+    return true;
+}
 
-        if (split_no == 0) {
-            current.seekg(31); // Skipping to position where filename is stored
-            char filename_buf[20] = {0};
-            current.read(filename_buf, 19);
-            std::string real_filename(filename_buf);
+/*
+ * global functions
+ */
+namespace combiner {
 
+inline std::vector<std::string> SHOW_PCORE_FILES() {
+    std::vector<std::string> file_names;
+    int count = 0;
+    for (const auto &tag : Scan_Packets(true)) {
+        if (tag.split_no == 0) {
             // Save in vector and map
-            file_names.push_back(real_filename);
+            file_names.push_back(Read_Real_Name(tag.path));
             count++;
         }
     }
@@ -75,31 +265,13 @@ inline std::string Detect_PCORE_Files() {
     std::map<std::string, std::string> fileID_name; // fileID → filename
     std::vector<std::string> file_names;
 
-    for (const auto &file : utils::FETCH_FILES(".")) {
-        std::ifstream current(file, std::ios::binary);
-
-        char ext[6] = {0};
-        current.read(ext, 5);
-        if (std::string(ext) != "PCORE") {
-            continue;
-        }
-
-        char file_id_buf[6] = {0};
-        current.read(file_id_buf, 5);
-        std::string file_id(file_id_buf);
-
-        uint32_t split_no;
-        current.read(reinterpret_cast<char *>(&split_no), 4);
-
-        if (split_no == 0) {
-            current.seekg(31); // Skipping to position where filename is stored
-            char filename_buf[20] = {0};
-            current.read(filename_buf, 19);
-            std::string real_filename(filename_buf);
+    for (const auto &tag : Scan_Packets(true)) {
+        if (tag.split_no == 0) {
+            std::string real_filename = Read_Real_Name(tag.path);
 
             // Save in vector and map
             file_names.push_back(real_filename);
-            fileID_name[file_id] = real_filename;
+            fileID_name[tag.file_id] = real_filename;
         }
     }
 
@@ -120,25 +292,11 @@ inline std::string Detect_PCORE_Files() {
 inline std::string Detect_PCORE_Files(std::string original_fname) {
     std::map<std::string, std::string> fileID_name; // fileID → filename
     std::vector<std::string> file_names;
-    for (const auto &file : utils::FETCH_FILES(".")) {
-        std::ifstream current(file, std::ios::binary);
-        char ext[6] = {0};
-        current.read(ext, 5);
-        if (std::string(ext) != "PCORE") {
-            continue;
-        }
-        char file_id_buf[6] = {0};
-        current.read(file_id_buf, 5);
-        std::string file_id(file_id_buf);
-        uint32_t split_no;
-        current.read(reinterpret_cast<char *>(&split_no), 4);
-        if (split_no == 0) {
-            current.seekg(31); // Skipping to position where filename is stored
-            char filename_buf[20] = {0};
-            current.read(filename_buf, 19);
-            std::string real_filename(filename_buf);
+    for (const auto &tag : Scan_Packets(true)) {
+        if (tag.split_no == 0) {
+            std::string real_filename = Read_Real_Name(tag.path);
             file_names.push_back(real_filename);
-            fileID_name[file_id] = real_filename;
+            fileID_name[tag.file_id] = real_filename;
         }
     }
     std::string selected_filename = original_fname;
@@ -157,28 +315,12 @@ BuildMinHeapForFile(const std::string &target_file_id) {
     std::priority_queue<MinHeapNode, std::vector<MinHeapNode>, CompareSplitNo>
         min_heap;
 
-    for (const auto &file : utils::FETCH_FILES(".")) {
-        std::ifstream current(file, std::ios::binary);
-        if (!current)
+    for (const auto &tag : Scan_Packets()) {
+        if (tag.file_id != target_file_id)
             continue;
 
-        char ext[6] = {0};
-        current.read(ext, 5);
-        if (std::string(ext) != "PCORE")
-            continue;
-
-        char file_id_buf[6] = {0};
-        current.read(file_id_buf, 5);
-        std::string file_id(file_id_buf);
-
-        if (file_id != target_file_id)
-            continue;
-
-        uint32_t split_no;
-        current.read(reinterpret_cast<char *>(&split_no), 4);
-
         // if (split_no != 0) {
-        min_heap.emplace(split_no, file);
+        min_heap.emplace(tag.split_no, tag.path);
         // }
     }
 
@@ -196,48 +338,665 @@ inline void PrintMinHeap(
     }
 }
 
-inline void COMBINE(
-    std::priority_queue<MinHeapNode, std::vector<MinHeapNode>, CompareSplitNo>
-        heap) {
+/*
+ * Combine_Plan: every read and write of a combine, known before the first
+ * one. Packets are listed in part order.
+ */
+struct Combine_Plan {
+    std::string output;
+    std::vector<std::string> packets;
+    std::vector<uint64_t> heads;   // packet header bytes before the payload
+    std::vector<uint64_t> sizes;   // payload bytes
+    std::vector<uint64_t> offsets; // where the payload goes in the output
+    std::vector<size_t> roots;     // root of the stripe set holding it
+    std::vector<uint32_t> crcs;    // crc32c of the payloads, empty: unknown
+    std::vector<uint8_t> flags;    // header::PACKET_* bits, empty: none set
+
+    bool Hole(size_t i) const {
+        return i < flags.size() && (flags[i] & header::PACKET_HOLE);
+    }
+};
 
+/*
+ * Plans a combine from the packets a directory scan found: the payload
+ * size of every packet comes from its file size, or from the full header
+ * for hole packets.
+ * - @heap : packets of one file, full header on top
+ */
+inline bool Plan_From_Heap(
+    std::priority_queue<MinHeapNode, std::vector<MinHeapNode>, CompareSplitNo>
+        heap,
+    Combine_Plan &plan) {
     if (heap.empty()) {
         std::cerr << "Heap is empty!\n";
-        return;
+        return false;
     }
 
     // The top of the heap has the full header (split_no == 0)
     const auto &header_node = heap.top();
-
-    std::ifstream current(header_node.filename, std::ios::binary);
-    if (!current.is_open()) {
+    header::Full_Header full;
+    manifest::Manifest table;
+    if (header_node.split_no != 0 ||
+        !manifest::READ_MANIFEST(header_node.filename, full, table)) {
         std::cerr << "Failed to open header file: " << header_node.filename
                   << "\n";
-        return;
+        return false;
     }
+    plan.output = table.name;
 
-    current.seekg(31); // Position where original filename is stored
-    char filename_buf[20] = {0};
-    current.read(filename_buf, 19);
-    std::string real_filename(filename_buf);
-    current.close(); // Done with header file
+    // Pop the header node; packet headers may be compact, so the payload
+    // of every packet starts at its own offset
+    heap.pop();
+    uint64_t total = 0;
+    while (!heap.empty()) {
+        const std::string &packet = heap.top().filename;
+        uint64_t head = header::Packet_Header_Size(full, heap.top().split_no);
+        struct stat st;
+        if (stat(packet.c_str(), &st) != 0) {
+            std::cerr << "Failed to open packet: " << packet << "\n";
+            return false;
+        }
+        uint64_t len =
+            static_cast<uint64_t>(st.st_size) > head ? st.st_size - head : 0;
+        header::Packet_Info info;
+        if ((full.flags[0] & header::FLAG_SPARSE) &&
+            header::Read_Packet_Header(packet, info)) {
+            uint32_t part = heap.top().split_no;
+            plan.flags.resize(plan.packets.size(), 0);
+            plan.flags.push_back(info.flag);
+            if (info.flag & header::PACKET_HOLE)
+                len = header::Packet_Start(full, part + 1) -
+                      header::Packet_Start(full, part);
+        }
+        plan.packets.push_back(packet);
+        plan.heads.push_back(head);
+        plan.sizes.push_back(len);
+        plan.offsets.push_back(total);
+        plan.roots.push_back(layout::Root_Of(packet));
+        total += len;
+        heap.pop();
+    }
+    return true;
+}
 
-    // Create the empty output file with the real/original filename
-    utils::CREATE_EMPTY_FILE(real_filename);
+/*
+ * Plans a combine from the manifest alone: no scan, no packet is opened
+ * before it is read.
+ */
+inline void Plan_From_Manifest(const std::string &file_id,
+                               const manifest::Manifest &table,
+                               Combine_Plan &plan) {
+    plan.output = table.name;
+    uint32_t part = 1;
+    for (const auto &packet : table.packets) {
+        plan.packets.push_back(utils::Packet_Path(file_id, part++));
+        plan.heads.push_back(packet.header_len);
+        plan.sizes.push_back(packet.payload);
+        plan.offsets.push_back(packet.offset);
+        plan.roots.push_back(packet.root);
+        plan.crcs.push_back(packet.crc);
+        plan.flags.push_back(packet.flags);
+    }
+}
 
-    // Pop the header node
-    heap.pop();
+/*
+ * Journal of the combine writing an output file: next to it.
+ */
+inline std::string Combine_Journal_Path(const std::string &output);
 
-    std::cout << "Min-Heap contents (split_no -> filename):\n";
-    while (!heap.empty()) {
-        const auto &node = heap.top();
+/*
+ * Opens the journal of a big combine, next to the output. A rerun for the
+ * same packet set and output resumes it; the packet journaled last is
+ * checked against the output first.
+ * - @total  : size of the output
+ * - @kind   : first word of the job line, "combine" or "consume"
+ * - @return : nullptr when no journal could be written
+ */
+inline std::unique_ptr<journal::Journal>
+Open_Combine_Journal(const Combine_Plan &plan, uint64_t total,
+                     const std::string &kind = "combine");
 
-        // Read data starting from byte 15 (skipping headers)
-        auto data = utils::Fetch_Bytes(node.filename, 19);
+/*
+ * RUN_COMBINE:
+ * Rebuilds the original file on the pipeline engine, so reading the next
+ * packets overlaps with writing the output. The ranges of hole packets are
+ * left unwritten, so they are holes of the output as well. Big buffered
+ * combines keep a journal next to the output; rerun after a crash, they
+ * keep the packets already in the output and combine the rest.
+ * - @in_flight : chunks alive at once between the read and write stages
+ * - @direct    : bypass the page cache (O_DIRECT) for bulk jobs
+ * - @verify    : check every payload against the crc32c of the manifest
+ */
+inline bool RUN_COMBINE(const Combine_Plan &plan, size_t in_flight = 16,
+                        bool direct = false, bool verify = false) {
+    const std::string &real_filename = plan.output;
+    const std::vector<std::string> &packets = plan.packets;
+    const std::vector<uint64_t> &heads = plan.heads;
+    const std::vector<uint64_t> &sizes = plan.sizes;
+    const std::vector<uint64_t> &offsets = plan.offsets;
+    if (verify && plan.crcs.empty()) {
+        std::cerr << "No checksums recorded for " << real_filename
+                  << ", combining without verification\n";
+        verify = false;
+    }
 
-        // Append the data to the real/original combined output file
-        utils::Append_Bytes(real_filename, data);
+    // A consume that was interrupted owns the output: its packets are partly
+    // gone, only the consume can finish it
+    std::string job, state;
+    std::map<uint32_t, uint32_t> consumed;
+    uint32_t boundary;
+    if (journal::Load(Combine_Journal_Path(real_filename), job, state,
+                      consumed, boundary) &&
+        job.compare(0, 8, "consume ") == 0) {
+        std::cerr << "Interrupted combine --consume of " << real_filename
+                  << ": rerun it with --consume\n";
+        return false;
+    }
 
-        heap.pop();
+    // Big buffered combines are journaled. Direct output is staged in order
+    // through one writer and restarts instead.
+    std::unique_ptr<journal::Journal> log;
+    uint64_t total = 0;
+    for (size_t i = 0; i < packets.size(); i++)
+        total = std::max(total, offsets[i] + sizes[i]);
+    if (!direct && total >= journal::JOURNAL_MIN)
+        log = Open_Combine_Journal(plan, total);
+
+    // Create the empty output file with the real/original filename; a
+    // resumed combine keeps what is in it
+    int flags = O_WRONLY | O_CREAT | (log && log->Resumed() ? 0 : O_TRUNC);
+    int out_fd = direct ? buffers::Open_Direct(real_filename, flags)
+                        : ::open(real_filename.c_str(), flags | O_CLOEXEC, 0644);
+    if (out_fd < 0) {
+        std::cerr << "Failed to create file: " << real_filename << "\n";
+        return false;
+    }
+
+    // Running crc32c of every packet, checked when its last chunk passes and
+    // journaled with it
+    std::vector<uint32_t> crcs(verify || log ? packets.size() : 0, 0);
+
+    // Result of every I/O group; one that fails stops the others
+    std::atomic<bool> ok{true};
+
+    // Combines some of the packets (indexes into packets) on one engine:
+    // the I/O group of one root
+    auto run = [&](const std::vector<size_t> &group) {
+        // Buffered jobs tell the kernel which packets come next and drop the
+        // ones already combined, so the page cache holds a window, not the
+        // file
+        std::unique_ptr<cache::Readahead> ahead;
+        cache::Write_Behind behind;
+        if (!direct) {
+            std::vector<cache::Range> ranges;
+            for (size_t i : group)
+                ranges.push_back({packets[i], heads[i], sizes[i]});
+            ahead = std::make_unique<cache::Readahead>(std::move(ranges));
+        }
+
+        // Read stage: payload of each packet (after its mini header), in
+        // order, while the write stage stores the chunks read before
+        pipeline::Engine engine(in_flight);
+        for (size_t i : group)
+            engine.Expect_Packet(sizes[i]);
+        if (verify || log)
+            engine.Transform([&](pipeline::Chunk &chunk) {
+                size_t index = chunk.part - 1;
+                if (plan.Hole(index))
+                    return true;
+                crcs[index] = manifest::Crc32c(chunk.Payload(), chunk.len,
+                                               chunk.first ? 0 : crcs[index]);
+                if (verify && chunk.last && crcs[index] != plan.crcs[index]) {
+                    std::cerr << "Checksum mismatch in packet: "
+                              << packets[index] << "\n";
+                    return false;
+                }
+                return true;
+            });
+        size_t next = 0;
+        int in_fd = -1;
+        uint64_t done = 0;
+        auto read = [&](pipeline::Chunk &chunk) -> int {
+            if (!ok)
+                return -1; // another group failed
+            if (next == group.size())
+                return 0;
+            size_t index = group[next];
+            bool hole = plan.Hole(index);
+            if (in_fd < 0 && !hole) {
+                in_fd = direct ? buffers::Open_Direct(packets[index], O_RDONLY)
+                               : ahead->Open(next);
+                if (in_fd < 0) {
+                    std::cerr << "Failed to open packet: " << packets[index]
+                              << "\n";
+                    return -1;
+                }
+                done = 0;
+            }
+            chunk.part = static_cast<uint32_t>(index + 1);
+            chunk.offset = done;
+            chunk.first = done == 0;
+            chunk.len = static_cast<size_t>(
+                std::min<uint64_t>(engine.Chunk_Bytes(), sizes[index] - done));
+            uint64_t at = heads[index] + done;
+            bool ok = true;
+            if (hole) {
+                // Only direct output, staged in order, sees holes: zeros
+                // here, punched out again once written
+                chunk.skip = 0;
+                std::memset(chunk.data, 0, chunk.len);
+            } else {
+                ok = direct ? buffers::Read_Aligned(in_fd, at, chunk.len,
+                                                    chunk.data, chunk.skip)
+                            : ::pread(in_fd, chunk.data, chunk.len, at) ==
+                                  static_cast<ssize_t>(chunk.len);
+            }
+            if (!ok) {
+                std::cerr << "Failed to read packet: " << packets[index]
+                          << "\n";
+                return -1;
+            }
+            done += chunk.len;
+            chunk.last = done == sizes[index];
+            if (!direct)
+                ahead->Progress(next, done);
+            if (chunk.last) {
+                done = 0;
+                if (!direct) {
+                    ahead->Done(next);
+                } else if (!hole) {
+                    buffers::Drop_Cache(in_fd);
+                    ::close(in_fd);
+                }
+                in_fd = -1;
+                next++;
+            }
+            return 1;
+        };
+
+        // Direct output is staged into whole blocks and trimmed at the end,
+        // buffered chunks are written straight to their place in the output
+        buffers::Direct_Writer staged(
+            buffers::Shared_Pool(engine.Chunk_Bytes() + buffers::DIRECT_SLACK));
+        staged.Open(out_fd);
+        auto write = [&](pipeline::Chunk &chunk) {
+            if (direct && !staged.Write(chunk.Payload(), chunk.len)) {
+                std::cerr << "Failed to write: " << real_filename << "\n";
+                return false;
+            }
+            uint64_t at = offsets[chunk.part - 1] + chunk.offset;
+            size_t written = direct ? chunk.len : 0;
+            while (written < chunk.len) {
+                ssize_t w = ::pwrite(out_fd, chunk.Payload() + written,
+                                     chunk.len - written, at + written);
+                if (w < 0 && errno == EINTR)
+                    continue;
+                if (w < 0) {
+                    std::cerr << "Failed to write: " << real_filename << "\n";
+                    return false;
+                }
+                written += static_cast<size_t>(w);
+            }
+            if (!direct)
+                behind.Written(out_fd, at, chunk.len);
+            return !chunk.last || !log ||
+                   log->Complete(chunk.part, crcs[chunk.part - 1],
+                                 sizes[chunk.part - 1]);
+        };
+
+        bool ok = engine.Run(read, write);
+        if (ok && direct && !staged.Finish()) {
+            std::cerr << "Failed to write: " << real_filename << "\n";
+            ok = false;
+        }
+        if (in_fd >= 0 && direct)
+            ::close(in_fd);
+        behind.Drain();
+        return ok;
+    };
+
+    // Packets striped over several roots are read by one group per root, so
+    // all drives work at once. Direct output is staged in order: one group.
+    size_t roots = layout::Active().roots.size();
+    std::vector<std::vector<size_t>> groups(direct ? 1 : roots);
+    progress::Expect(total, packets.size());
+    bool holes = false;
+    for (size_t i = 0; i < packets.size(); i++) {
+        size_t root = plan.roots[i] < roots ? plan.roots[i] : 0;
+        holes = holes || plan.Hole(i);
+        bool done = log && log->Done().count(static_cast<uint32_t>(i + 1));
+        if (direct || (!plan.Hole(i) && !done))
+            groups[direct ? 0 : root].push_back(i);
+        else
+            progress::Add(sizes[i], 1);
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t g = 1; g < groups.size(); g++) {
+        if (!groups[g].empty())
+            workers.emplace_back([&, g] {
+                if (!run(groups[g]))
+                    ok = false;
+            });
+    }
+    if (!run(groups[0]))
+        ok = false;
+    for (auto &worker : workers)
+        worker.join();
+
+    // Holes at the end leave the output short; direct output has the zeros
+    // of its holes written and gives the blocks back
+    if (ok && holes && ::ftruncate(out_fd, static_cast<off_t>(total)) != 0) {
+        std::cerr << "Failed to write: " << real_filename << "\n";
+        ok = false;
+    }
+    for (size_t i = 0; ok && direct && i < packets.size(); i++) {
+        if (plan.Hole(i))
+            sparse::Punch_Hole(out_fd, offsets[i], sizes[i]);
+    }
+    if (log && ok && ::fdatasync(out_fd) == 0)
+        log->Remove();
+    else if (log)
+        log->Checkpoint();
+    ::close(out_fd);
+    return ok.load();
+}
+
+inline std::string Combine_Journal_Path(const std::string &output) {
+    std::filesystem::path path(output);
+    return (path.parent_path() /
+            (".pktcore-combine-" + path.filename().string()))
+        .string();
+}
+
+inline std::unique_ptr<journal::Journal>
+Open_Combine_Journal(const Combine_Plan &plan, uint64_t total,
+                     const std::string &kind) {
+    std::string path = Combine_Journal_Path(plan.output);
+
+    // The job is the packet set: its packets, where each one goes and what
+    // it holds
+    uint32_t fingerprint = 0;
+    for (size_t i = 0; i < plan.packets.size(); i++) {
+        uint64_t place[2] = {plan.offsets[i], plan.sizes[i]};
+        fingerprint = manifest::Crc32c(plan.packets[i].data(),
+                                       plan.packets[i].size(), fingerprint);
+        fingerprint = manifest::Crc32c(place, sizeof(place), fingerprint);
+        if (i < plan.crcs.size())
+            fingerprint = manifest::Crc32c(&plan.crcs[i], sizeof(plan.crcs[i]),
+                                           fingerprint);
+    }
+    std::string job = kind + " " + std::to_string(plan.packets.size()) + " " +
+                      std::to_string(total) + " " +
+                      std::to_string(fingerprint) + " " + plan.output;
+
+    // Without the output there is nothing to resume
+    if (::access(plan.output.c_str(), F_OK) != 0)
+        ::unlink(path.c_str());
+
+    // The output is one file: syncing it makes every packet in it durable
+    auto log = std::make_unique<journal::Journal>();
+    std::string state;
+    if (!log->Open(path, job, state, [&plan] {
+            int fd = ::open(plan.output.c_str(), O_WRONLY | O_CLOEXEC);
+            bool ok = fd >= 0 && ::fdatasync(fd) == 0;
+            if (fd >= 0)
+                ::close(fd);
+            return ok;
+        }))
+        return nullptr;
+    if (!log->Resumed())
+        return log;
+
+    // The packet journaled last may be where the crash hit: it is kept only
+    // when its range of the output has the journaled checksum
+    uint32_t last = log->Boundary();
+    auto done = log->Done().find(last);
+    if (done != log->Done().end()) {
+        uint32_t crc = 0;
+        int fd = ::open(plan.output.c_str(), O_RDONLY | O_CLOEXEC);
+        bool whole = fd >= 0 && last >= 1 && last <= plan.packets.size() &&
+                     journal::Crc_Of(fd, plan.offsets[last - 1],
+                                     plan.sizes[last - 1], crc) &&
+                     crc == done->second;
+        if (fd >= 0)
+            ::close(fd);
+        if (!whole)
+            log->Forget(last);
+    }
+    std::cout << "Resuming " << kind << ": " << log->Done().size() << " of "
+              << plan.packets.size() << " packets already in "
+              << plan.output << "\n";
+    return log;
+}
+
+/*
+ * COMBINE:
+ * Rebuilds the original file from a packet heap.
+ * - @heap      : packets of one file, full header on top
+ * - @in_flight : chunks alive at once between the read and write stages
+ * - @direct    : bypass the page cache (O_DIRECT) for bulk jobs
+ */
+inline bool COMBINE(
+    std::priority_queue<MinHeapNode, std::vector<MinHeapNode>, CompareSplitNo>
+        heap,
+    size_t in_flight = 16, bool direct = false) {
+    Combine_Plan plan;
+    return Plan_From_Heap(std::move(heap), plan) &&
+           RUN_COMBINE(plan, in_flight, direct);
+}
+
+/*
+ * Plans the combine of a packet set. Sets with a manifest are planned from
+ * part 0 alone; older ones by scanning for their packets.
+ * - @file_id : file_id of the packet set
+ * - @full    : filled with the full header of the set
+ * - @table   : filled with its manifest
+ */
+inline bool Plan_Set(const std::string &file_id, header::Full_Header &full,
+                     manifest::Manifest &table, Combine_Plan &plan) {
+    bool found =
+        manifest::READ_MANIFEST(utils::Packet_Path(file_id, 0), full, table);
+    if (found && table.version >= manifest::VERSION) {
+        Plan_From_Manifest(file_id, table, plan);
+        return true;
+    }
+    auto heap = BuildMinHeapForFile(file_id);
+    if (!found && !heap.empty() && heap.top().split_no == 0)
+        found = manifest::READ_MANIFEST(heap.top().filename, full, table);
+    return found && Plan_From_Heap(std::move(heap), plan);
+}
+
+/*
+ * COMBINE_SET:
+ * Rebuilds the original file of a packet set.
+ * - @file_id : file_id of the packet set
+ * - @verify  : check the payloads against the checksums of the manifest
+ */
+inline bool COMBINE_SET(const std::string &file_id, size_t in_flight = 16,
+                        bool direct = false, bool verify = false) {
+    header::Full_Header full;
+    manifest::Manifest table;
+    Combine_Plan plan;
+    return Plan_Set(file_id, full, table, plan) &&
+           RUN_COMBINE(plan, in_flight, direct, verify);
+}
+
+/*
+ * Reorder_Window: hands out packets in part order while they are discovered
+ * in directory order. Once `limit` out of order packets are held back, the
+ * missing part is looked up by its packet file name instead of waiting for
+ * the scan to reach it.
+ */
+class Reorder_Window {
+  public:
+    Reorder_Window(const std::string &file_id, size_t limit)
+        : file_id_(file_id), limit_(limit) {}
+
+    void Add(uint32_t split_no, const std::string &filename) {
+        if (split_no >= next_)
+            pending_.emplace(split_no, filename);
+    }
+
+    bool Full() const { return pending_.size() >= limit_; }
+
+    /*
+     * Returns the file of the next part if it is known, else an empty
+     * string. With force set, the default packet name is tried as well.
+     */
+    std::string Next(bool force) {
+        auto it = pending_.find(next_);
+        if (it != pending_.end()) {
+            std::string filename = it->second;
+            pending_.erase(it);
+            next_++;
+            return filename;
+        }
+        if (force) {
+            std::string filename = utils::Packet_Path(file_id_, next_);
+            std::string id;
+            uint32_t split_no;
+            if (Read_Packet_Tag(filename, id, split_no) && id == file_id_ &&
+                split_no == next_) {
+                next_++;
+                return filename;
+            }
+        }
+        return "";
+    }
+
+    uint32_t Expected() const { return next_; }
+
+  private:
+    std::string file_id_;
+    size_t limit_;
+    uint32_t next_ = 1;
+    std::map<uint32_t, std::string> pending_;
+};
+
+/*
+ * COMBINE_STREAM:
+ * Writes the payloads of a packet set to a descriptor in part order, while
+ * the directory is still being scanned, instead of building a file first.
+ * - @file_id : file_id of the packet set
+ * - @out_fd  : destination, e.g. STDOUT_FILENO
+ * - @window  : how many out of order packets may be held back
+ */
+inline bool COMBINE_STREAM(const std::string &file_id, int out_fd,
+                           size_t window = 64) {
+    // The packet count is known once the full header is found, either under
+    // its default name or later during the scan
+    header::Full_Header full;
+    bool have_header =
+        header::READ_FULL_HEADER(utils::Packet_Path(file_id, 0), full);
+    uint32_t packets = have_header ? header::Packets_Of(full) : UINT32_MAX;
+    if (have_header)
+        progress::Expect(header::File_Size_Of(full), packets);
+
+    struct stat st;
+    bool out_is_pipe = fstat(out_fd, &st) == 0 && S_ISFIFO(st.st_mode);
+
+    // Holes are sought over in a regular output file and written as zeros
+    // anywhere else
+    bool seek_holes = !out_is_pipe && S_ISREG(st.st_mode) &&
+                      !(::fcntl(out_fd, F_GETFL) & O_APPEND);
+    bool sought = false;
+    auto finish = [&] {
+        struct stat now;
+        off_t end = ::lseek(out_fd, 0, SEEK_CUR);
+        return !sought || (end >= 0 && fstat(out_fd, &now) == 0 &&
+                           (now.st_size >= end ||
+                            ::ftruncate(out_fd, end) == 0));
+    };
+
+    auto emit = [&](const std::string &filename) {
+        int in_fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in_fd < 0) {
+            std::cerr << "Could not open packet: " << filename << "\n";
+            return false;
+        }
+        struct stat pst;
+        header::Packet_Info info;
+        bool ok = fstat(in_fd, &pst) == 0 &&
+                  header::Read_Packet_Header(in_fd, info) &&
+                  pst.st_size >= static_cast<off_t>(info.header_len);
+        if (ok && (info.flag & header::PACKET_HOLE)) {
+            // Compact headers do not say how long the hole is
+            uint64_t len = info.payload_len;
+            if (info.compact)
+                len = have_header ? header::Packet_Start(full, info.part + 1) -
+                                        header::Packet_Start(full, info.part)
+                                  : 0;
+            ok = (!info.compact || have_header) &&
+                 Write_Hole(out_fd, len, seek_holes);
+            sought = sought || seek_holes;
+            progress::Add(len, 1);
+        } else if (ok) {
+            size_t len = pst.st_size - info.header_len;
+            ok = Copy_Range(in_fd, info.header_len, len, out_fd, out_is_pipe);
+            progress::Add(len, 1);
+        }
+        ::close(in_fd);
+        if (!ok)
+            std::cerr << "Failed to copy packet: " << filename << "\n";
+        return ok;
+    };
+
+    // A manifest names every packet: nothing to scan or reorder
+    manifest::Manifest table;
+    if (have_header && (full.flags[0] & header::FLAG_MANIFEST)) {
+        if (!manifest::READ_MANIFEST(utils::Packet_Path(file_id, 0), full,
+                                     table))
+            return false;
+        for (uint32_t part = 1; part <= table.packets.size(); part++) {
+            if (!emit(utils::Packet_Path(file_id, part)))
+                return false;
+        }
+        return finish();
+    }
+
+    Reorder_Window order(file_id, window);
+
+    for (const auto &file : layout::Files()) {
+        if (order.Expected() > packets)
+            break;
+        std::string id;
+        uint32_t split_no;
+        if (!Read_Packet_Tag(file, id, split_no) || id != file_id)
+            continue;
+        if (split_no == 0) {
+            if (!have_header && header::READ_FULL_HEADER(file, full)) {
+                have_header = true;
+                packets = header::Packets_Of(full);
+                progress::Expect(header::File_Size_Of(full), packets);
+            }
+            continue;
+        }
+        order.Add(split_no, file);
+
+        for (std::string next = order.Next(order.Full()); !next.empty();
+             next = order.Next(order.Full())) {
+            if (!emit(next))
+                return false;
+            if (order.Expected() > packets)
+                break;
+        }
+    }
+
+    if (!have_header) {
+        std::cerr << "Failed to find the full header of the packet set\n";
+        return false;
+    }
+    while (order.Expected() <= packets) {
+        std::string next = order.Next(true);
+        if (next.empty()) {
+            std::cerr << "Missing packet " << order.Expected() << " of "
+                      << packets << "\n";
+            return false;
+        }
+        if (!emit(next))
+            return false;
     }
+    return finish();
 }
 } // namespace combiner
@@ -0,0 +1,211 @@
+#pragma once
+#include "combiner.h"
+#include "full_header.h"
+#include "journal.h"
+#include "manifest.h"
+#include "pkt_utils.h"
+#include "progress.h"
+#include "sparse.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Consume module namespace: combines a packet set while giving its space
+ * back, for volumes without room for the output next to the packets.
+ * Packets are copied into the output in part order with copy_file_range, so
+ * a filesystem that can share extents does, and each one is checked against
+ * the crc32c of the manifest. Every WINDOW bytes the output is synced, the
+ * packets now in it are journaled as done and then unlinked as one batch.
+ * A packet bigger than the window is punched out (FALLOC_FL_PUNCH_HOLE) a
+ * window at a time as its payload reaches the output. Extra disk use stays
+ * at about one window instead of a second copy of the file. A consume that
+ * was killed resumes when rerun; part 0 and the journal are removed last.
+ */
+namespace consume {
+
+constexpr uint64_t WINDOW = journal::CHECKPOINT_BYTES;
+
+/*
+ * CONSUME:
+ * Rebuilds the original file of a packet set and deletes the set.
+ * - @file_id : file_id of the packet set
+ * - @output  : where to write the file, empty for the name it was split from
+ * - @return  : false when a packet is missing, damaged or could not be
+ *              copied; packets not yet in the output are kept
+ */
+inline bool CONSUME(const std::string &file_id, const std::string &output = "");
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+
+/*
+ * Copies the payload of a packet into the output from byte `from` on. A
+ * packet bigger than the window gives back the whole blocks the output holds
+ * durably after every window.
+ * - @crc : chained over the range of the output written
+ */
+inline bool Copy_Packet(int in_fd, uint64_t head, uint64_t size, uint64_t from,
+                        int out_fd, uint64_t offset, uint64_t block,
+                        uint32_t &crc) {
+    uint64_t punched =
+        from > 0 ? head + from : (head + block - 1) / block * block;
+    for (uint64_t at = from; at < size;) {
+        uint64_t len = std::min(size - at, WINDOW);
+        if (!Copy_To_Offset(in_fd, static_cast<off_t>(head + at),
+                            static_cast<size_t>(len), out_fd,
+                            static_cast<off_t>(offset + at)) ||
+            !journal::Crc_Of(out_fd, offset + at, len, crc))
+            return false;
+        at += len;
+        progress::Add(len, at == size ? 1 : 0);
+        if (size <= WINDOW)
+            continue;
+        uint64_t to = (head + at) / block * block;
+        if (to > punched) {
+            if (::fdatasync(out_fd) != 0)
+                return false;
+            sparse::Punch_Hole(in_fd, punched, to - punched);
+            punched = to;
+        }
+    }
+    return true;
+}
+
+inline bool CONSUME(const std::string &file_id, const std::string &output) {
+    header::Full_Header full;
+    manifest::Manifest table;
+    combiner::Combine_Plan plan;
+    std::string first = utils::Packet_Path(file_id, 0);
+    if (!combiner::Plan_Set(file_id, full, table, plan))
+        return false;
+    // Once packets are gone a scan cannot plan the set any more
+    if (table.version < manifest::VERSION || plan.crcs.empty()) {
+        std::cerr << "No manifest in " << first
+                  << ": repack the set before consuming it\n";
+        return false;
+    }
+    if (!output.empty())
+        plan.output = output;
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < plan.packets.size(); i++)
+        total = std::max(total, plan.offsets[i] + plan.sizes[i]);
+    auto log = combiner::Open_Combine_Journal(plan, total, "consume");
+    if (!log)
+        return false;
+    int out_fd = ::open(plan.output.c_str(),
+                        O_RDWR | O_CREAT | (log->Resumed() ? 0 : O_TRUNC) |
+                            O_CLOEXEC,
+                        0644);
+    if (out_fd < 0) {
+        std::cerr << "Failed to create file: " << plan.output << "\n";
+        return false;
+    }
+
+    // The output first, then the journal saying what it holds, then the
+    // packets go. Packets already gone (a resumed run) are fine.
+    std::vector<std::string> batch;
+    uint64_t pending = 0;
+    auto release = [&] {
+        if (!log->Checkpoint())
+            return false;
+        for (const auto &path : batch) {
+            if (::unlink(path.c_str()) != 0 && errno != ENOENT)
+                std::cerr << "Could not delete packet: " << path << "\n";
+        }
+        batch.clear();
+        pending = 0;
+        return true;
+    };
+
+    progress::Expect(total, plan.packets.size());
+    bool ok = true;
+    for (size_t i = 0; ok && i < plan.packets.size(); i++) {
+        const std::string &path = plan.packets[i];
+        uint32_t part = static_cast<uint32_t>(i + 1);
+        uint64_t head = plan.heads[i], size = plan.sizes[i];
+        if (plan.Hole(i) || log->Done().count(part)) {
+            // Holes stay unwritten; packets journaled are in the output
+            progress::Add(size, 1);
+            batch.push_back(path);
+            continue;
+        }
+
+        int in_fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        struct stat st;
+        if (in_fd < 0 || fstat(in_fd, &st) != 0 ||
+            static_cast<uint64_t>(st.st_size) != head + size) {
+            std::cerr << "Failed to open packet: " << path << "\n";
+            if (in_fd >= 0)
+                ::close(in_fd);
+            ok = false;
+            break;
+        }
+
+        // A big packet an interrupted run punched holds only its tail: the
+        // output has everything before its first data
+        uint64_t block = st.st_blksize > 0 ? st.st_blksize : 4096;
+        uint64_t from = 0;
+        uint32_t crc = 0;
+        if (size > WINDOW) {
+            uint64_t start, end;
+            uint64_t aligned = (head + block - 1) / block * block;
+            if (!sparse::Next_Data(in_fd, aligned, head + size, start, end))
+                from = size;
+            else if (start > aligned)
+                from = start - head;
+            if (from > 0 &&
+                !journal::Crc_Of(out_fd, plan.offsets[i], from, crc))
+                ok = false;
+            progress::Add(from, from == size ? 1 : 0);
+        }
+        ok = ok && Copy_Packet(in_fd, head, size, from, out_fd,
+                               plan.offsets[i], block, crc);
+        ::close(in_fd);
+        if (!ok) {
+            std::cerr << "Failed to copy packet: " << path << "\n";
+            break;
+        }
+        if (crc != plan.crcs[i]) {
+            std::cerr << "Checksum mismatch in packet: " << path << "\n";
+            ok = false;
+            break;
+        }
+
+        ok = log->Complete(part, crc, size);
+        batch.push_back(path);
+        pending += size;
+        if (ok && (pending >= WINDOW ||
+                   batch.size() >= journal::CHECKPOINT_PARTS))
+            ok = release();
+    }
+
+    // Holes at the end leave the output short
+    if (ok && (::ftruncate(out_fd, static_cast<off_t>(total)) != 0 ||
+               ::fdatasync(out_fd) != 0)) {
+        std::cerr << "Failed to write: " << plan.output << "\n";
+        ok = false;
+    }
+    ok = ok && release();
+    ::close(out_fd);
+    if (!ok) {
+        log->Checkpoint();
+        return false;
+    }
+
+    // Part 0 before the journal: a rerun then finds no set to consume
+    // rather than starting over
+    ::unlink(first.c_str());
+    log->Remove();
+    return true;
+}
+} // namespace consume
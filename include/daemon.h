@@ -0,0 +1,470 @@
+#pragma once
+#include "batch.h"
+#include "catalog.h"
+#include "full_header.h"
+#include "pkt_utils.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Daemon module namespace: pktcored, one resident pktcore process.
+ * It keeps a worker pool and a warm packet catalog alive between requests,
+ * so interactive tools (the GUI) no longer pay a process spawn and a cold
+ * directory scan for every action.
+ *
+ * Protocol: one JSON object per line over a Unix-domain socket.
+ *   request  : {"id":1,"op":"split","file":"a.iso","packet_size":1048576}
+ *              {"id":2,"op":"combine","name":"a.iso","output":"b.iso"}
+ *              {"id":3,"op":"list"}   {"id":4,"op":"status"}
+ *              {"id":5,"op":"shutdown"}
+ *   events   : {"id":1,"event":"progress","done":3,"total":10}
+ *   response : {"id":1,"event":"result","ok":true,...}
+ */
+namespace pktcored {
+
+/*
+ * Socket used when none is given: $XDG_RUNTIME_DIR/pktcored.sock, or
+ * /tmp/pktcored-<uid>.sock.
+ */
+inline std::string Default_Socket_Path();
+
+/*
+ * Parses a flat JSON object (string, number and boolean values) into a map
+ * of raw values. Returns false on anything else.
+ */
+inline bool Parse_Request(const std::string &line,
+                          std::map<std::string, std::string> &fields);
+
+/*
+ * Runs the daemon until a shutdown request arrives.
+ * - @socket_path : Unix socket to listen on
+ * - @threads     : workers, 0 for one per hardware thread
+ */
+inline bool SERVE(const std::string &socket_path, size_t threads = 0);
+
+/*
+ * Sends one request to a running daemon and prints every line it answers
+ * until the final result.
+ */
+inline bool RPC_CALL(const std::string &socket_path, const std::string &request);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+inline std::string Default_Socket_Path() {
+    const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime)
+        return std::string(runtime) + "/pktcored.sock";
+    return "/tmp/pktcored-" + std::to_string(getuid()) + ".sock";
+}
+
+inline bool Parse_Request(const std::string &line,
+                          std::map<std::string, std::string> &fields) {
+    size_t pos = 0;
+    auto skip_space = [&] {
+        while (pos < line.size() && isspace(static_cast<unsigned char>(line[pos])))
+            pos++;
+    };
+    auto parse_string = [&](std::string &out) {
+        if (pos >= line.size() || line[pos] != '"')
+            return false;
+        for (pos++; pos < line.size(); pos++) {
+            char c = line[pos];
+            if (c == '"') {
+                pos++;
+                return true;
+            }
+            if (c == '\\' && pos + 1 < line.size()) {
+                c = line[++pos];
+                if (c == 'n')
+                    c = '\n';
+                else if (c == 't')
+                    c = '\t';
+            }
+            out += c;
+        }
+        return false;
+    };
+
+    fields.clear();
+    skip_space();
+    if (pos >= line.size() || line[pos++] != '{')
+        return false;
+    skip_space();
+    if (pos < line.size() && line[pos] == '}')
+        return true;
+
+    while (pos < line.size()) {
+        std::string key, value;
+        skip_space();
+        if (!parse_string(key))
+            return false;
+        skip_space();
+        if (pos >= line.size() || line[pos++] != ':')
+            return false;
+        skip_space();
+        if (pos < line.size() && line[pos] == '"') {
+            if (!parse_string(value))
+                return false;
+        } else {
+            while (pos < line.size() && line[pos] != ',' && line[pos] != '}' &&
+                   !isspace(static_cast<unsigned char>(line[pos])))
+                value += line[pos++];
+            if (value.empty() || value[0] == '{' || value[0] == '[')
+                return false;
+        }
+        fields[key] = value;
+        skip_space();
+        if (pos < line.size() && line[pos] == ',') {
+            pos++;
+            continue;
+        }
+        return pos < line.size() && line[pos] == '}';
+    }
+    return false;
+}
+
+/*
+ * Connection: one client socket. Workers answer from their own threads, so
+ * every line is written under a lock; the socket closes with the last job
+ * that still holds the connection.
+ */
+struct Connection {
+    int fd;
+    std::mutex lock;
+
+    explicit Connection(int socket_fd) : fd(socket_fd) {}
+    ~Connection() { ::close(fd); }
+
+    void Send(const std::string &line) {
+        std::lock_guard<std::mutex> guard(lock);
+        std::string data = line + "\n";
+        for (size_t done = 0; done < data.size();) {
+            ssize_t w = ::send(fd, data.data() + done, data.size() - done,
+                               MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return; // client went away, the job still runs to the end
+            done += static_cast<size_t>(w);
+        }
+    }
+};
+
+class Daemon {
+  public:
+    explicit Daemon(size_t threads)
+        : pool_(threads), started_(std::chrono::steady_clock::now()) {}
+
+    bool Serve(const std::string &socket_path);
+
+  private:
+    void Handle_Client(std::shared_ptr<Connection> conn);
+    void Handle_Request(const std::shared_ptr<Connection> &conn,
+                        const std::string &line);
+    batch::Job_Callback Reporter(const std::shared_ptr<Connection> &conn,
+                                 const std::string &id);
+
+    sched::Work_Stealing_Pool pool_;
+    catalog::Catalog catalog_;
+    std::chrono::steady_clock::time_point started_;
+    std::atomic<size_t> jobs_{0};
+    std::atomic<bool> stopping_{false};
+    int listen_fd_ = -1;
+
+    std::mutex clients_lock_;
+    std::vector<int> client_fds_; // sockets of the clients still reading
+    std::map<std::thread::id, std::thread> clients_; // one per client
+    std::vector<std::thread::id> finished_; // client threads left to join
+};
+
+inline batch::Job_Callback
+Daemon::Reporter(const std::shared_ptr<Connection> &conn,
+                 const std::string &id) {
+    jobs_++;
+    return [this, conn, id](uint64_t done, uint64_t total, bool ok) {
+        if (done < total) {
+            conn->Send("{\"id\":" + id + ",\"event\":\"progress\",\"done\":" +
+                       std::to_string(done) + ",\"total\":" +
+                       std::to_string(total) + "}");
+            return;
+        }
+        jobs_--;
+        conn->Send("{\"id\":" + id + ",\"event\":\"result\",\"ok\":" +
+                   (ok ? "true" : "false") + ",\"packets\":" +
+                   std::to_string(total) + "}");
+    };
+}
+
+inline void Daemon::Handle_Request(const std::shared_ptr<Connection> &conn,
+                                   const std::string &line) {
+    std::map<std::string, std::string> req;
+    if (!Parse_Request(line, req)) {
+        conn->Send("{\"id\":0,\"event\":\"result\",\"ok\":false,"
+                   "\"error\":\"malformed request\"}");
+        return;
+    }
+    std::string id = req.count("id") ? req["id"] : "0";
+    if (id.empty() || id.find_first_not_of("0123456789") != std::string::npos)
+        id = utils::Json_String(id);
+    std::string op = req["op"];
+    auto fail = [&](const std::string &error) {
+        conn->Send("{\"id\":" + id + ",\"event\":\"result\",\"ok\":false," +
+                   "\"error\":" + utils::Json_String(error) + "}");
+    };
+
+    if (op == "split") {
+        std::string file = req["file"];
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(file, ec);
+        if (file.empty() || ec)
+            return fail("cannot read file: " + file);
+
+        uint64_t packet_size = 1024 * 1024;
+        if (!req["packet_size"].empty())
+            packet_size = std::strtoull(req["packet_size"].c_str(), nullptr, 10);
+        else if (!req["splits"].empty()) {
+            uint64_t splits = std::strtoull(req["splits"].c_str(), nullptr, 10);
+            if (splits > 0)
+                packet_size = (size + splits - 1) / splits;
+        }
+        if (packet_size == 0 || packet_size > UINT32_MAX)
+            return fail("invalid packet size");
+
+        std::string name = req["name"];
+        if (name.empty())
+            name = std::filesystem::path(file).filename().string();
+        batch::Queue_Split_File(pool_, file, name,
+                                static_cast<uint32_t>(packet_size),
+                                Reporter(conn, id));
+
+    } else if (op == "combine") {
+        catalog_.Refresh();
+        catalog::Packet_Set set;
+        if (!catalog_.Find(req["name"], set))
+            return fail("no PCORE file named " + req["name"]);
+        if (!set.Complete())
+            return fail("packet set is incomplete");
+
+        std::string output = req["output"].empty() ? set.name : req["output"];
+        auto report = Reporter(conn, id);
+        if (!batch::Queue_Combine_Set(pool_, set.full, std::move(set.parts),
+                                      output, report))
+            report(0, 0, false);
+
+    } else if (op == "list") {
+        catalog_.Refresh();
+        std::string sets;
+        for (const auto &set : catalog_.Sets()) {
+            if (!set.has_header)
+                continue;
+            if (!sets.empty())
+                sets += ",";
+            sets += "{\"name\":" + utils::Json_String(set.name) + ",\"packet\":" +
+                    utils::Json_String(utils::Packet_File_Name(set.file_id, 0)) +
+                    ",\"packets\":" +
+                    std::to_string(header::Packets_Of(set.full)) +
+                    ",\"size\":" +
+                    std::to_string(header::File_Size_Of(set.full)) +
+                    ",\"complete\":" + (set.Complete() ? "true" : "false") +
+                    "}";
+        }
+        conn->Send("{\"id\":" + id + ",\"event\":\"result\",\"ok\":true," +
+                   "\"sets\":[" + sets + "]}");
+
+    } else if (op == "status") {
+        auto uptime = std::chrono::duration_cast<std::chrono::seconds>(
+                          std::chrono::steady_clock::now() - started_)
+                          .count();
+        conn->Send("{\"id\":" + id + ",\"event\":\"result\",\"ok\":true," +
+                   "\"threads\":" + std::to_string(pool_.Size()) +
+                   ",\"jobs\":" + std::to_string(jobs_.load()) +
+                   ",\"files\":" + std::to_string(catalog_.Files()) +
+                   ",\"uptime\":" + std::to_string(uptime) + "}");
+
+    } else if (op == "shutdown") {
+        conn->Send("{\"id\":" + id + ",\"event\":\"result\",\"ok\":true}");
+        stopping_ = true;
+        ::shutdown(listen_fd_, SHUT_RDWR); // wakes up accept()
+
+    } else {
+        fail("unknown op: " + op);
+    }
+}
+
+inline void Daemon::Handle_Client(std::shared_ptr<Connection> conn) {
+    std::string pending;
+    char buf[4096];
+    while (true) {
+        ssize_t got = ::recv(conn->fd, buf, sizeof(buf), 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        pending.append(buf, static_cast<size_t>(got));
+
+        size_t newline;
+        while ((newline = pending.find('\n')) != std::string::npos) {
+            std::string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            if (!line.empty())
+                Handle_Request(conn, line);
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(clients_lock_);
+    client_fds_.erase(
+        std::find(client_fds_.begin(), client_fds_.end(), conn->fd));
+    finished_.push_back(std::this_thread::get_id());
+}
+
+inline bool Daemon::Serve(const std::string &socket_path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << socket_path << "\n";
+        return false;
+    }
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    // A socket file nobody answers on was left behind by a daemon that
+    // crashed; one that answers belongs to a live daemon and is kept
+    int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool live = probe >= 0 &&
+                ::connect(probe, reinterpret_cast<sockaddr *>(&addr),
+                          sizeof(addr)) == 0;
+    bool stale = !live && errno == ECONNREFUSED;
+    if (probe >= 0)
+        ::close(probe);
+    if (live) {
+        std::cerr << "pktcored is already running on: " << socket_path << "\n";
+        return false;
+    }
+    if (stale)
+        ::unlink(socket_path.c_str());
+
+    listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0 ||
+        ::bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ||
+        ::listen(listen_fd_, 64)) {
+        std::cerr << "Failed to listen on: " << socket_path << "\n";
+        return false;
+    }
+
+    catalog_.Refresh();
+    std::cout << "pktcored listening on " << socket_path << " with "
+              << pool_.Size() << " workers" << std::endl;
+
+    while (!stopping_) {
+        int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        // The thread registers itself under the lock, so it is in
+        // clients_ before it can report itself finished
+        std::vector<std::thread> done;
+        {
+            std::lock_guard<std::mutex> guard(clients_lock_);
+            client_fds_.push_back(fd);
+            std::thread client([this, fd] {
+                Handle_Client(std::make_shared<Connection>(fd));
+            });
+            clients_.emplace(client.get_id(), std::move(client));
+            for (const auto &id : finished_) {
+                auto it = clients_.find(id);
+                done.push_back(std::move(it->second));
+                clients_.erase(it);
+            }
+            finished_.clear();
+        }
+        for (auto &client : done)
+            client.join();
+    }
+
+    // Let running jobs finish, then wake up the client threads and join
+    // them: the Daemon must outlive every one of them
+    pool_.Wait();
+    std::map<std::thread::id, std::thread> running;
+    {
+        std::lock_guard<std::mutex> guard(clients_lock_);
+        for (int fd : client_fds_)
+            ::shutdown(fd, SHUT_RD);
+        running.swap(clients_);
+        finished_.clear();
+    }
+    for (auto &client : running)
+        client.second.join();
+    ::close(listen_fd_);
+    ::unlink(socket_path.c_str());
+    return true;
+}
+
+inline bool SERVE(const std::string &socket_path, size_t threads) {
+    Daemon pktcored(threads);
+    return pktcored.Serve(socket_path);
+}
+
+inline bool RPC_CALL(const std::string &socket_path,
+                     const std::string &request) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path))
+        return false;
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 ||
+        ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+        std::cerr << "pktcored is not running on: " << socket_path << "\n";
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+
+    auto conn = std::make_shared<Connection>(fd);
+    conn->Send(request);
+
+    std::string pending;
+    char buf[4096];
+    while (true) {
+        ssize_t got = ::recv(fd, buf, sizeof(buf), 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        pending.append(buf, static_cast<size_t>(got));
+
+        size_t newline;
+        while ((newline = pending.find('\n')) != std::string::npos) {
+            std::string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            std::cout << line << std::endl;
+
+            if (line.find("\"event\":\"result\"") != std::string::npos)
+                return line.find("\"ok\":true") != std::string::npos;
+        }
+    }
+    return false;
+}
+} // namespace pktcored
@@ -0,0 +1,471 @@
+#pragma once
+#include "full_header.h"
+#include "journal.h"
+#include "layout.h"
+#include "manifest.h"
+#include "mini_header.h"
+#include "pkt_utils.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Fsck module namespace: checks the structure of a packet directory.
+ * Every file is looked at once, by the parallel walk of layout.h: one pread
+ * for a packet header, a mapping of the whole file for a full header with
+ * its manifest. The findings are then cross-checked per file_id and printed
+ * as one JSON report:
+ *   bad_packets : headers that disagree with their own file (payload_len vs
+ *                 bytes stored) or with their set (size, header variant,
+ *                 part number out of range)
+ *   duplicates  : one part of a set stored in several files
+ *   collisions  : one file_id used by different sets
+ *   orphans     : packets without a part 0 (in_progress when a split
+ *                 journal says the set is still being written)
+ *   incomplete  : sets with parts missing
+ * Payloads are not read; `combine --verify` checks those.
+ */
+namespace fsck {
+
+/*
+ * Checks the packet directories and prints the report to stdout.
+ * - @roots   : comma separated directories; a stripe set is checked whole
+ * - @threads : workers, 0 for one per hardware thread
+ * - @return  : true when nothing is wrong
+ */
+inline bool FSCK(const std::string &roots, size_t threads = 0);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+
+// Missing parts listed per incomplete set; the rest are only counted
+constexpr size_t MAX_LISTED = 16;
+
+using File_ID = std::array<uint8_t, 5>;
+
+/*
+ * What one packet file says about itself.
+ */
+struct Record {
+    File_ID id{};
+    uint32_t part = 0;
+    bool compact = false;
+    bool hole = false;
+    uint32_t payload_len = 0; // standard headers only
+    uint64_t stored = 0;      // bytes after the header
+    std::string path;
+};
+
+/*
+ * What one part 0 file says about its set.
+ */
+struct Set_Header {
+    File_ID id{};
+    std::string path;
+    bool damaged = false; // manifest unreadable
+    header::Full_Header full{};
+    manifest::Manifest table;
+};
+
+inline std::string Hex_Of(const File_ID &id) {
+    return utils::Packet_File_Name(id, 0).substr(0, 2 * id.size());
+}
+
+inline bool Id_Of(const std::string &hex, File_ID &id) {
+    if (hex.size() != 2 * id.size() ||
+        hex.find_first_not_of("0123456789ABCDEFabcdef") != std::string::npos)
+        return false;
+    for (size_t i = 0; i < id.size(); i++)
+        id[i] = static_cast<uint8_t>(
+            std::stoul(hex.substr(2 * i, 2), nullptr, 16));
+    return true;
+}
+
+/*
+ * Reads a part 0 file through a mapping: the full header, then the manifest
+ * behind it when the set has one.
+ */
+inline bool Read_Set_Header(int fd, uint64_t size, Set_Header &set) {
+    if (size < header::FULL_HEADER_SIZE)
+        return false;
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+    const uint8_t *data = static_cast<const uint8_t *>(map);
+    std::memcpy(&set.full, data, header::FULL_HEADER_SIZE);
+    if (!(set.full.flags[0] & header::FLAG_MANIFEST))
+        set.table = manifest::Build(set.full, header::Name_Of(set.full), {});
+    else
+        set.damaged =
+            !manifest::Decode(data + header::FULL_HEADER_SIZE,
+                              size - header::FULL_HEADER_SIZE, set.table) ||
+            set.table.packets.size() != header::Packets_Of(set.full);
+    ::munmap(map, size);
+    return true;
+}
+
+/*
+ * Payload bytes the set expects in a part.
+ */
+inline uint64_t Expected_Payload(const Set_Header &set, uint32_t part) {
+    if (!set.damaged && part <= set.table.packets.size())
+        return set.table.packets[part - 1].payload;
+    return header::Packet_Start(set.full, part + 1) -
+           header::Packet_Start(set.full, part);
+}
+
+inline bool FSCK(const std::string &roots, size_t threads) {
+    auto started = std::chrono::steady_clock::now();
+
+    // The directories as they are: nothing is created, markers only read
+    layout::Layout where;
+    where.roots.clear();
+    std::stringstream list(roots);
+    for (std::string dir; std::getline(list, dir, ',');) {
+        if (dir.empty())
+            continue;
+        if (!std::filesystem::is_directory(dir)) {
+            std::cerr << "Not a directory: " << dir << "\n";
+            return false;
+        }
+        layout::Marker marker;
+        if (layout::Load(dir, marker))
+            where.levels = std::max(where.levels, marker.levels);
+        where.roots.push_back(dir);
+    }
+    if (where.roots.empty())
+        where.roots.push_back(".");
+
+    std::vector<Record> records;
+    std::vector<Set_Header> sets;
+    std::vector<std::string> unreadable, truncated;
+    size_t files = 0, foreign = 0;
+    std::mutex lock;
+    layout::For_Each_File(
+        [&](const std::string &path) {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            uint8_t head[header::FULL_HEADER_SIZE];
+            ssize_t got = -1;
+            if (fd >= 0 && fstat(fd, &st) == 0)
+                got = ::pread(fd, head, sizeof(head), 0);
+
+            Record record;
+            header::Packet_Info info;
+            bool packet = got > 0 &&
+                          header::Parse_Packet_Header(
+                              head, static_cast<size_t>(got), info);
+            // A compact header is one magic byte: only trusted under the
+            // name it was written as
+            if (packet && info.compact)
+                packet = std::filesystem::path(path).filename() ==
+                         utils::Packet_File_Name(info.file_id, info.part);
+            Set_Header set;
+            bool is_set = packet && !info.compact && info.part == 0;
+            bool short_set = false;
+            if (is_set) {
+                set.id = info.file_id;
+                set.path = path;
+                is_set = Read_Set_Header(fd, st.st_size, set);
+                short_set = !is_set;
+            }
+            if (packet && !is_set) {
+                record.id = info.file_id;
+                record.part = info.part;
+                record.compact = info.compact;
+                record.hole = info.flag & header::PACKET_HOLE;
+                record.payload_len = info.payload_len;
+                record.stored =
+                    static_cast<uint64_t>(st.st_size) > info.header_len
+                        ? st.st_size - info.header_len
+                        : 0;
+                record.path = path;
+            }
+            if (fd >= 0)
+                ::close(fd);
+
+            std::lock_guard<std::mutex> guard(lock);
+            files++;
+            if (got < 0)
+                unreadable.push_back(path);
+            else if (is_set)
+                sets.push_back(std::move(set));
+            else if (short_set)
+                truncated.push_back(path);
+            else if (packet && info.part > 0)
+                records.push_back(std::move(record));
+            else
+                foreign++;
+        },
+        where, threads);
+
+    // Sets whose split is still running (or was killed and not resumed)
+    std::set<File_ID> journaled;
+    for (const auto &root : where.roots) {
+        std::error_code ec;
+        for (const auto &entry :
+             std::filesystem::directory_iterator(root, ec)) {
+            std::string name = entry.path().filename().string();
+            std::string job, state;
+            std::map<uint32_t, uint32_t> done;
+            uint32_t last;
+            File_ID id;
+            if (name.compare(0, 15, ".pktcore-split-") == 0 &&
+                journal::Load(entry.path().string(), job, state, done, last) &&
+                Id_Of(state, id))
+                journaled.insert(id);
+        }
+    }
+
+    std::sort(records.begin(), records.end(),
+              [](const Record &a, const Record &b) {
+                  if (a.id != b.id)
+                      return a.id < b.id;
+                  return a.part != b.part ? a.part < b.part : a.path < b.path;
+              });
+    std::sort(sets.begin(), sets.end(),
+              [](const Set_Header &a, const Set_Header &b) {
+                  return a.id != b.id ? a.id < b.id : a.path < b.path;
+              });
+
+    std::vector<std::string> bad, duplicates, collisions, orphans, incomplete;
+    auto item = [](const std::vector<std::pair<std::string, std::string>>
+                       &fields) {
+        std::string out = "{";
+        for (const auto &[key, value] : fields)
+            out += (out.size() > 1 ? ", \"" : "\"") + key + "\": " + value;
+        return out + "}";
+    };
+    auto quoted = utils::Json_String;
+    auto paths = [&](const std::vector<std::string> &list) {
+        std::string out = "[";
+        for (const auto &path : list)
+            out += (out.size() > 1 ? ", " : "") + quoted(path);
+        return out + "]";
+    };
+
+    for (const auto &path : truncated)
+        bad.push_back(item({{"path", quoted(path)},
+                            {"part", "0"},
+                            {"problem", quoted("truncated full header")}}));
+
+    // Part 0 files: one per file_id, or several copies of the same header
+    std::map<File_ID, const Set_Header *> set_of;
+    for (size_t i = 0; i < sets.size();) {
+        size_t end = i;
+        std::vector<std::string> copies, names;
+        bool differ = false;
+        for (; end < sets.size() && sets[end].id == sets[i].id; end++) {
+            copies.push_back(sets[end].path);
+            names.push_back(sets[end].table.name);
+            differ = differ ||
+                     std::memcmp(&sets[end].full, &sets[i].full,
+                                 header::FULL_HEADER_SIZE) != 0;
+            if (sets[end].damaged)
+                bad.push_back(item({{"path", quoted(sets[end].path)},
+                                    {"file_id", quoted(Hex_Of(sets[end].id))},
+                                    {"part", "0"},
+                                    {"problem", quoted("damaged manifest")}}));
+        }
+        if (differ) {
+            std::string list = "[";
+            for (const auto &name : names)
+                list += (list.size() > 1 ? ", " : "") + quoted(name);
+            collisions.push_back(item({{"file_id", quoted(Hex_Of(sets[i].id))},
+                                       {"names", list + "]"},
+                                       {"paths", paths(copies)}}));
+        } else if (copies.size() > 1) {
+            duplicates.push_back(item({{"file_id", quoted(Hex_Of(sets[i].id))},
+                                       {"part", "0"},
+                                       {"paths", paths(copies)}}));
+        }
+        set_of[sets[i].id] = &sets[i];
+        i = end;
+    }
+    size_t set_count = set_of.size();
+
+    // Packets, one file_id at a time
+    size_t complete = 0;
+    for (size_t i = 0; i < records.size();) {
+        const File_ID id = records[i].id;
+        auto found = set_of.find(id);
+        const Set_Header *set = found == set_of.end() ? nullptr : found->second;
+        uint32_t packets = set ? header::Packets_Of(set->full) : 0;
+        bool compact = set && (set->full.flags[0] & header::FLAG_COMPACT);
+
+        std::vector<std::string> missing;
+        std::vector<std::string> clashing; // copies of a part that differ
+        uint64_t absent = 0, distinct = 0;
+        uint32_t expected = 1; // next part a complete set would have
+        size_t end = i;
+        for (; end < records.size() && records[end].id == id;) {
+            const Record &r = records[end];
+            std::vector<std::string> copies;
+            bool differ = false;
+            size_t same = end;
+            for (; same < records.size() && records[same].id == id &&
+                   records[same].part == r.part;
+                 same++) {
+                copies.push_back(records[same].path);
+                differ = differ || records[same].stored != r.stored ||
+                         records[same].compact != r.compact ||
+                         records[same].hole != r.hole;
+            }
+            // Copies of a part that are not even alike come from two sets
+            if (differ)
+                clashing.insert(clashing.end(), copies.begin(), copies.end());
+            else if (copies.size() > 1)
+                duplicates.push_back(item({{"file_id", quoted(Hex_Of(id))},
+                                           {"part", std::to_string(r.part)},
+                                           {"paths", paths(copies)}}));
+
+            for (size_t k = end; k < same; k++) {
+                const Record &p = records[k];
+                std::string problem;
+                if (p.hole && p.stored != 0)
+                    problem = "hole packet with " + std::to_string(p.stored) +
+                              " payload bytes";
+                else if (!p.compact && !p.hole && p.payload_len != p.stored)
+                    problem = "payload_len " + std::to_string(p.payload_len) +
+                              " but " + std::to_string(p.stored) +
+                              " bytes stored";
+                else if (set && p.part > packets)
+                    problem = "part beyond the " + std::to_string(packets) +
+                              " packets of its set";
+                else if (set && p.compact != compact)
+                    problem = std::string(p.compact ? "compact" : "standard") +
+                              " header in a set of " +
+                              (compact ? "compact" : "standard") + " headers";
+                else if (set) {
+                    uint64_t want = Expected_Payload(*set, p.part);
+                    uint64_t has = p.hole ? (p.compact ? want : p.payload_len)
+                                          : p.stored;
+                    if (has != want)
+                        problem = std::to_string(has) + " payload bytes, the "
+                                  "set expects " + std::to_string(want);
+                }
+                if (!problem.empty())
+                    bad.push_back(item({{"path", quoted(p.path)},
+                                        {"file_id", quoted(Hex_Of(id))},
+                                        {"part", std::to_string(p.part)},
+                                        {"problem", quoted(problem)}}));
+            }
+
+            if (r.part <= packets) {
+                for (; expected < r.part; expected++, absent++) {
+                    if (missing.size() < MAX_LISTED)
+                        missing.push_back(std::to_string(expected));
+                }
+                expected = r.part + 1;
+                distinct++;
+            }
+            end = same;
+        }
+
+        if (!clashing.empty())
+            collisions.push_back(item(
+                {{"file_id", quoted(Hex_Of(id))},
+                 {"names", set ? "[" + quoted(set->table.name) + "]" : "[]"},
+                 {"paths", paths(clashing)}}));
+        if (!set) {
+            orphans.push_back(item(
+                {{"file_id", quoted(Hex_Of(id))},
+                 {"packets", std::to_string(end - i)},
+                 {"first_part", std::to_string(records[i].part)},
+                 {"last_part", std::to_string(records[end - 1].part)},
+                 {"in_progress", journaled.count(id) ? "true" : "false"}}));
+        } else {
+            for (; expected <= packets; expected++, absent++) {
+                if (missing.size() < MAX_LISTED)
+                    missing.push_back(std::to_string(expected));
+            }
+            if (absent > 0) {
+                std::string list = "[";
+                for (const auto &part : missing)
+                    list += (list.size() > 1 ? ", " : "") + part;
+                incomplete.push_back(
+                    item({{"file_id", quoted(Hex_Of(id))},
+                          {"name", quoted(set->table.name)},
+                          {"packets", std::to_string(packets)},
+                          {"present", std::to_string(distinct)},
+                          {"missing", std::to_string(absent)},
+                          {"first_missing", list + "]"}}));
+            } else {
+                complete++;
+            }
+            set_of.erase(found);
+        }
+        i = end;
+    }
+
+    // Part 0 files whose packets are all gone (an empty set is complete)
+    for (const auto &[id, set] : set_of) {
+        uint32_t packets = header::Packets_Of(set->full);
+        if (packets == 0) {
+            complete++;
+            continue;
+        }
+        std::string list = "[";
+        for (uint32_t part = 1; part <= packets && part <= MAX_LISTED; part++)
+            list += (list.size() > 1 ? ", " : "") + std::to_string(part);
+        incomplete.push_back(item({{"file_id", quoted(Hex_Of(id))},
+                                   {"name", quoted(set->table.name)},
+                                   {"packets", std::to_string(packets)},
+                                   {"present", "0"},
+                                   {"missing", std::to_string(packets)},
+                                   {"first_missing", list + "]"}}));
+    }
+
+    bool ok = bad.empty() && duplicates.empty() && collisions.empty() &&
+              orphans.empty() && incomplete.empty() && unreadable.empty();
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - started)
+                         .count();
+
+    auto array = [](const std::vector<std::string> &items) {
+        if (items.empty())
+            return std::string("[]");
+        std::string out = "[\n";
+        for (size_t k = 0; k < items.size(); k++)
+            out += "    " + items[k] + (k + 1 < items.size() ? ",\n" : "\n");
+        return out + "  ]";
+    };
+    std::vector<std::string> unreadable_items;
+    for (const auto &path : unreadable)
+        unreadable_items.push_back(quoted(path));
+
+    std::cout << "{\n"
+              << "  \"roots\": " << paths(where.roots) << ",\n"
+              << "  \"files\": " << files << ",\n"
+              << "  \"packets\": " << records.size() << ",\n"
+              << "  \"sets\": " << set_count << ",\n"
+              << "  \"complete_sets\": " << complete << ",\n"
+              << "  \"foreign_files\": " << foreign << ",\n"
+              << "  \"unreadable\": " << array(unreadable_items) << ",\n"
+              << "  \"bad_packets\": " << array(bad) << ",\n"
+              << "  \"duplicates\": " << array(duplicates) << ",\n"
+              << "  \"collisions\": " << array(collisions) << ",\n"
+              << "  \"orphans\": " << array(orphans) << ",\n"
+              << "  \"incomplete\": " << array(incomplete) << ",\n"
+              << "  \"ok\": " << (ok ? "true" : "false") << ",\n"
+              << "  \"seconds\": " << seconds << "\n"
+              << "}\n";
+    return ok;
+}
+} // namespace fsck
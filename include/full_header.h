@@ -1,5 +1,7 @@
 #pragma once
+#include "schema.h"
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
@@ -12,6 +14,20 @@
  */
 namespace header {
 
+/*
+ * Bits of Full_Header::flags
+ * - FLAG_PACKED  : payload is several small files back to back, their entry
+ *                  table follows the full header in the 0th split file
+ * - FLAG_COMPACT : packets of the set carry the compact packet header
+ * - FLAG_MANIFEST: a version 2 manifest (long name, packet table) follows
+ *                  the full header, see manifest.h
+ * - FLAG_SPARSE  : some packets are hole packets (PACKET_HOLE), see sparse.h
+ */
+constexpr uint8_t FLAG_PACKED = 0x01;
+constexpr uint8_t FLAG_COMPACT = 0x02;
+constexpr uint8_t FLAG_MANIFEST = 0x04;
+constexpr uint8_t FLAG_SPARSE = 0x08;
+
 /*
  * Full_Header: Structure representing the full header file data
  * contains information of orignal file and the important info about packets
@@ -37,25 +53,27 @@ struct Full_Header {
                 uint32_t payloadsize, uint64_t fsize,
                 const std::string &fname) {
 
+        uint8_t *base = reinterpret_cast<uint8_t *>(this);
+
         std::memcpy(PKTCORE.data(), "PCORE", 5);
         // constat PCORE extention in first 5 bytes
 
         file_id = file_id_input;
         // 5 bytes random file id for identification purpos of one file
 
-        std::memcpy(part_number.data(), &part_number0, 4);
+        Full_Fields::Part::Put(base, part_number0);
         // constant part number for full header
 
-        std::memcpy(no_of_packets.data(), &num_parts, 4);
+        Full_Fields::Packets::Put(base, num_parts);
         // stores total number of packets helps find missing packets
 
-        flags[0] = flag_val;
+        Full_Fields::Flags::Put(base, flag_val);
         // tells about extra used features encrytion and compression etc
 
-        std::memcpy(payloadSize.data(), &payloadsize, 4);
+        Full_Fields::Payload::Put(base, payloadsize);
         // comman paylod size of packets
 
-        std::memcpy(filesize.data(), &fsize, 8);
+        Full_Fields::File_Size::Put(base, fsize);
         // orignal file size helps is confurmatation purpouses
 
         for (size_t i = 0; i < filename.size(); ++i)
@@ -64,6 +82,21 @@ struct Full_Header {
     }
 };
 
+// The struct is the encoded header byte for byte
+static_assert(sizeof(Full_Header) == Full_Fields::SIZE, "full header padding");
+static_assert(offsetof(Full_Header, file_id) == Full_Fields::File_ID::offset &&
+                  offsetof(Full_Header, no_of_packets) ==
+                      Full_Fields::Packets::offset &&
+                  offsetof(Full_Header, flags) == Full_Fields::Flags::offset &&
+                  offsetof(Full_Header, filesize) ==
+                      Full_Fields::File_Size::offset &&
+                  offsetof(Full_Header, filename) == Full_Fields::Name::offset,
+              "Full_Header does not match its schema");
+
+inline const uint8_t *Bytes_Of(const Full_Header &header) {
+    return reinterpret_cast<const uint8_t *>(&header);
+}
+
 /*
  * Global constructor for FULL_HEADER
  * - @file_id      :randomly genrated file_id for every packet of file
@@ -96,6 +129,53 @@ inline void WRITE_FULL_HEADER(const std::string &filename,
  */
 inline void Print_Full_Header(const std::string &filename);
 
+/*
+ * READ_FULL_HEADER:
+ * Reads the full header back from the 0th split file.
+ * - @filename : path of the 0th split file
+ * - @header   : filled with the header on success
+ * - @return   : false if the file can't be read or is not a PCORE header
+ */
+inline bool READ_FULL_HEADER(const std::string &filename, Full_Header &header);
+
+/*
+ * Small accessors for the numeric fields (stored little-endian).
+ */
+inline uint32_t Packets_Of(const Full_Header &header);
+inline uint32_t Payload_Size_Of(const Full_Header &header);
+inline uint64_t File_Size_Of(const Full_Header &header);
+
+/*
+ * Original file name, without its zero padding.
+ */
+inline std::string Name_Of(const Full_Header &header);
+
+/*
+ * Bytes in front of the payload of a part of the set: the standard 19 byte
+ * header, or a compact one whose length grows with the part number.
+ */
+inline size_t Packet_Header_Size(const Full_Header &header, uint32_t part);
+
+/*
+ * Packet_Start:
+ * Byte offset in the original file where the payload of a part begins.
+ * Two layouts exist and both are recognised from the header alone:
+ *   - split into N parts: payloadSize = size / N and one extra byte goes to
+ *     each of the first (size % N) parts, so payloadSize * N <= size
+ *   - split by packet size: every part holds payloadSize bytes except a
+ *     shorter last one, so payloadSize * N >= size
+ * - @header : full header of the packet set
+ * - @part   : part number, 1 based (packets + 1 gives the file size)
+ */
+inline uint64_t Packet_Start(const Full_Header &header, uint32_t part);
+
+/*
+ * Packet_For_Offset:
+ * Inverse of Packet_Start, returns the part holding a byte of the original
+ * file. Returns 0 when the offset is past the end of the file.
+ */
+inline uint32_t Packet_For_Offset(const Full_Header &header, uint64_t offset);
+
 //=================================================================================
 //=================================================================================
 // function coding here
@@ -117,72 +197,108 @@ void WRITE_FULL_HEADER(const std::string &filename, const Full_Header &header) {
         std::cerr << "❌ Failed to open file: " << filename << "\n";
         return;
     }
-    out.write(reinterpret_cast<const char *>(&header), sizeof(Full_Header));
+    out.write(reinterpret_cast<const char *>(Bytes_Of(header)),
+              FULL_HEADER_SIZE);
     out.close();
 }
 
 inline void Print_Full_Header(const std::string &filepath) {
-    std::ifstream in(filepath, std::ios::binary);
-
-    if (!in) {
-        std::cerr << "❌ Failed to open file: " << filepath << "\n";
-        return;
-    }
-
-    constexpr size_t headerSize = 7 + 4 + 4 + 1 + 4 + 8 + 19; // = 50 bytes
-    std::vector<uint8_t> buffer(headerSize);
-    in.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
-
-    if (!in) {
+    Full_Header header;
+    if (!READ_FULL_HEADER(filepath, header)) {
         std::cerr << "❌ Failed to read full header from: " << filepath << "\n";
         return;
     }
+    const uint8_t *base = Bytes_Of(header);
 
-    size_t offset = 0;
+    std::cout << "📦 Full Header Info from: " << filepath << "\n";
+    std::cout << "  Extention     : "
+              << std::string(header.PKTCORE.begin(), header.PKTCORE.end())
+              << "\n";
+    std::cout << "  file_id       : "
+              << std::string(header.file_id.begin(), header.file_id.end())
+              << "\n";
+    std::cout << "  part Number   : "
+              << Full_Fields::Part::Get<uint32_t>(base) << "\n";
+    std::cout << "  Total Parts   : " << Packets_Of(header) << "\n";
+    std::cout << "  Flag          : " << static_cast<int>(header.flags[0])
+              << "\n";
+    std::cout << "  Payload Size  : " << Payload_Size_Of(header) << "\n";
+    std::cout << "  File Size     : " << File_Size_Of(header) << "\n";
+    std::cout << "  Filename      : " << Name_Of(header) << "\n";
+}
 
-    std::string extention;
-    for (int i = 0; i < 5; ++i)
-        extention += static_cast<char>(buffer[offset++]);
+bool READ_FULL_HEADER(const std::string &filename, Full_Header &header) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+        return false;
+    in.read(reinterpret_cast<char *>(&header), FULL_HEADER_SIZE);
+    if (!in)
+        return false;
+    return std::memcmp(header.PKTCORE.data(), "PCORE", 5) == 0;
+}
 
-    std::string file_id;
-    for (int i = 0; i < 5; ++i)
-        file_id += static_cast<char>(buffer[offset++]);
+uint32_t Packets_Of(const Full_Header &header) {
+    return Full_Fields::Packets::Get<uint32_t>(Bytes_Of(header));
+}
 
-    uint32_t part_number;
-    std::memcpy(&part_number, &buffer[offset], 4);
+uint32_t Payload_Size_Of(const Full_Header &header) {
+    return Full_Fields::Payload::Get<uint32_t>(Bytes_Of(header));
+}
 
-    offset += 4;
-    uint32_t totalParts;
-    std::memcpy(&totalParts, &buffer[offset], 4);
+inline std::string Name_Of(const Full_Header &header) {
+    std::string name(reinterpret_cast<const char *>(header.filename.data()),
+                     header.filename.size());
+    return name.c_str(); // drop the zero padding
+}
 
-    offset += 4;
-    uint8_t flag = buffer[offset];
+inline size_t Packet_Header_Size(const Full_Header &header, uint32_t part) {
+    if (header.flags[0] & FLAG_COMPACT)
+        return Compact_Fields::SIZE + Varint_Size(part);
+    return MINI_HEADER_SIZE;
+}
 
-    offset += 1;
-    uint32_t payloadSize;
-    std::memcpy(&payloadSize, &buffer[offset], 4);
+/*
+ * True when the packet set was cut into fixed payloadSize packets.
+ */
+inline bool Is_Fixed_Payload(const Full_Header &header) {
+    uint64_t payload = Payload_Size_Of(header);
+    return payload * Packets_Of(header) >= File_Size_Of(header);
+}
 
-    offset += 4;
-    uint64_t fileSize;
-    std::memcpy(&fileSize, &buffer[offset], 8);
+uint64_t File_Size_Of(const Full_Header &header) {
+    return Full_Fields::File_Size::Get<uint64_t>(Bytes_Of(header));
+}
 
-    offset += 8;
-    std::string fname;
-    for (size_t i = 0; i < 19; ++i) {
-        if (buffer[offset + i] == 0)
-            break;
-        fname += static_cast<char>(buffer[offset + i]);
-    }
+uint64_t Packet_Start(const Full_Header &header, uint32_t part) {
+    uint64_t packets = Packets_Of(header);
+    uint64_t size = File_Size_Of(header);
+    if (packets == 0 || part == 0)
+        return 0;
+    if (part > packets)
+        return size;
+    if (Is_Fixed_Payload(header))
+        return static_cast<uint64_t>(part - 1) * Payload_Size_Of(header);
+
+    uint64_t payload = size / packets;
+    uint64_t leftover = size % packets;
+    uint64_t k = part - 1;
+    return k * payload + (k < leftover ? k : leftover);
+}
 
-    std::cout << "📦 Full Header Info from: " << filepath << "\n";
-    std::cout << "  Extention     : " << extention << "\n";
-    std::cout << "  file_id       : " << file_id << "\n";
-    std::cout << "  part Number   : " << part_number << "\n";
-    std::cout << "  Total Parts   : " << totalParts << "\n";
-    std::cout << "  Flag          : " << static_cast<int>(flag) << "\n";
-    std::cout << "  Payload Size  : " << payloadSize << "\n";
-    std::cout << "  File Size     : " << fileSize << "\n";
-    std::cout << "  Filename      : " << fname << "\n";
+uint32_t Packet_For_Offset(const Full_Header &header, uint64_t offset) {
+    uint64_t packets = Packets_Of(header);
+    uint64_t size = File_Size_Of(header);
+    if (packets == 0 || offset >= size)
+        return 0;
+    if (Is_Fixed_Payload(header))
+        return static_cast<uint32_t>(offset / Payload_Size_Of(header) + 1);
+
+    uint64_t payload = size / packets;
+    uint64_t leftover = size % packets;
+    uint64_t boundary = leftover * (payload + 1); // end of the longer parts
+    if (offset < boundary)
+        return static_cast<uint32_t>(offset / (payload + 1) + 1);
+    return static_cast<uint32_t>(leftover + (offset - boundary) / payload + 1);
 }
 //=================================================================================
 } // namespace header
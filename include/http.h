@@ -0,0 +1,845 @@
+#pragma once
+#include "catalog.h"
+#include "combiner.h"
+#include "full_header.h"
+#include "pkt_utils.h"
+#include "reader.h"
+#include "splitter.h"
+#include "transport.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <netdb.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * HTTP module namespace: an embedded HTTP/1.1 server over the packets in the
+ * current directory.
+ *   GET  /files              JSON list of packet sets
+ *   GET  /files/<name>       original file served from its packets; a Range
+ *                            header is mapped to the packets holding it
+ *   PUT  /files/<name>       upload, split into packets while it arrives
+ *                            (?packet_size=N, default 1 MiB)
+ *   GET  /packets/<HEX_n>    one packet file, as stored
+ * File bodies leave with sendfile straight from the packet files. Every
+ * event loop thread owns its own SO_REUSEPORT listener, epoll set and
+ * connections, so loops never share state.
+ */
+namespace http {
+
+/*
+ * Runs the server until the process is killed.
+ * - @address : [HOST:]PORT to listen on
+ * - @threads : event loops, 0 for one per hardware thread
+ */
+inline bool SERVE(const std::string &address, size_t threads = 0);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+constexpr size_t MAX_HEADER_BYTES = 16 * 1024;
+constexpr size_t RECV_CHUNK = 64 * 1024;
+constexpr size_t SENDFILE_CHUNK = 1024 * 1024;
+constexpr uint32_t DEFAULT_UPLOAD_PACKET = 1024 * 1024;
+constexpr double CATALOG_TTL = 1.0; // seconds a catalog refresh is reused
+
+struct Request {
+    std::string method;
+    std::string path;
+    std::string query;
+    std::map<std::string, std::string> headers; // lower-case names
+    bool keep_alive = true;
+
+    std::string Header(const std::string &name) const {
+        auto it = headers.find(name);
+        return it == headers.end() ? "" : it->second;
+    }
+};
+
+/*
+ * Decodes %XX escapes of a URL path segment.
+ */
+inline std::string Url_Decode(const std::string &in) {
+    std::string out;
+    for (size_t i = 0; i < in.size(); i++) {
+        if (in[i] == '%' && i + 2 < in.size() && isxdigit(in[i + 1]) &&
+            isxdigit(in[i + 2])) {
+            out += static_cast<char>(std::stoi(in.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            out += in[i];
+        }
+    }
+    return out;
+}
+
+inline std::string Query_Value(const std::string &query, const std::string &key) {
+    size_t pos = 0;
+    while (pos <= query.size()) {
+        size_t end = query.find('&', pos);
+        if (end == std::string::npos)
+            end = query.size();
+        std::string pair = query.substr(pos, end - pos);
+        if (pair.compare(0, key.size() + 1, key + "=") == 0)
+            return Url_Decode(pair.substr(key.size() + 1));
+        pos = end + 1;
+    }
+    return "";
+}
+
+/*
+ * Parses the request line and headers (everything before the blank line).
+ */
+inline bool Parse_Request(const std::string &head, Request &req) {
+    size_t line_end = head.find("\r\n");
+    std::string line = head.substr(0, line_end);
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.rfind(' ');
+    if (sp1 == std::string::npos || sp1 == sp2)
+        return false;
+    req.method = line.substr(0, sp1);
+    std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::string version = line.substr(sp2 + 1);
+    size_t q = target.find('?');
+    req.path = target.substr(0, q);
+    req.query = q == std::string::npos ? "" : target.substr(q + 1);
+    req.keep_alive = version == "HTTP/1.1";
+
+    size_t pos = line_end == std::string::npos ? head.size() : line_end + 2;
+    while (pos < head.size()) {
+        size_t end = head.find("\r\n", pos);
+        if (end == std::string::npos)
+            end = head.size();
+        std::string field = head.substr(pos, end - pos);
+        size_t colon = field.find(':');
+        if (colon != std::string::npos) {
+            std::string name = field.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            size_t v = field.find_first_not_of(" \t", colon + 1);
+            req.headers[name] = v == std::string::npos ? "" : field.substr(v);
+        }
+        pos = end + 2;
+    }
+
+    std::string connection = req.Header("connection");
+    std::transform(connection.begin(), connection.end(), connection.begin(),
+                   ::tolower);
+    if (connection == "close")
+        req.keep_alive = false;
+    else if (connection == "keep-alive")
+        req.keep_alive = true;
+    return true;
+}
+
+/*
+ * Parses a single "bytes=first-last" range against a file size.
+ * - @return : 1 for a usable range, 0 to ignore the header (serve the whole
+ *             file), -1 when the range cannot be satisfied
+ */
+inline int Parse_Range(const std::string &value, uint64_t size, uint64_t &first,
+                       uint64_t &last) {
+    if (value.compare(0, 6, "bytes=") != 0 ||
+        value.find(',') != std::string::npos)
+        return 0; // multiple ranges: a full response is allowed
+    std::string spec = value.substr(6);
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos)
+        return 0;
+    std::string a = spec.substr(0, dash), b = spec.substr(dash + 1);
+    try {
+        if (a.empty()) { // suffix: the last N bytes
+            uint64_t n = std::stoull(b);
+            if (n == 0 || size == 0)
+                return -1;
+            first = n >= size ? 0 : size - n;
+            last = size - 1;
+        } else {
+            first = std::stoull(a);
+            last = b.empty() ? size - 1 : std::min<uint64_t>(std::stoull(b), size - 1);
+            if (first >= size || last < first)
+                return -1;
+        }
+    } catch (const std::exception &) {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Connection: one client socket and whatever its current request is doing.
+ */
+struct Connection {
+    int fd = -1;
+    std::string in;   // received, not yet consumed
+    std::string out;  // response bytes not yet sent
+    size_t out_pos = 0;
+    bool keep_alive = true;
+    bool peer_closed = false;  // nothing more to read, finish sending
+    uint32_t events = EPOLLIN; // currently registered with epoll
+
+    // Request body
+    enum Body_State { NONE, LENGTH, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILER };
+    Body_State body = NONE;
+    uint64_t body_left = 0;
+    std::unique_ptr<splitter::Stream_Splitter> upload; // null: discard body
+    bool upload_ok = true;
+
+    // Response body: one packet file range, or a range of an original file
+    int file_fd = -1;
+    off_t file_off = 0;
+    uint64_t file_left = 0;
+    std::unique_ptr<reader::Packet_Reader> reader;
+    uint64_t range_pos = 0;
+    uint64_t range_left = 0;
+
+    bool Sending() const {
+        return out_pos < out.size() || file_left > 0 || range_left > 0;
+    }
+
+    ~Connection() {
+        if (upload)
+            upload->Abort(); // closed before the body was whole
+        if (file_fd >= 0)
+            ::close(file_fd);
+        if (fd >= 0)
+            ::close(fd);
+    }
+};
+
+class Event_Loop {
+  public:
+    explicit Event_Loop(int listener) : listener_(listener) {}
+    ~Event_Loop() {
+        if (epoll_ >= 0)
+            ::close(epoll_);
+        ::close(listener_);
+    }
+    void Run();
+
+  private:
+    void Accept();
+    void Close(int fd) { conns_.erase(fd); }
+    void Watch(Connection &c, bool out);
+
+    // - @return : false when the connection must be closed
+    bool Flush(Connection &c, bool &blocked);
+    bool On_Readable(Connection &c);
+    bool On_Writable(Connection &c);
+    bool Process(Connection &c);
+    bool Feed_Body(Connection &c);
+    void Start_Request(Connection &c, const Request &req);
+    void Finish_Upload(Connection &c);
+
+    void Respond(Connection &c, int status, const std::string &reason,
+                 const std::string &body,
+                 const std::string &type = "application/json",
+                 const std::string &extra = "");
+    void Head(Connection &c, int status, const std::string &reason,
+              uint64_t length, const std::string &type,
+              const std::string &extra = "");
+    void Get_List(Connection &c);
+    void Get_File(Connection &c, const Request &req, const std::string &name);
+    void Get_Packet(Connection &c, const std::string &name);
+
+    /*
+     * Brings the catalog up to date at most every CATALOG_TTL seconds, so
+     * GETs are answered from the index instead of a directory walk each.
+     * - @force : refresh now, e.g. after a lookup missed
+     */
+    void Refresh_Catalog(bool force);
+
+    int listener_;
+    int epoll_ = -1;
+    std::unordered_map<int, std::unique_ptr<Connection>> conns_;
+    catalog::Catalog catalog_;
+    bool catalog_stale_ = true;
+    std::chrono::steady_clock::time_point refreshed_;
+};
+
+inline void Event_Loop::Run() {
+    epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listener_;
+    ::epoll_ctl(epoll_, EPOLL_CTL_ADD, listener_, &ev);
+
+    std::vector<epoll_event> events(256);
+    while (true) {
+        int n = ::epoll_wait(epoll_, events.data(),
+                             static_cast<int>(events.size()), -1);
+        if (n < 0 && errno != EINTR) {
+            std::cerr << "epoll_wait failed: " << strerror(errno) << "\n";
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listener_) {
+                Accept();
+                continue;
+            }
+            auto it = conns_.find(fd);
+            if (it == conns_.end())
+                continue;
+            Connection &c = *it->second;
+            bool ok = !(events[i].events & (EPOLLERR | EPOLLHUP)) ||
+                      (events[i].events & EPOLLIN);
+            if (ok && (events[i].events & EPOLLOUT))
+                ok = On_Writable(c);
+            if (ok && (events[i].events & EPOLLIN))
+                ok = On_Readable(c);
+            if (!ok)
+                Close(fd);
+        }
+    }
+}
+
+inline void Event_Loop::Accept() {
+    while (true) {
+        int fd = ::accept4(listener_, nullptr, nullptr,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return; // EAGAIN: another loop may have taken it
+        auto conn = std::make_unique<Connection>();
+        conn->fd = fd;
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        ::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev);
+        conns_[fd] = std::move(conn);
+    }
+}
+
+inline void Event_Loop::Watch(Connection &c, bool out) {
+    uint32_t events = (c.peer_closed ? 0u : static_cast<uint32_t>(EPOLLIN)) |
+                      (out ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    if (c.events == events)
+        return;
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = c.fd;
+    ::epoll_ctl(epoll_, EPOLL_CTL_MOD, c.fd, &ev);
+    c.events = events;
+}
+
+inline bool Event_Loop::On_Readable(Connection &c) {
+    char buf[RECV_CHUNK];
+    while (true) {
+        ssize_t got = ::recv(c.fd, buf, sizeof(buf), 0);
+        if (got > 0) {
+            c.in.append(buf, static_cast<size_t>(got));
+            // Uploads are split as they arrive instead of piling up
+            if (!Process(c))
+                return false;
+            continue;
+        }
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0 || c.body != Connection::NONE || !c.Sending())
+            return false;
+        // Peer half-closed: finish the response already under way
+        c.peer_closed = true;
+        c.keep_alive = false;
+        Watch(c, true);
+        return true;
+    }
+}
+
+inline bool Event_Loop::Flush(Connection &c, bool &blocked) {
+    blocked = false;
+    while (c.out_pos < c.out.size()) {
+        ssize_t w = ::send(c.fd, c.out.data() + c.out_pos,
+                           c.out.size() - c.out_pos, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            Watch(c, true);
+            blocked = true;
+            return true;
+        }
+        if (w <= 0)
+            return false;
+        c.out_pos += static_cast<size_t>(w);
+    }
+    c.out.clear();
+    c.out_pos = 0;
+    return true;
+}
+
+inline bool Event_Loop::On_Writable(Connection &c) {
+    bool blocked;
+    if (!Flush(c, blocked))
+        return false;
+    if (blocked)
+        return true;
+
+    while (c.file_left > 0) {
+        ssize_t w = ::sendfile(c.fd, c.file_fd, &c.file_off,
+                               std::min<uint64_t>(c.file_left, SENDFILE_CHUNK));
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w < 0 && errno == EAGAIN) {
+            Watch(c, true);
+            return true;
+        }
+        if (w <= 0)
+            return false;
+        c.file_left -= static_cast<uint64_t>(w);
+    }
+    if (c.file_fd >= 0) {
+        ::close(c.file_fd);
+        c.file_fd = -1;
+    }
+
+    while (c.range_left > 0) {
+        int pfd;
+        off_t at;
+        int64_t avail = c.reader->Locate(c.range_pos, pfd, at);
+        if (avail <= 0)
+            return false;
+        size_t want = static_cast<size_t>(std::min<uint64_t>(
+            {static_cast<uint64_t>(avail), c.range_left, SENDFILE_CHUNK}));
+        ssize_t w = ::sendfile(c.fd, pfd, &at, want);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w < 0 && errno == EAGAIN) {
+            Watch(c, true);
+            return true;
+        }
+        if (w <= 0)
+            return false;
+        c.range_pos += static_cast<uint64_t>(w);
+        c.range_left -= static_cast<uint64_t>(w);
+    }
+    c.reader.reset();
+    Watch(c, false);
+
+    if (!c.keep_alive)
+        return false;
+    // A pipelined request may be waiting behind the one just answered
+    return c.in.empty() || Process(c);
+}
+
+inline bool Event_Loop::Process(Connection &c) {
+    while (true) {
+        if (c.body != Connection::NONE) {
+            if (!Feed_Body(c))
+                return false;
+            if (c.body != Connection::NONE) {
+                bool blocked; // e.g. "100 Continue" waiting to go out
+                return Flush(c, blocked);
+            }
+            continue;
+        }
+        if (c.Sending())
+            return true; // answer in order: wait for this response to leave
+
+        size_t end = c.in.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            if (c.in.size() > MAX_HEADER_BYTES) {
+                c.keep_alive = false;
+                Respond(c, 431, "Request Header Fields Too Large", "");
+                return On_Writable(c);
+            }
+            return true;
+        }
+
+        Request req;
+        bool parsed = Parse_Request(c.in.substr(0, end), req);
+        c.in.erase(0, end + 4);
+        if (!parsed) {
+            c.keep_alive = false;
+            Respond(c, 400, "Bad Request", "{\"error\":\"bad request\"}");
+            return On_Writable(c);
+        }
+        Start_Request(c, req);
+        if (!c.Sending() && c.body == Connection::NONE && !c.keep_alive)
+            return false;
+        if (c.Sending() && !On_Writable(c))
+            return false;
+    }
+}
+
+inline bool Event_Loop::Feed_Body(Connection &c) {
+    auto consume = [&](size_t n) {
+        if (c.upload && c.upload_ok &&
+            !c.upload->Feed(reinterpret_cast<const uint8_t *>(c.in.data()), n))
+            c.upload_ok = false;
+        c.in.erase(0, n);
+    };
+
+    while (c.body != Connection::NONE) {
+        switch (c.body) {
+        case Connection::LENGTH:
+        case Connection::CHUNK_DATA: {
+            size_t n = static_cast<size_t>(
+                std::min<uint64_t>(c.body_left, c.in.size()));
+            if (n == 0 && c.body_left > 0)
+                return true;
+            consume(n);
+            c.body_left -= n;
+            if (c.body_left == 0) {
+                if (c.body == Connection::LENGTH) {
+                    c.body = Connection::NONE;
+                    Finish_Upload(c);
+                } else {
+                    c.body = Connection::CHUNK_END;
+                }
+            }
+            break;
+        }
+        case Connection::CHUNK_END:
+            if (c.in.size() < 2)
+                return true;
+            c.in.erase(0, 2);
+            c.body = Connection::CHUNK_SIZE;
+            break;
+        case Connection::CHUNK_SIZE: {
+            size_t eol = c.in.find("\r\n");
+            if (eol == std::string::npos)
+                return c.in.size() < 1024;
+            std::string line = c.in.substr(0, eol);
+            c.in.erase(0, eol + 2);
+            try {
+                c.body_left = std::stoull(line, nullptr, 16);
+            } catch (const std::exception &) {
+                return false;
+            }
+            c.body = c.body_left == 0 ? Connection::TRAILER
+                                      : Connection::CHUNK_DATA;
+            break;
+        }
+        case Connection::TRAILER: {
+            size_t eol = c.in.find("\r\n");
+            if (eol == std::string::npos)
+                return c.in.size() < MAX_HEADER_BYTES;
+            c.in.erase(0, eol + 2);
+            if (eol == 0) { // blank line ends the trailer
+                c.body = Connection::NONE;
+                Finish_Upload(c);
+            }
+            break;
+        }
+        case Connection::NONE:
+            break;
+        }
+    }
+    return !c.Sending() || On_Writable(c);
+}
+
+inline void Event_Loop::Start_Request(Connection &c, const Request &req) {
+    c.keep_alive = req.keep_alive;
+
+    // Body framing: chunked or Content-Length
+    std::string te = req.Header("transfer-encoding");
+    std::transform(te.begin(), te.end(), te.begin(), ::tolower);
+    uint64_t length = 0;
+    try {
+        std::string cl = req.Header("content-length");
+        if (!cl.empty())
+            length = std::stoull(cl);
+    } catch (const std::exception &) {
+        c.keep_alive = false;
+        Respond(c, 400, "Bad Request", "{\"error\":\"bad content-length\"}");
+        return;
+    }
+    bool chunked = te.find("chunked") != std::string::npos;
+    c.upload.reset();
+    c.upload_ok = true;
+    if (chunked) {
+        c.body = Connection::CHUNK_SIZE;
+    } else if (length > 0) {
+        c.body = Connection::LENGTH;
+        c.body_left = length;
+    }
+
+    const std::string files = "/files/", packets = "/packets/";
+    if ((req.method == "PUT" || req.method == "POST") &&
+        req.path.compare(0, files.size(), files) == 0) {
+        std::string name = Url_Decode(req.path.substr(files.size()));
+        uint32_t packet_size = DEFAULT_UPLOAD_PACKET;
+        try {
+            std::string opt = Query_Value(req.query, "packet_size");
+            if (!opt.empty()) {
+                // Digits only, and no wrap past UINT32_MAX (0 is refused)
+                size_t used = 0;
+                unsigned long long value =
+                    std::isdigit(static_cast<unsigned char>(opt[0]))
+                        ? std::stoull(opt, &used)
+                        : 0;
+                packet_size = used == opt.size() && value <= UINT32_MAX
+                                  ? static_cast<uint32_t>(value)
+                                  : 0;
+            }
+        } catch (const std::exception &) {
+            packet_size = 0;
+        }
+        if (name.empty() || packet_size == 0) {
+            c.keep_alive = c.keep_alive && c.body == Connection::NONE;
+            Respond(c, 400, "Bad Request",
+                    "{\"error\":\"need a name and a packet_size > 0\"}");
+            return;
+        }
+        // The name is where combine writes the file later: a plain file
+        // name only, no directories, no absolute path, no ".."
+        if (utils::Safe_File_Name(name) != name) {
+            c.keep_alive = c.keep_alive && c.body == Connection::NONE;
+            Respond(c, 400, "Bad Request",
+                    "{\"error\":\"name must be a plain file name\"}");
+            return;
+        }
+        c.upload = std::make_unique<splitter::Stream_Splitter>(name, packet_size);
+        if (req.Header("expect") == "100-continue")
+            c.out += "HTTP/1.1 100 Continue\r\n\r\n";
+        if (c.body == Connection::NONE)
+            Finish_Upload(c); // empty upload
+        return;
+    }
+
+    if (c.body != Connection::NONE) {
+        // Body we have no use for: read and drop it, then answer
+        c.keep_alive = false;
+    }
+    if (req.method != "GET" && req.method != "HEAD") {
+        Respond(c, 405, "Method Not Allowed", "{\"error\":\"method not allowed\"}",
+                "application/json", "Allow: GET, HEAD, PUT\r\n");
+        return;
+    }
+
+    size_t before = c.out.size();
+    if (req.path == "/files" || req.path == "/files/")
+        Get_List(c);
+    else if (req.path.compare(0, files.size(), files) == 0)
+        Get_File(c, req, Url_Decode(req.path.substr(files.size())));
+    else if (req.path.compare(0, packets.size(), packets) == 0)
+        Get_Packet(c, Url_Decode(req.path.substr(packets.size())));
+    else
+        Respond(c, 404, "Not Found", "{\"error\":\"not found\"}");
+
+    if (req.method == "HEAD") {
+        // Same headers, no body
+        size_t head_end = c.out.find("\r\n\r\n", before);
+        if (head_end != std::string::npos)
+            c.out.resize(head_end + 4);
+        c.file_left = c.range_left = 0;
+    }
+}
+
+inline void Event_Loop::Finish_Upload(Connection &c) {
+    if (!c.upload)
+        return; // a body that was only drained, already answered
+    auto upload = std::move(c.upload);
+    if (!c.upload_ok || !upload->Finish()) {
+        upload->Abort();
+        Respond(c, 500, "Internal Server Error",
+                "{\"error\":\"failed to write packets\"}");
+        return;
+    }
+    catalog_stale_ = true;
+    Respond(c, 201, "Created",
+            "{\"packet\":" +
+                utils::Json_String(utils::Packet_File_Name(upload->File_ID(), 0)) +
+                ",\"packets\":" + std::to_string(upload->Packets()) +
+                ",\"size\":" + std::to_string(upload->Bytes()) + "}");
+}
+
+inline void Event_Loop::Head(Connection &c, int status,
+                             const std::string &reason, uint64_t length,
+                             const std::string &type, const std::string &extra) {
+    c.out += "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n";
+    c.out += "Server: pktcore\r\n";
+    c.out += "Content-Type: " + type + "\r\n";
+    c.out += "Content-Length: " + std::to_string(length) + "\r\n";
+    c.out += extra;
+    c.out += c.keep_alive ? "Connection: keep-alive\r\n\r\n"
+                          : "Connection: close\r\n\r\n";
+}
+
+inline void Event_Loop::Respond(Connection &c, int status,
+                                const std::string &reason,
+                                const std::string &body, const std::string &type,
+                                const std::string &extra) {
+    Head(c, status, reason, body.size(), type, extra);
+    c.out += body;
+}
+
+inline void Event_Loop::Refresh_Catalog(bool force) {
+    auto now = std::chrono::steady_clock::now();
+    if (!force && !catalog_stale_ &&
+        std::chrono::duration<double>(now - refreshed_).count() < CATALOG_TTL)
+        return;
+    catalog_.Refresh();
+    catalog_stale_ = false;
+    refreshed_ = now;
+}
+
+inline void Event_Loop::Get_List(Connection &c) {
+    Refresh_Catalog(false);
+    std::string body = "[";
+    for (const auto &set : catalog_.Sets()) {
+        if (!set.has_header)
+            continue;
+        if (body.size() > 1)
+            body += ",";
+        body += "{\"name\":" + utils::Json_String(set.name) +
+                ",\"packet\":" +
+                utils::Json_String(utils::Packet_File_Name(set.file_id, 0)) +
+                ",\"size\":" + std::to_string(header::File_Size_Of(set.full)) +
+                ",\"packets\":" + std::to_string(header::Packets_Of(set.full)) +
+                ",\"complete\":" + (set.Complete() ? "true" : "false") + "}";
+    }
+    Respond(c, 200, "OK", body + "]");
+}
+
+inline void Event_Loop::Get_File(Connection &c, const Request &req,
+                                 const std::string &name) {
+    // By original filename, or by the name of the 0th packet file. A miss
+    // (or a set that looks incomplete) may just be news the index has not
+    // seen yet: looked up once more after a forced refresh.
+    catalog::Packet_Set set;
+    bool found = false;
+    for (int attempt = 0; attempt < 2 && !(found && set.Complete());
+         attempt++) {
+        Refresh_Catalog(attempt > 0);
+        found = catalog_.Find(name, set);
+        for (const auto &s : found ? std::vector<catalog::Packet_Set>{}
+                                   : catalog_.Sets()) {
+            if (s.has_header && utils::Packet_File_Name(s.file_id, 0) == name) {
+                set = s;
+                found = true;
+            }
+        }
+    }
+    if (!found) {
+        Respond(c, 404, "Not Found", "{\"error\":\"no such file\"}");
+        return;
+    }
+    if (!set.Complete()) {
+        Respond(c, 409, "Conflict", "{\"error\":\"packet set is incomplete\"}");
+        return;
+    }
+
+    auto pkt_reader = std::make_unique<reader::Packet_Reader>();
+    if (!pkt_reader->Open(set.file_id)) {
+        Respond(c, 500, "Internal Server Error",
+                "{\"error\":\"could not open packets\"}");
+        return;
+    }
+    uint64_t size = pkt_reader->Size();
+    uint64_t first = 0, last = size == 0 ? 0 : size - 1;
+    int range = req.Header("range").empty()
+                    ? 0
+                    : Parse_Range(req.Header("range"), size, first, last);
+    if (range < 0) {
+        Respond(c, 416, "Range Not Satisfiable", "", "application/octet-stream",
+                "Content-Range: bytes */" + std::to_string(size) + "\r\n");
+        return;
+    }
+
+    uint64_t length = size == 0 ? 0 : last - first + 1;
+    if (range > 0)
+        Head(c, 206, "Partial Content", length, "application/octet-stream",
+             "Accept-Ranges: bytes\r\nContent-Range: bytes " +
+                 std::to_string(first) + "-" + std::to_string(last) + "/" +
+                 std::to_string(size) + "\r\n");
+    else
+        Head(c, 200, "OK", length, "application/octet-stream",
+             "Accept-Ranges: bytes\r\n");
+    c.reader = std::move(pkt_reader);
+    c.range_pos = first;
+    c.range_left = length;
+}
+
+inline void Event_Loop::Get_Packet(Connection &c, const std::string &name) {
+    std::string file_id;
+    uint32_t split_no;
+    std::string path = layout::Path_Of(name);
+    if (name.find('/') != std::string::npos ||
+        !Read_Packet_Tag(path, file_id, split_no)) {
+        Respond(c, 404, "Not Found", "{\"error\":\"no such packet\"}");
+        return;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0)
+            ::close(fd);
+        Respond(c, 404, "Not Found", "{\"error\":\"no such packet\"}");
+        return;
+    }
+    Head(c, 200, "OK", static_cast<uint64_t>(st.st_size),
+         "application/octet-stream");
+    c.file_fd = fd;
+    c.file_off = 0;
+    c.file_left = static_cast<uint64_t>(st.st_size);
+}
+
+/*
+ * Opens one listening socket of the SO_REUSEPORT group.
+ */
+inline int Listen(const std::string &address) {
+    addrinfo *info = transport::Resolve(address, SOCK_STREAM, true);
+    int fd = -1;
+    for (addrinfo *ai = info; ai && fd < 0; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family,
+                      ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                      ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        if (::bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 ||
+            ::listen(fd, SOMAXCONN) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    if (info)
+        freeaddrinfo(info);
+    if (fd < 0)
+        std::cerr << "Could not listen on " << address << "\n";
+    return fd;
+}
+
+inline bool SERVE(const std::string &address, size_t threads) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // The kernel spreads new connections over the listeners
+    std::vector<std::unique_ptr<Event_Loop>> loops;
+    for (size_t i = 0; i < threads; i++) {
+        int fd = Listen(address);
+        if (fd < 0)
+            return false;
+        loops.push_back(std::make_unique<Event_Loop>(fd));
+    }
+    std::cout << "pktcore http listening on " << address << " with "
+              << threads << " event loops\n";
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < loops.size(); i++)
+        workers.emplace_back([&loops, i] { loops[i]->Run(); });
+    loops[0]->Run();
+    for (auto &t : workers)
+        t.join();
+    return false; // Run only returns on a fatal epoll error
+}
+} // namespace http
@@ -0,0 +1,271 @@
+#pragma once
+#include "manifest.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Journal module namespace: lets a large split or combine that was killed
+ * resume instead of starting over. A job keeps a small append-only journal
+ *   pktcore-journal 1
+ *   job <what the job is: its input, output and parameters>
+ *   state <what a resumed run must reuse, e.g. the file_id of a split>
+ *   done <part> <crc32c>
+ * Finished parts are not journaled one by one: they are batched, the job's
+ * own writes are made durable first (one sync per batch), then the batch is
+ * appended and the journal synced. A rerun of the same command finds the
+ * journal, checks the part journaled last against its checksum, and only
+ * does the parts not journaled. The journal is removed once the job is done.
+ */
+namespace journal {
+
+constexpr uint64_t JOURNAL_MIN = 256ull * 1024 * 1024; // smaller jobs restart
+constexpr uint64_t CHECKPOINT_BYTES = 64ull * 1024 * 1024;
+constexpr size_t CHECKPOINT_PARTS = 4096;
+
+/*
+ * Reads a journal.
+ * - @job    : filled with its job line
+ * - @state  : filled with its state line
+ * - @done   : filled with the parts journaled, part -> crc32c
+ * - @last   : filled with the part journaled last
+ * - @return : false when there is no readable journal
+ */
+inline bool Load(const std::string &path, std::string &job, std::string &state,
+                 std::map<uint32_t, uint32_t> &done, uint32_t &last);
+
+class Journal {
+  public:
+    Journal() = default;
+    ~Journal();
+
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+
+    /*
+     * Opens the journal of a job, resuming it when an existing journal is
+     * for the same job, else starting a new one.
+     * - @path  : journal file
+     * - @job   : one line naming the job; a journal for another job is
+     *            replaced
+     * - @state : stored in a new journal; replaced by the stored one when
+     *            the job resumes
+     * - @sync  : makes the job's writes durable, run before every checkpoint
+     */
+    bool Open(const std::string &path, const std::string &job,
+              std::string &state, std::function<bool()> sync);
+
+    bool Resumed() const { return resumed_; }
+
+    /*
+     * Parts done by the runs before, part -> crc32c.
+     */
+    const std::map<uint32_t, uint32_t> &Done() const { return done_; }
+
+    /*
+     * Part journaled last: where the previous run stopped.
+     */
+    uint32_t Boundary() const { return boundary_; }
+
+    /*
+     * Drops a part from the done set, e.g. a boundary that failed its check.
+     */
+    void Forget(uint32_t part) { done_.erase(part); }
+
+    /*
+     * Records a finished part. Checkpoints once enough work is pending.
+     * Safe to call from several threads.
+     */
+    bool Complete(uint32_t part, uint32_t crc, uint64_t bytes);
+
+    /*
+     * Makes everything recorded so far durable.
+     */
+    bool Checkpoint();
+
+    /*
+     * The job is done: the journal is deleted.
+     */
+    void Remove();
+
+  private:
+    bool Checkpoint_Locked();
+
+    std::string path_;
+    int fd_ = -1;
+    bool resumed_ = false;
+    std::map<uint32_t, uint32_t> done_;
+    uint32_t boundary_ = 0;
+    std::function<bool()> sync_;
+
+    std::mutex lock_;
+    std::string pending_; // records not appended yet
+    size_t pending_parts_ = 0;
+    uint64_t pending_bytes_ = 0;
+};
+
+/*
+ * Sync callback that makes every write to the filesystems holding the given
+ * directories durable (syncfs), for jobs writing many files.
+ */
+inline std::function<bool()> Sync_Filesystems(std::vector<std::string> dirs);
+
+/*
+ * crc32c of [offset, offset + len) of a file, to check a part journaled as
+ * done before it is trusted. Chains: pass the crc of the bytes before.
+ * - @return : false when the range cannot be read in full
+ */
+inline bool Crc_Of(int fd, uint64_t offset, uint64_t len, uint32_t &crc);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+inline bool Load(const std::string &path, std::string &job, std::string &state,
+                 std::map<uint32_t, uint32_t> &done, uint32_t &last) {
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line) || line != "pktcore-journal 1")
+        return false;
+
+    job.clear();
+    state.clear();
+    done.clear();
+    last = 0;
+    while (std::getline(in, line)) {
+        // A record cut short by a crash has no newline: it is not there
+        if (in.eof())
+            break;
+        if (line.compare(0, 4, "job ") == 0) {
+            job = line.substr(4);
+        } else if (line.compare(0, 6, "state ") == 0) {
+            state = line.substr(6);
+        } else if (line.compare(0, 5, "done ") == 0) {
+            std::istringstream fields(line.substr(5));
+            uint32_t part, crc;
+            if (fields >> part >> crc) {
+                done[part] = crc;
+                last = part;
+            }
+        }
+    }
+    return !job.empty();
+}
+
+inline Journal::~Journal() {
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+inline bool Journal::Open(const std::string &path, const std::string &job,
+                          std::string &state, std::function<bool()> sync) {
+    path_ = path;
+    sync_ = std::move(sync);
+
+    std::string old_job, old_state;
+    resumed_ = Load(path, old_job, old_state, done_, boundary_) &&
+               old_job == job;
+    if (resumed_) {
+        state = old_state;
+        fd_ = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    } else {
+        done_.clear();
+        boundary_ = 0;
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                     0644);
+        std::string head =
+            "pktcore-journal 1\njob " + job + "\nstate " + state + "\n";
+        if (fd_ >= 0 &&
+            (::write(fd_, head.data(), head.size()) !=
+                 static_cast<ssize_t>(head.size()) ||
+             ::fdatasync(fd_) != 0)) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+    if (fd_ < 0) {
+        std::cerr << "Could not write journal: " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+inline bool Journal::Complete(uint32_t part, uint32_t crc, uint64_t bytes) {
+    std::lock_guard<std::mutex> guard(lock_);
+    pending_ += "done " + std::to_string(part) + " " + std::to_string(crc) +
+                "\n";
+    pending_parts_++;
+    pending_bytes_ += bytes;
+    if (pending_bytes_ < CHECKPOINT_BYTES && pending_parts_ < CHECKPOINT_PARTS)
+        return true;
+    return Checkpoint_Locked();
+}
+
+inline bool Journal::Checkpoint() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return Checkpoint_Locked();
+}
+
+inline bool Journal::Checkpoint_Locked() {
+    if (fd_ < 0 || pending_.empty())
+        return fd_ >= 0;
+    // The parts first, then the records saying they are there
+    bool ok = (!sync_ || sync_()) &&
+              ::write(fd_, pending_.data(), pending_.size()) ==
+                  static_cast<ssize_t>(pending_.size()) &&
+              ::fdatasync(fd_) == 0;
+    pending_.clear();
+    pending_parts_ = 0;
+    pending_bytes_ = 0;
+    if (!ok)
+        std::cerr << "Could not write journal: " << path_ << "\n";
+    return ok;
+}
+
+inline void Journal::Remove() {
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+    ::unlink(path_.c_str());
+}
+
+inline std::function<bool()> Sync_Filesystems(std::vector<std::string> dirs) {
+    return [dirs] {
+        bool ok = true;
+        for (const auto &dir : dirs) {
+            int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            ok = fd >= 0 && ::syncfs(fd) == 0 && ok;
+            if (fd >= 0)
+                ::close(fd);
+        }
+        return ok;
+    };
+}
+
+inline bool Crc_Of(int fd, uint64_t offset, uint64_t len, uint32_t &crc) {
+    std::vector<uint8_t> buf(1024 * 1024);
+    while (len > 0) {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(len, buf.size()));
+        ssize_t got = ::pread(fd, buf.data(), want, static_cast<off_t>(offset));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        crc = manifest::Crc32c(buf.data(), static_cast<size_t>(got), crc);
+        offset += static_cast<uint64_t>(got);
+        len -= static_cast<uint64_t>(got);
+    }
+    return true;
+}
+} // namespace journal
@@ -0,0 +1,482 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <sys/statvfs.h>
+#include <thread>
+#include <vector>
+
+/*
+ * Layout module namespace: where packet files live.
+ * Packets go to one directory (--out-dir, the current one by default). A flat
+ * directory slows down every create, lookup and scan once it holds hundreds
+ * of thousands of entries, so a directory can be fanned out: each packet is
+ * stored under `levels` shard directories picked from a hash of its name,
+ *   <root>/ab/cd/<HEX>_<n>
+ * Consecutive parts land in different shards, so concurrent writers do not
+ * all contend on one directory.
+ * Several roots, one per drive, can be given at once: packets are striped
+ * over them like RAID-0, round-robin or weighted by the free space each root
+ * had when the stripe set was created. Split and combine run one I/O group
+ * per root, so throughput adds up across drives.
+ * The choice is recorded in a marker file in every root, so later commands
+ * find the packets without being told again.
+ */
+namespace layout {
+
+constexpr const char *MARKER = ".pktcore-layout";
+constexpr uint32_t MAX_LEVELS = 4;   // one hash byte per level
+constexpr uint32_t MAX_WEIGHT = 16;  // slots of the root with most space
+constexpr size_t MAX_ROOTS = 64;
+
+struct Layout {
+    std::vector<std::string> roots = {"."};
+    uint32_t levels = 0;           // 0: flat, else 256 shards per level
+    std::vector<uint32_t> weights; // slots per root, empty: round-robin
+    std::vector<uint32_t> slots;   // root of each stripe slot, from weights
+};
+
+/*
+ * What the marker of one root records.
+ */
+struct Marker {
+    uint32_t levels = 0;
+    uint32_t index = 0; // position of this root in the stripe set
+    uint32_t count = 1; // roots in the stripe set
+    std::vector<uint32_t> weights;
+};
+
+/*
+ * Layout of the packet directories used by this process.
+ */
+inline Layout &Active();
+
+/*
+ * Reads the marker of a directory.
+ * - @return : false when the directory has none (a flat, single root)
+ */
+inline bool Load(const std::string &root, Marker &found);
+
+/*
+ * Makes the given roots the packet directories of this process, creating
+ * them if needed. Roots of an existing stripe set may be listed in any order.
+ * - @roots  : comma separated directories, one per drive
+ * - @levels : fan-out to use; -1 takes the one recorded in the markers
+ * - @stripe : "rr" or "space" for a new stripe set; empty takes the markers
+ */
+inline bool Select(const std::string &roots, int levels = -1,
+                   const std::string &stripe = "");
+
+/*
+ * Root (stripe) a part is stored on.
+ */
+inline size_t Stripe_Of(uint32_t part, const Layout &where = Active());
+
+/*
+ * Shard directories of a packet name, e.g. "ab/cd" (empty when flat).
+ */
+inline std::string Shard_Of(const std::string &name, uint32_t levels);
+
+/*
+ * Path of a packet file from its name (<HEX>_<n>).
+ */
+inline std::string Path_Of(const std::string &name,
+                           const Layout &where = Active());
+
+/*
+ * Index of the root a packet path lies in.
+ */
+inline size_t Root_Of(const std::string &path, const Layout &where = Active());
+
+/*
+ * Creates the shard directories of a packet path before it is written.
+ * Each directory is created once per process.
+ */
+inline bool Prepare(const std::string &path);
+
+/*
+ * Calls visit for every regular file of the packet directories. Roots and
+ * shards are walked by several threads at once, so visit must be thread safe.
+ */
+inline void For_Each_File(const std::function<void(const std::string &)> &visit,
+                          const Layout &where = Active(), size_t threads = 0);
+
+/*
+ * Every regular file of the packet directories, sorted.
+ */
+inline std::vector<std::string> Files(const Layout &where = Active(),
+                                      size_t threads = 0);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+inline Layout &Active() {
+    static Layout active;
+    return active;
+}
+
+inline bool Load(const std::string &root, Marker &found) {
+    std::ifstream marker(std::filesystem::path(root) / MARKER);
+    std::string magic;
+    int version = 0;
+    if (!(marker >> magic >> version) || magic != "pktcore-layout")
+        return false;
+
+    Marker read;
+    std::string line;
+    while (std::getline(marker, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        fields >> key;
+        if (key == "levels") {
+            fields >> read.levels;
+        } else if (key == "stripe") {
+            fields >> read.index >> read.count;
+        } else if (key == "weights") {
+            for (uint32_t w; fields >> w;)
+                read.weights.push_back(w);
+        }
+    }
+    if (read.levels > MAX_LEVELS || read.count == 0 ||
+        read.index >= read.count ||
+        (!read.weights.empty() && read.weights.size() != read.count))
+        return false;
+    found = read;
+    return true;
+}
+
+/*
+ * True when a directory already holds packet files at its top level.
+ */
+inline bool Has_Flat_Packets(const std::string &root) {
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(root, ec)) {
+        std::string name = entry.path().filename().string();
+        size_t cut = name.find('_');
+        if (cut == 10 && cut + 1 < name.size() &&
+            name.find_first_not_of("0123456789ABCDEF") == cut &&
+            name.find_first_not_of("0123456789", cut + 1) ==
+                std::string::npos &&
+            entry.is_regular_file(ec))
+            return true;
+    }
+    return false;
+}
+
+inline bool Write_Marker(const std::string &root, const Marker &marker) {
+    std::ofstream out(std::filesystem::path(root) / MARKER);
+    out << "pktcore-layout 1\nlevels " << marker.levels << "\n";
+    if (marker.count > 1)
+        out << "stripe " << marker.index << " " << marker.count << "\n";
+    if (!marker.weights.empty()) {
+        out << "weights";
+        for (uint32_t w : marker.weights)
+            out << " " << w;
+        out << "\n";
+    }
+    if (!out) {
+        std::cerr << "Could not write layout marker in: " << root << "\n";
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Weights from the space still free on each root: the root with the most
+ * gets MAX_WEIGHT slots, the others proportionally fewer but at least one.
+ */
+inline std::vector<uint32_t> Free_Space_Weights(
+    const std::vector<std::string> &roots) {
+    std::vector<uint64_t> free_bytes;
+    uint64_t most = 0;
+    for (const auto &root : roots) {
+        struct statvfs vfs;
+        uint64_t bytes = statvfs(root.c_str(), &vfs) == 0
+                             ? static_cast<uint64_t>(vfs.f_bavail) * vfs.f_frsize
+                             : 0;
+        free_bytes.push_back(bytes);
+        most = std::max(most, bytes);
+    }
+    std::vector<uint32_t> weights;
+    for (uint64_t bytes : free_bytes)
+        weights.push_back(most == 0 ? 1
+                                    : std::max<uint32_t>(
+                                          1, static_cast<uint32_t>(
+                                                 (bytes * MAX_WEIGHT + most / 2) /
+                                                 most)));
+    return weights;
+}
+
+/*
+ * Smooth weighted round-robin: roots with more slots come up more often,
+ * but their slots are spread over the cycle instead of bunched together.
+ */
+inline std::vector<uint32_t> Build_Slots(const std::vector<uint32_t> &weights) {
+    std::vector<uint32_t> slots;
+    std::vector<int64_t> current(weights.size(), 0);
+    int64_t total = 0;
+    for (uint32_t w : weights)
+        total += w;
+    for (int64_t n = 0; n < total; n++) {
+        size_t best = 0;
+        for (size_t i = 0; i < weights.size(); i++) {
+            current[i] += weights[i];
+            if (current[i] > current[best])
+                best = i;
+        }
+        current[best] -= total;
+        slots.push_back(static_cast<uint32_t>(best));
+    }
+    return slots;
+}
+
+inline bool Select(const std::string &roots, int levels,
+                   const std::string &stripe) {
+    if (levels < -1 || levels > static_cast<int>(MAX_LEVELS)) {
+        std::cerr << "Fan-out must be between 0 and " << MAX_LEVELS << "\n";
+        return false;
+    }
+    if (!stripe.empty() && stripe != "rr" && stripe != "space") {
+        std::cerr << "Stripe mode must be rr or space\n";
+        return false;
+    }
+
+    std::vector<std::string> dirs;
+    std::stringstream list(roots);
+    for (std::string dir; std::getline(list, dir, ',');) {
+        if (!dir.empty())
+            dirs.push_back(dir);
+    }
+    if (dirs.empty())
+        dirs.push_back(".");
+    if (dirs.size() > MAX_ROOTS) {
+        std::cerr << "At most " << MAX_ROOTS << " roots can be striped\n";
+        return false;
+    }
+
+    std::vector<Marker> markers(dirs.size());
+    size_t marked = 0;
+    for (size_t i = 0; i < dirs.size(); i++) {
+        std::error_code ec;
+        std::filesystem::create_directories(dirs[i], ec);
+        if (ec || !std::filesystem::is_directory(dirs[i])) {
+            std::cerr << "Could not create directory: " << dirs[i] << "\n";
+            return false;
+        }
+        marked += Load(dirs[i], markers[i]);
+    }
+
+    Layout chosen;
+    if (marked > 0) {
+        // An existing set: every root must belong to it, in its own slot
+        chosen.roots.assign(dirs.size(), "");
+        for (size_t i = 0; i < dirs.size(); i++) {
+            const Marker &m = markers[i];
+            if (marked != dirs.size() || m.count != dirs.size() ||
+                m.levels != markers[0].levels ||
+                !chosen.roots[m.index].empty()) {
+                std::cerr << "The roots do not form one stripe set: " << roots
+                          << "\n";
+                return false;
+            }
+            chosen.roots[m.index] = dirs[i];
+        }
+        if (levels >= 0 && static_cast<uint32_t>(levels) != markers[0].levels) {
+            std::cerr << roots << " already uses a fan-out of "
+                      << markers[0].levels << "\n";
+            return false;
+        }
+        if (!stripe.empty() && (stripe == "space") != !markers[0].weights.empty()) {
+            std::cerr << roots << " already uses another stripe mode\n";
+            return false;
+        }
+        chosen.levels = markers[0].levels;
+        chosen.weights = markers[0].weights;
+    } else {
+        chosen.roots = dirs;
+        chosen.levels = levels > 0 ? static_cast<uint32_t>(levels) : 0;
+        if (stripe == "space" && dirs.size() > 1)
+            chosen.weights = Free_Space_Weights(dirs);
+        // A plain flat directory needs no marker. Packets already lying
+        // flat in a root would no longer be found where the new layout
+        // looks for them: such roots are left as they are.
+        bool marking = dirs.size() > 1 || levels > 0;
+        for (size_t i = 0; i < dirs.size() && marking; i++) {
+            if (Has_Flat_Packets(dirs[i])) {
+                std::cerr << dirs[i] << " already holds packets without "
+                          << "fan-out or striping; use an empty directory "
+                          << "or combine them first\n";
+                return false;
+            }
+        }
+        for (size_t i = 0; i < dirs.size() && marking; i++) {
+            Marker m;
+            m.levels = chosen.levels;
+            m.index = static_cast<uint32_t>(i);
+            m.count = static_cast<uint32_t>(dirs.size());
+            m.weights = chosen.weights;
+            if (!Write_Marker(dirs[i], m))
+                return false;
+        }
+    }
+    chosen.slots = Build_Slots(chosen.weights);
+    Active() = chosen;
+    return true;
+}
+
+inline size_t Stripe_Of(uint32_t part, const Layout &where) {
+    if (!where.slots.empty())
+        return where.slots[part % where.slots.size()];
+    return part % where.roots.size();
+}
+
+inline std::string Shard_Of(const std::string &name, uint32_t levels) {
+    // FNV-1a: cheap and spreads names that only differ in the part number
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    std::string shard;
+    for (uint32_t i = 0; i < levels; i++) {
+        char buf[4];
+        snprintf(buf, sizeof(buf), "%02x", (hash >> (8 * i)) & 0xFF);
+        if (!shard.empty())
+            shard += '/';
+        shard += buf;
+    }
+    return shard;
+}
+
+inline std::string Path_Of(const std::string &name, const Layout &where) {
+    size_t sep = name.rfind('_');
+    uint32_t part = sep == std::string::npos
+                        ? 0
+                        : static_cast<uint32_t>(
+                              std::strtoul(name.c_str() + sep + 1, nullptr, 10));
+    const std::string &root = where.roots[Stripe_Of(part, where)];
+    std::string shard = Shard_Of(name, where.levels);
+
+    // Flat packets in the current directory keep their bare names
+    if (root == "." && shard.empty())
+        return name;
+    std::filesystem::path path(root);
+    if (!shard.empty())
+        path /= shard;
+    return (path / name).string();
+}
+
+inline size_t Root_Of(const std::string &path, const Layout &where) {
+    size_t current = 0; // "." holds the relative paths
+    for (size_t i = 0; i < where.roots.size(); i++) {
+        const std::string &root = where.roots[i];
+        if (root == ".")
+            current = i;
+        else if (path.compare(0, root.size(), root) == 0 &&
+                 (path.size() == root.size() || path[root.size()] == '/'))
+            return i;
+    }
+    return current;
+}
+
+inline bool Prepare(const std::string &path) {
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    if (dir.empty())
+        return true;
+
+    static std::mutex lock;
+    static std::set<std::string> created;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (created.count(dir))
+            return true;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+        std::cerr << "Could not create directory: " << dir << "\n";
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    created.insert(dir);
+    return true;
+}
+
+inline bool Is_Shard(const std::string &name) {
+    return name.size() == 2 && std::isxdigit(static_cast<unsigned char>(name[0])) &&
+           std::isxdigit(static_cast<unsigned char>(name[1]));
+}
+
+inline void For_Each_File(const std::function<void(const std::string &)> &visit,
+                          const Layout &where, size_t threads) {
+    if (threads == 0)
+        threads = std::min<size_t>(
+            std::max(1u, std::thread::hardware_concurrency()), 16);
+
+    // Work items: single files at a root, whole shards below it. The
+    // .pktcore-* files (marker, journals) are not packets.
+    std::vector<std::string> files, shards;
+    for (const auto &root : where.roots) {
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(root, ec)) {
+            std::string name = entry.path().filename().string();
+            if (where.levels > 0 && Is_Shard(name) && entry.is_directory(ec))
+                shards.push_back(entry.path().string());
+            else if (name.compare(0, 9, ".pktcore-") != 0 &&
+                     entry.is_regular_file(ec))
+                files.push_back(root == "." ? name : entry.path().string());
+        }
+    }
+
+    std::atomic<size_t> next_file{0}, next_shard{0};
+    auto work = [&] {
+        for (size_t i = next_file++; i < files.size(); i = next_file++)
+            visit(files[i]);
+        for (size_t i = next_shard++; i < shards.size(); i = next_shard++) {
+            std::error_code walk_ec;
+            for (const auto &entry : std::filesystem::recursive_directory_iterator(
+                     shards[i], walk_ec)) {
+                if (entry.is_regular_file(walk_ec))
+                    visit(entry.path().string());
+            }
+        }
+    };
+
+    // Small flat directories are not worth the threads
+    threads = std::min(threads, std::max<size_t>(shards.size(), files.size() / 256));
+    if (threads <= 1) {
+        work();
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+        workers.emplace_back(work);
+    for (auto &w : workers)
+        w.join();
+}
+
+inline std::vector<std::string> Files(const Layout &where, size_t threads) {
+    std::vector<std::string> files;
+    std::mutex lock;
+    For_Each_File(
+        [&](const std::string &path) {
+            std::lock_guard<std::mutex> guard(lock);
+            files.push_back(path);
+        },
+        where, threads);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+} // namespace layout
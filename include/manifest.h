@@ -0,0 +1,419 @@
+#pragma once
+#include "full_header.h"
+#include "pkt_utils.h"
+#include "schema.h"
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Manifest module namespace: version 2 of the 0th split file.
+ * A full header flagged FLAG_MANIFEST is followed by a manifest describing
+ * the whole packet set:
+ *   magic "PMAN"(4) version(1) section count(2)
+ *   per section: type(2) length(4) body
+ *   crc32c(4) of every byte above
+ * - NAME    : original filename of any length (the full header keeps its
+ *             first 19 bytes for older readers)
+ * - PACKETS : one fixed size record per part, in part order
+ * - ENTRIES : entry table of a packed set
+ * Readers skip sections they do not know, so sections can be added without
+ * a new version. With the packet table, combine and verification plan every
+ * read from part 0 alone, without scanning the directory or opening a
+ * packet to learn what it holds.
+ */
+namespace manifest {
+
+constexpr uint8_t VERSION = 2;
+constexpr uint16_t SECTION_NAME = 1;
+constexpr uint16_t SECTION_PACKETS = 2;
+constexpr uint16_t SECTION_ENTRIES = 3;
+
+struct Manifest_Fields {
+    using Layout = header::Schema<4, 1, 2>;
+    using Magic = Layout::At<0>; // "PMAN"
+    using Version = Layout::At<1>;
+    using Sections = Layout::At<2>;
+    static constexpr size_t SIZE = Layout::SIZE;
+};
+
+struct Section_Fields {
+    using Layout = header::Schema<2, 4>;
+    using Type = Layout::At<0>;
+    using Length = Layout::At<1>;
+    static constexpr size_t SIZE = Layout::SIZE;
+};
+
+/*
+ * Record of one part in the PACKETS section.
+ */
+struct Packet_Fields {
+    using Layout = header::Schema<8, 8, 4, 2, 1, 1>;
+    using Payload = Layout::At<0>; // payload bytes
+    using Offset = Layout::At<1>;  // where the payload goes in the file
+    using Crc = Layout::At<2>;     // crc32c of the payload
+    using Root = Layout::At<3>;    // root of the stripe set holding it
+    using Header = Layout::At<4>;  // packet header bytes before the payload
+    using Flags = Layout::At<5>;   // header::PACKET_* bits of the part
+    static constexpr size_t SIZE = Layout::SIZE;
+};
+
+struct Packet {
+    uint64_t payload = 0;
+    uint64_t offset = 0;
+    uint32_t crc = 0;
+    uint16_t root = 0;
+    uint8_t header_len = 0;
+    uint8_t flags = 0; // header::PACKET_* bits of the part
+};
+
+struct Manifest {
+    uint8_t version = 1; // 1: derived from a full header, no checksums
+    std::string name;
+    std::vector<Packet> packets; // part i at index i - 1
+    std::vector<uint8_t> entries;
+};
+
+/*
+ * CRC-32C (Castagnoli) of a buffer. Chains: pass the crc of the bytes before.
+ * Uses the SSE4.2 instruction when the CPU has it.
+ */
+inline uint32_t Crc32c(const void *data, size_t len, uint32_t crc = 0);
+
+/*
+ * Describes a packet set whose parts are laid out as the full header says.
+ * - @full  : full header of the set
+ * - @name  : original filename
+ * - @crcs  : crc32c of every part, crcs[part]; empty for a version 1 view
+ * - @flags : header::PACKET_* bits of every part, flags[part]
+ */
+inline Manifest Build(const header::Full_Header &full, const std::string &name,
+                      const std::vector<uint32_t> &crcs,
+                      const std::vector<uint8_t> &flags = {});
+
+inline std::vector<uint8_t> Encode(const Manifest &manifest);
+
+/*
+ * - @return : false if the bytes are not a version 2 manifest or damaged
+ */
+inline bool Decode(const uint8_t *data, size_t len, Manifest &manifest);
+
+/*
+ * Length of a manifest starting at data, found by walking its sections.
+ * - @return : 0 if no whole manifest fits in avail bytes
+ */
+inline size_t Measure(const uint8_t *data, size_t avail);
+
+/*
+ * Writes the 0th split file: the full header, flagged FLAG_MANIFEST, then
+ * the manifest. It is synced before returning.
+ */
+inline bool WRITE_MANIFEST(const std::string &filename,
+                           header::Full_Header full, const Manifest &manifest);
+
+/*
+ * Reads the 0th split file. Sets written before manifests existed get a
+ * version 1 manifest derived from their full header.
+ * - @return : false if there is no full header or its manifest is damaged
+ */
+inline bool READ_MANIFEST(const std::string &filename,
+                          header::Full_Header &full, Manifest &manifest);
+
+/*
+ * Reads only the original filename from the 0th split file, seeking past
+ * the other sections. The manifest checksum is not verified.
+ * - @return : false if there is no full header or no readable NAME section
+ */
+inline bool READ_NAME(const std::string &filename, header::Full_Header &full,
+                      std::string &name);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+struct Crc_Tables {
+    uint32_t table[8][256];
+
+    Crc_Tables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++)
+            for (int k = 1; k < 8; k++)
+                table[k][i] = (table[k - 1][i] >> 8) ^
+                              table[0][table[k - 1][i] & 0xFF];
+    }
+};
+
+// Slicing-by-8: eight table lookups per 8 bytes
+inline uint32_t Crc32c_Soft(const uint8_t *p, size_t len, uint32_t crc) {
+    static const Crc_Tables tables;
+    const auto &t = tables.table;
+    while (len >= 8) {
+        uint64_t word = header::Field<0, 8>::Get<uint64_t>(p) ^ crc;
+        crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^
+              t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF] ^
+              t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^
+              t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2"))) inline uint32_t
+Crc32c_Hard(const uint8_t *p, size_t len, uint32_t crc) {
+    uint64_t wide = crc;
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        wide = __builtin_ia32_crc32di(wide, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(wide);
+    while (len-- > 0)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+#endif
+
+inline uint32_t Crc32c(const void *data, size_t len, uint32_t crc) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+#if defined(__x86_64__) && defined(__GNUC__)
+    static const bool hard = __builtin_cpu_supports("sse4.2");
+    if (hard)
+        return ~Crc32c_Hard(p, len, ~crc);
+#endif
+    return ~Crc32c_Soft(p, len, ~crc);
+}
+
+inline Manifest Build(const header::Full_Header &full, const std::string &name,
+                      const std::vector<uint32_t> &crcs,
+                      const std::vector<uint8_t> &flags) {
+    Manifest manifest;
+    manifest.version = crcs.empty() ? 1 : VERSION;
+    manifest.name = name;
+    uint32_t parts = header::Packets_Of(full);
+    for (uint32_t part = 1; part <= parts; part++) {
+        Packet packet;
+        packet.offset = header::Packet_Start(full, part);
+        packet.payload = header::Packet_Start(full, part + 1) - packet.offset;
+        packet.crc = part < crcs.size() ? crcs[part] : 0;
+        packet.root = static_cast<uint16_t>(layout::Stripe_Of(part));
+        packet.header_len =
+            static_cast<uint8_t>(header::Packet_Header_Size(full, part));
+        packet.flags = part < flags.size() ? flags[part] : 0;
+        manifest.packets.push_back(packet);
+    }
+    return manifest;
+}
+
+inline void Put_Section(std::vector<uint8_t> &out, uint16_t type,
+                        const uint8_t *body, size_t len) {
+    uint8_t head[Section_Fields::SIZE];
+    Section_Fields::Type::Put(head, type);
+    Section_Fields::Length::Put(head, static_cast<uint32_t>(len));
+    out.insert(out.end(), head, head + sizeof(head));
+    out.insert(out.end(), body, body + len);
+}
+
+inline std::vector<uint8_t> Encode(const Manifest &manifest) {
+    std::vector<uint8_t> out(Manifest_Fields::SIZE);
+    std::memcpy(out.data(), "PMAN", 4);
+    Manifest_Fields::Version::Put(out.data(), VERSION);
+    Manifest_Fields::Sections::Put(out.data(),
+                                   uint16_t(manifest.entries.empty() ? 2 : 3));
+
+    Put_Section(out, SECTION_NAME,
+                reinterpret_cast<const uint8_t *>(manifest.name.data()),
+                manifest.name.size());
+
+    std::vector<uint8_t> table(manifest.packets.size() * Packet_Fields::SIZE);
+    uint8_t *record = table.data();
+    for (const auto &packet : manifest.packets) {
+        Packet_Fields::Payload::Put(record, packet.payload);
+        Packet_Fields::Offset::Put(record, packet.offset);
+        Packet_Fields::Crc::Put(record, packet.crc);
+        Packet_Fields::Root::Put(record, packet.root);
+        Packet_Fields::Header::Put(record, packet.header_len);
+        Packet_Fields::Flags::Put(record, packet.flags);
+        record += Packet_Fields::SIZE;
+    }
+    Put_Section(out, SECTION_PACKETS, table.data(), table.size());
+
+    if (!manifest.entries.empty())
+        Put_Section(out, SECTION_ENTRIES, manifest.entries.data(),
+                    manifest.entries.size());
+
+    uint8_t crc[4];
+    header::Field<0, 4>::Put(crc, Crc32c(out.data(), out.size()));
+    out.insert(out.end(), crc, crc + sizeof(crc));
+    return out;
+}
+
+inline bool Decode(const uint8_t *data, size_t len, Manifest &manifest) {
+    if (len < Manifest_Fields::SIZE + 4 || std::memcmp(data, "PMAN", 4) != 0 ||
+        Manifest_Fields::Version::Get<uint8_t>(data) != VERSION)
+        return false;
+    len -= 4;
+    if (header::Field<0, 4>::Get<uint32_t>(data + len) != Crc32c(data, len))
+        return false;
+
+    manifest = Manifest();
+    manifest.version = VERSION;
+    uint16_t sections = Manifest_Fields::Sections::Get<uint16_t>(data);
+    size_t pos = Manifest_Fields::SIZE;
+    for (uint16_t i = 0; i < sections; i++) {
+        if (len - pos < Section_Fields::SIZE)
+            return false;
+        uint16_t type = Section_Fields::Type::Get<uint16_t>(data + pos);
+        uint32_t size = Section_Fields::Length::Get<uint32_t>(data + pos);
+        pos += Section_Fields::SIZE;
+        if (len - pos < size)
+            return false;
+        const uint8_t *body = data + pos;
+        pos += size;
+
+        if (type == SECTION_NAME) {
+            manifest.name.assign(reinterpret_cast<const char *>(body), size);
+        } else if (type == SECTION_PACKETS) {
+            if (size % Packet_Fields::SIZE != 0)
+                return false;
+            for (uint32_t at = 0; at < size; at += Packet_Fields::SIZE) {
+                Packet packet;
+                packet.payload = Packet_Fields::Payload::Get<uint64_t>(body + at);
+                packet.offset = Packet_Fields::Offset::Get<uint64_t>(body + at);
+                packet.crc = Packet_Fields::Crc::Get<uint32_t>(body + at);
+                packet.root = Packet_Fields::Root::Get<uint16_t>(body + at);
+                packet.header_len =
+                    Packet_Fields::Header::Get<uint8_t>(body + at);
+                packet.flags = Packet_Fields::Flags::Get<uint8_t>(body + at);
+                manifest.packets.push_back(packet);
+            }
+        } else if (type == SECTION_ENTRIES) {
+            manifest.entries.assign(body, body + size);
+        }
+    }
+    return true;
+}
+
+inline size_t Measure(const uint8_t *data, size_t avail) {
+    if (avail < Manifest_Fields::SIZE || std::memcmp(data, "PMAN", 4) != 0)
+        return 0;
+    uint16_t sections = Manifest_Fields::Sections::Get<uint16_t>(data);
+    size_t pos = Manifest_Fields::SIZE;
+    for (uint16_t i = 0; i < sections; i++) {
+        if (avail - pos < Section_Fields::SIZE)
+            return 0;
+        uint32_t size = Section_Fields::Length::Get<uint32_t>(data + pos);
+        pos += Section_Fields::SIZE;
+        if (avail - pos < size)
+            return 0;
+        pos += size;
+    }
+    return avail - pos < 4 ? 0 : pos + 4;
+}
+
+inline bool WRITE_MANIFEST(const std::string &filename,
+                           header::Full_Header full, const Manifest &manifest) {
+    full.flags[0] |= header::FLAG_MANIFEST;
+    std::vector<uint8_t> bytes(header::Bytes_Of(full),
+                               header::Bytes_Of(full) + header::FULL_HEADER_SIZE);
+    std::vector<uint8_t> tail = Encode(manifest);
+    bytes.insert(bytes.end(), tail.begin(), tail.end());
+
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    bool ok = fd >= 0 &&
+              ::write(fd, bytes.data(), bytes.size()) ==
+                  static_cast<ssize_t>(bytes.size()) &&
+              ::fdatasync(fd) == 0;
+    if (fd >= 0)
+        ::close(fd);
+    if (!ok)
+        std::cerr << "Failed to write manifest: " << filename << "\n";
+    return ok;
+}
+
+inline bool READ_MANIFEST(const std::string &filename,
+                          header::Full_Header &full, Manifest &manifest) {
+    if (!header::READ_FULL_HEADER(filename, full))
+        return false;
+    if (!(full.flags[0] & header::FLAG_MANIFEST)) {
+        manifest = Build(full, header::Name_Of(full), {});
+        return true;
+    }
+
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    bool ok = fd >= 0 && fstat(fd, &st) == 0 &&
+              static_cast<size_t>(st.st_size) > header::FULL_HEADER_SIZE;
+    std::vector<uint8_t> bytes;
+    if (ok) {
+        bytes.resize(st.st_size - header::FULL_HEADER_SIZE);
+        ok = ::pread(fd, bytes.data(), bytes.size(), header::FULL_HEADER_SIZE) ==
+                 static_cast<ssize_t>(bytes.size()) &&
+             Decode(bytes.data(), bytes.size(), manifest) &&
+             manifest.packets.size() == header::Packets_Of(full);
+    }
+    if (fd >= 0)
+        ::close(fd);
+    if (!ok)
+        std::cerr << "Damaged manifest in: " << filename << "\n";
+    return ok;
+}
+
+inline bool READ_NAME(const std::string &filename, header::Full_Header &full,
+                      std::string &name) {
+    if (!header::READ_FULL_HEADER(filename, full))
+        return false;
+    if (!(full.flags[0] & header::FLAG_MANIFEST)) {
+        name = header::Name_Of(full);
+        return true;
+    }
+
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    uint8_t head[Manifest_Fields::SIZE];
+    off_t pos = header::FULL_HEADER_SIZE;
+    bool found = false;
+    if (::pread(fd, head, sizeof(head), pos) ==
+            static_cast<ssize_t>(sizeof(head)) &&
+        std::memcmp(head, "PMAN", 4) == 0) {
+        uint16_t sections = Manifest_Fields::Sections::Get<uint16_t>(head);
+        pos += Manifest_Fields::SIZE;
+        for (uint16_t i = 0; i < sections && !found; i++) {
+            uint8_t section[Section_Fields::SIZE];
+            if (::pread(fd, section, sizeof(section), pos) !=
+                static_cast<ssize_t>(sizeof(section)))
+                break;
+            uint16_t type = Section_Fields::Type::Get<uint16_t>(section);
+            uint32_t size = Section_Fields::Length::Get<uint32_t>(section);
+            pos += Section_Fields::SIZE;
+            if (type == SECTION_NAME) {
+                name.resize(size);
+                found = ::pread(fd, &name[0], size, pos) ==
+                        static_cast<ssize_t>(size);
+            }
+            pos += size;
+        }
+    }
+    ::close(fd);
+    if (!found)
+        std::cerr << "Damaged manifest in: " << filename << "\n";
+    return found;
+}
+} // namespace manifest
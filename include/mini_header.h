@@ -1,10 +1,14 @@
 #pragma once
+#include "schema.h"
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <unistd.h>
 #include <vector>
 
 /*
@@ -28,13 +32,52 @@ struct Mini_Header {
      */
     Mini_Header(const std::array<uint8_t, 5> &file_id_input, uint32_t part,
                 uint32_t payload_size_value) {
+        uint8_t *base = reinterpret_cast<uint8_t *>(this);
         file_id = file_id_input;
         std::memcpy(PKTCORE.data(), "PCORE", 5);
-        std::memcpy(packet_no.data(), &part, 4);
-        std::memcpy(payload_len.data(), &payload_size_value, 4);
+        Mini_Fields::Part::Put(base, part);
+        Mini_Fields::Payload::Put(base, payload_size_value);
+        flag = 0;
     }
 };
 
+// The struct is the encoded header byte for byte
+static_assert(sizeof(Mini_Header) == Mini_Fields::SIZE, "mini header padding");
+static_assert(offsetof(Mini_Header, packet_no) == Mini_Fields::Part::offset &&
+                  offsetof(Mini_Header, payload_len) ==
+                      Mini_Fields::Payload::offset &&
+                  offsetof(Mini_Header, flag) == Mini_Fields::Flag::offset,
+              "Mini_Header does not match its schema");
+
+inline uint32_t Part_Of(const Mini_Header &header) {
+    return Mini_Fields::Part::Get<uint32_t>(
+        reinterpret_cast<const uint8_t *>(&header));
+}
+
+inline uint32_t Payload_Len_Of(const Mini_Header &header) {
+    return Mini_Fields::Payload::Get<uint32_t>(
+        reinterpret_cast<const uint8_t *>(&header));
+}
+
+/*
+ * Bits of the packet header flag byte
+ * - PACKET_HOLE : the part is all zeros in a hole of the original file; no
+ *                 payload is stored, the payload length says how long it is
+ */
+constexpr uint8_t PACKET_HOLE = 0x01;
+
+/*
+ * Packet_Info: what a packet header says, in either variant.
+ */
+struct Packet_Info {
+    std::array<uint8_t, 5> file_id{};
+    uint32_t part = 0;
+    uint8_t flag = 0;
+    uint32_t payload_len = 0; // standard headers only, else 0
+    size_t header_len = 0;    // the payload starts here
+    bool compact = false;
+};
+
 /*
  * Global constructor for MINI_HEADER
  * - @file_id      :randomly genrated file_id for every packet of file
@@ -44,6 +87,30 @@ struct Mini_Header {
 inline Mini_Header MINI_HEADER(const std::array<uint8_t, 5> &file_id,
                                uint32_t packet_no, uint32_t payload_size);
 
+/*
+ * Encodes a packet header.
+ * - @out     : at least MAX_PACKET_HEADER bytes
+ * - @compact : compact variant (no payload length, varint part number)
+ * - @return  : header length
+ */
+inline size_t Encode_Packet_Header(const std::array<uint8_t, 5> &file_id,
+                                   uint32_t part, uint32_t payload_len,
+                                   bool compact, uint8_t *out,
+                                   uint8_t flag = 0);
+
+/*
+ * Decodes the packet header at the start of data (either variant).
+ * - @return : false when the bytes are not a packet header
+ */
+inline bool Parse_Packet_Header(const uint8_t *data, size_t len,
+                                Packet_Info &info);
+
+/*
+ * Reads and decodes the header of a packet file.
+ */
+inline bool Read_Packet_Header(int fd, Packet_Info &info);
+inline bool Read_Packet_Header(const std::string &filename, Packet_Info &info);
+
 /*
  * Write_Mini_Header:
  * This function writes a Mini_Header to a given file.
@@ -73,6 +140,72 @@ inline Mini_Header MINI_HEADER(const std::array<uint8_t, 5> &file_id,
     return Mini_Header(file_id, packet_no, payload_size);
 }
 
+inline size_t Encode_Packet_Header(const std::array<uint8_t, 5> &file_id,
+                                   uint32_t part, uint32_t payload_len,
+                                   bool compact, uint8_t *out, uint8_t flag) {
+    if (compact) {
+        Compact_Fields::Magic::Put(out, COMPACT_MAGIC);
+        Compact_Fields::File_ID::Copy_In(out, file_id.data());
+        Compact_Fields::Flag::Put(out, flag);
+        return Compact_Fields::SIZE +
+               Put_Varint(out + Compact_Fields::SIZE, part);
+    }
+    Mini_Fields::Magic::Copy_In(out, reinterpret_cast<const uint8_t *>("PCORE"));
+    Mini_Fields::File_ID::Copy_In(out, file_id.data());
+    Mini_Fields::Part::Put(out, part);
+    Mini_Fields::Payload::Put(out, payload_len);
+    Mini_Fields::Flag::Put(out, flag);
+    return MINI_HEADER_SIZE;
+}
+
+inline bool Parse_Packet_Header(const uint8_t *data, size_t len,
+                                Packet_Info &info) {
+    if (len >= Compact_Fields::SIZE + 1 &&
+        Compact_Fields::Magic::Get<uint8_t>(data) == COMPACT_MAGIC) {
+        size_t used = Get_Varint(data + Compact_Fields::SIZE,
+                                 len - Compact_Fields::SIZE, info.part);
+        if (used == 0)
+            return false;
+        Compact_Fields::File_ID::Copy_Out(data, info.file_id.data());
+        info.flag = Compact_Fields::Flag::Get<uint8_t>(data);
+        info.payload_len = 0;
+        info.header_len = Compact_Fields::SIZE + used;
+        info.compact = true;
+        return true;
+    }
+    // The full header (split 0) starts the same way as a standard header
+    if (len < Mini_Fields::Part::end ||
+        std::memcmp(data + Mini_Fields::Magic::offset, "PCORE", 5) != 0)
+        return false;
+    Mini_Fields::File_ID::Copy_Out(data, info.file_id.data());
+    info.part = Mini_Fields::Part::Get<uint32_t>(data);
+    info.payload_len = len >= Mini_Fields::Payload::end
+                           ? Mini_Fields::Payload::Get<uint32_t>(data)
+                           : 0;
+    info.flag = len >= Mini_Fields::Flag::end
+                    ? Mini_Fields::Flag::Get<uint8_t>(data)
+                    : 0;
+    info.header_len = MINI_HEADER_SIZE;
+    info.compact = false;
+    return true;
+}
+
+inline bool Read_Packet_Header(int fd, Packet_Info &info) {
+    uint8_t buf[MAX_PACKET_HEADER];
+    ssize_t got = ::pread(fd, buf, sizeof(buf), 0);
+    return got > 0 &&
+           Parse_Packet_Header(buf, static_cast<size_t>(got), info);
+}
+
+inline bool Read_Packet_Header(const std::string &filename, Packet_Info &info) {
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = Read_Packet_Header(fd, info);
+    ::close(fd);
+    return ok;
+}
+
 inline void WRITE_MINI_HEADER(const std::string &filename,
                               const Mini_Header &header) {
     std::ofstream out(filename, std::ios::binary | std::ios::trunc);
@@ -85,43 +218,20 @@ inline void WRITE_MINI_HEADER(const std::string &filename,
 }
 
 inline void Print_Mini_Header(const std::string &filepath) {
-    std::ifstream in(filepath, std::ios::binary);
-
-    if (!in) {
-        std::cerr << "Failed to open file: " << filepath << "\n";
-        return;
-    }
-
-    constexpr size_t headerSize = 7 + 4 + 4; //  15 bytes
-    std::vector<uint8_t> buffer(headerSize);
-    in.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
-
-    if (!in) {
+    Packet_Info info;
+    if (!Read_Packet_Header(filepath, info)) {
         std::cerr << "Failed to read mini header from: " << filepath << "\n";
         return;
     }
 
-    size_t offset = 0;
-
-    std::string extention;
-    for (int i = 0; i < 5; ++i)
-        extention += static_cast<char>(buffer[offset++]);
-
-    std::string file_id;
-    for (int i = 0; i < 5; ++i)
-        file_id += static_cast<char>(buffer[offset++]);
-
-    uint32_t packet_no;
-    std::memcpy(&packet_no, &buffer[offset], 4);
-    offset += 4;
-
-    uint32_t packet_size;
-    std::memcpy(&packet_size, &buffer[offset], 4);
-
     std::cout << "📦 Header Info from file: " << filepath << "\n";
-    std::cout << "   Extention      : " << extention << "\n";
-    std::cout << "   File ID        : " << file_id << "\n";
-    std::cout << "   Part Number    : " << packet_no << "\n";
-    std::cout << "   Payload Length : " << packet_size << "\n";
+    std::cout << "   Extention      : " << (info.compact ? "compact" : "PCORE")
+              << "\n";
+    std::cout << "   File ID        : "
+              << std::string(info.file_id.begin(), info.file_id.end()) << "\n";
+    std::cout << "   Part Number    : " << info.part << "\n";
+    if (!info.compact)
+        std::cout << "   Payload Length : " << info.payload_len << "\n";
+    std::cout << "   Header Length  : " << info.header_len << "\n";
 }
 } // namespace header
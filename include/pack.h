@@ -0,0 +1,265 @@
+#pragma once
+#include "full_header.h"
+#include "manifest.h"
+#include "pkt_utils.h"
+#include "reader.h"
+#include "splitter.h"
+#include "throttle.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Pack module namespace: stores many small files as one packet set.
+ * The files are concatenated into a single payload stream under one file_id
+ * and packets are filled to the packet size regardless of file boundaries.
+ * An entry table (name, offset, size) is kept in the manifest of the 0th
+ * split file (right after the full header in sets packed before manifests
+ * existed), so a directory of N tiny files costs one packet set instead of
+ * N headers and N packet files.
+ */
+namespace pack {
+
+/*
+ * One packed file: where its bytes sit in the payload stream.
+ */
+struct Entry {
+    std::string name;
+    uint64_t offset;
+    uint64_t size;
+};
+
+/*
+ * Serializes / parses the entry table stored in the 0th split file:
+ *   uint32 count, then per entry: uint16 name length, name, uint64 offset,
+ *   uint64 size
+ */
+inline std::vector<uint8_t> Encode_Entries(const std::vector<Entry> &entries);
+inline bool Decode_Entries(const std::vector<uint8_t> &bytes,
+                           std::vector<Entry> &entries);
+
+/*
+ * Reads the entry table of a packed set.
+ * - @file_id : file_id of the packet set
+ * - @return  : false if the set is not packed or the table is damaged
+ */
+inline bool READ_ENTRIES(const std::string &file_id,
+                         std::vector<Entry> &entries);
+
+/*
+ * Packs every regular file below a directory into one packet set.
+ * - @dir         : directory to pack (recursively)
+ * - @name        : name stored in the full header
+ * - @packet_size : payload bytes per packet
+ */
+inline bool PACK(const std::string &dir, const std::string &name,
+                 uint32_t packet_size);
+
+/*
+ * Extracts one entry, or all of them when entry is empty, into the current
+ * directory.
+ */
+inline bool UNPACK(const std::string &file_id, const std::string &entry = "");
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+template <typename T> inline void Put(std::vector<uint8_t> &out, T value) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&value);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+inline bool Get(const std::vector<uint8_t> &in, size_t &pos, T &value) {
+    if (in.size() - pos < sizeof(T))
+        return false;
+    std::memcpy(&value, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+inline std::vector<uint8_t> Encode_Entries(const std::vector<Entry> &entries) {
+    std::vector<uint8_t> out;
+    Put<uint32_t>(out, static_cast<uint32_t>(entries.size()));
+    for (const auto &entry : entries) {
+        Put<uint16_t>(out, static_cast<uint16_t>(entry.name.size()));
+        out.insert(out.end(), entry.name.begin(), entry.name.end());
+        Put<uint64_t>(out, entry.offset);
+        Put<uint64_t>(out, entry.size);
+    }
+    return out;
+}
+
+inline bool Decode_Entries(const std::vector<uint8_t> &bytes,
+                           std::vector<Entry> &entries) {
+    size_t pos = 0;
+    uint32_t count;
+    if (!Get(bytes, pos, count))
+        return false;
+
+    entries.clear();
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t len;
+        Entry entry;
+        if (!Get(bytes, pos, len) || bytes.size() - pos < len)
+            return false;
+        entry.name.assign(reinterpret_cast<const char *>(&bytes[pos]), len);
+        pos += len;
+        if (!Get(bytes, pos, entry.offset) || !Get(bytes, pos, entry.size))
+            return false;
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+inline bool READ_ENTRIES(const std::string &file_id,
+                         std::vector<Entry> &entries) {
+    std::string fname = utils::Packet_Path(file_id, 0);
+    header::Full_Header full;
+    manifest::Manifest set;
+    if (!manifest::READ_MANIFEST(fname, full, set) ||
+        !(full.flags[0] & header::FLAG_PACKED)) {
+        std::cerr << "Not a packed set: " << fname << "\n";
+        return false;
+    }
+    auto table = set.version >= manifest::VERSION
+                     ? set.entries
+                     : utils::Fetch_Bytes(fname, header::FULL_HEADER_SIZE);
+    if (!Decode_Entries(table, entries)) {
+        std::cerr << "Damaged entry table in: " << fname << "\n";
+        return false;
+    }
+    return true;
+}
+
+inline bool PACK(const std::string &dir, const std::string &name,
+                 uint32_t packet_size) {
+    if (packet_size == 0) {
+        std::cerr << "Packet size must be greater than zero\n";
+        return false;
+    }
+
+    std::vector<std::filesystem::path> files;
+    std::error_code ec;
+    for (const auto &entry :
+         std::filesystem::recursive_directory_iterator(dir, ec)) {
+        if (entry.is_regular_file())
+            files.push_back(entry.path());
+    }
+    if (ec) {
+        std::cerr << "Could not read directory: " << dir << "\n";
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+
+    splitter::Stream_Splitter stream(name, packet_size);
+    std::vector<Entry> entries;
+    std::vector<uint8_t> buffer(1024 * 1024);
+    for (const auto &path : files) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "Could not open file: " << path << "\n";
+            return false;
+        }
+
+        Entry entry{path.lexically_relative(dir).string(), stream.Bytes(), 0};
+        ssize_t got;
+        while ((got = ::read(fd, buffer.data(), buffer.size())) > 0) {
+            if (!stream.Feed(buffer.data(), static_cast<size_t>(got))) {
+                ::close(fd);
+                return false;
+            }
+        }
+        ::close(fd);
+        if (got < 0) {
+            std::cerr << "Could not read file: " << path << "\n";
+            return false;
+        }
+        entry.size = stream.Bytes() - entry.offset;
+        entries.push_back(entry);
+    }
+
+    if (!stream.Finish(header::FLAG_PACKED, Encode_Entries(entries)))
+        return false;
+    std::cout << "packed " << entries.size() << " files into "
+              << stream.Packets() << " packets\n";
+    return true;
+}
+
+/*
+ * True for an entry name that stays inside the extraction directory: not
+ * empty, not absolute, no ".." climbing out of it.
+ */
+inline bool Inside_Directory(const std::string &name) {
+    std::filesystem::path path = std::filesystem::path(name).lexically_normal();
+    if (name.empty() || path.is_absolute() || path.has_root_name() ||
+        path.empty() || path == ".")
+        return false;
+    return *path.begin() != "..";
+}
+
+inline bool UNPACK(const std::string &file_id, const std::string &entry) {
+    std::vector<Entry> entries;
+    if (!READ_ENTRIES(file_id, entries))
+        return false;
+
+    reader::Packet_Reader pkt_reader;
+    if (!pkt_reader.Open(file_id))
+        return false;
+
+    std::vector<uint8_t> buffer(1024 * 1024);
+    size_t extracted = 0;
+    bool rejected = false;
+    for (const auto &e : entries) {
+        if (!entry.empty() && e.name != entry)
+            continue;
+        // Entry names come from the set: never written outside the cwd
+        if (!Inside_Directory(e.name)) {
+            std::cerr << "Skipping entry outside the directory: " << e.name
+                      << "\n";
+            rejected = true;
+            continue;
+        }
+
+        std::filesystem::path out_path(e.name);
+        if (out_path.has_parent_path())
+            std::filesystem::create_directories(out_path.parent_path());
+        int fd = ::open(e.name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        0644);
+        if (fd < 0) {
+            std::cerr << "Failed to create file: " << e.name << "\n";
+            return false;
+        }
+
+        uint64_t done = 0;
+        while (done < e.size) {
+            size_t want = static_cast<size_t>(
+                std::min<uint64_t>(buffer.size(), e.size - done));
+            throttle::Charge(want, 2);
+            ssize_t got =
+                pkt_reader.Read(e.offset + done, buffer.data(), want);
+            if (got <= 0 || ::write(fd, buffer.data(), got) != got) {
+                std::cerr << "Failed to extract: " << e.name << "\n";
+                ::close(fd);
+                return false;
+            }
+            done += static_cast<uint64_t>(got);
+        }
+        ::close(fd);
+        extracted++;
+    }
+
+    if (!entry.empty() && extracted == 0 && !rejected) {
+        std::cerr << "No entry named " << entry << "\n";
+        return false;
+    }
+    return !rejected;
+}
+} // namespace pack
@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Page cache module namespace: hints for the kernel when the access order is
+ * known in advance, short of bypassing the cache with O_DIRECT.
+ * - Readahead asks for the next bytes of a known list of file ranges
+ *   (WILLNEED) while the current one is consumed, and drops what was already
+ *   consumed (DONTNEED).
+ * - Write_Behind starts writeback of written ranges right away and, once a
+ *   window of them is outstanding, waits for the oldest and drops its pages.
+ * Disks keep streaming while the cache footprint of a job stays around two
+ * windows instead of the whole file.
+ */
+namespace cache {
+
+constexpr uint64_t DEFAULT_WINDOW = 32 * 1024 * 1024;
+constexpr size_t MAX_AHEAD_FILES = 64;
+
+/*
+ * A byte range of a file that will be read, in consumption order.
+ */
+struct Range {
+    std::string path;
+    uint64_t offset;
+    uint64_t len;
+};
+
+class Readahead {
+  public:
+    /*
+     * - @ranges : everything the job will read, in order
+     * - @window : bytes to keep requested ahead of the reader
+     */
+    explicit Readahead(std::vector<Range> ranges,
+                       uint64_t window = DEFAULT_WINDOW);
+    ~Readahead();
+
+    Readahead(const Readahead &) = delete;
+    Readahead &operator=(const Readahead &) = delete;
+
+    /*
+     * Descriptor of range i. Files already opened to prefetch them are
+     * handed over instead of being opened twice. Owned by the scheduler.
+     */
+    int Open(size_t i);
+
+    /*
+     * The reader got `done` bytes into range i: pages behind it are dropped
+     * and the window ahead of it is requested.
+     */
+    void Progress(size_t i, uint64_t done);
+
+    /*
+     * Range i is fully consumed: its pages are dropped and its file closed.
+     */
+    void Done(size_t i);
+
+  private:
+    std::vector<Range> ranges_;
+    std::vector<uint64_t> starts_;  // position of each range in read order
+    std::vector<uint64_t> dropped_; // bytes of each range already dropped
+    uint64_t window_;
+    std::map<size_t, int> open_; // range -> descriptor
+    size_t ahead_index_ = 0;     // range holding the request frontier
+    uint64_t requested_ = 0;     // frontier, in read order
+};
+
+class Write_Behind {
+  public:
+    explicit Write_Behind(uint64_t window = DEFAULT_WINDOW) : window_(window) {}
+    ~Write_Behind() { Drain(); }
+
+    Write_Behind(const Write_Behind &) = delete;
+    Write_Behind &operator=(const Write_Behind &) = delete;
+
+    /*
+     * A range of a file that stays open was written.
+     */
+    void Written(int fd, uint64_t offset, uint64_t len);
+
+    /*
+     * A file of `size` bytes is complete. The scheduler takes the descriptor
+     * and closes it once its pages are written back and dropped.
+     */
+    void Close(int fd, uint64_t size);
+
+    /*
+     * Waits for everything outstanding and drops it.
+     */
+    void Drain();
+
+  private:
+    struct Pending {
+        int fd;
+        uint64_t offset;
+        uint64_t len; // 0: the whole file
+        uint64_t bytes;
+        bool close;
+    };
+    void Retire();
+
+    uint64_t window_;
+    uint64_t bytes_ = 0;
+    std::deque<Pending> pending_;
+};
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+inline void Advise(int fd, uint64_t offset, uint64_t len, int advice) {
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(len),
+                  advice);
+#endif
+}
+
+inline Readahead::Readahead(std::vector<Range> ranges, uint64_t window)
+    : ranges_(std::move(ranges)), dropped_(ranges_.size(), 0),
+      window_(window) {
+    uint64_t pos = 0;
+    for (const auto &r : ranges_) {
+        starts_.push_back(pos);
+        pos += r.len;
+    }
+}
+
+inline Readahead::~Readahead() {
+    for (auto &entry : open_)
+        ::close(entry.second);
+}
+
+inline int Readahead::Open(size_t i) {
+    auto it = open_.find(i);
+    if (it != open_.end())
+        return it->second;
+    int fd = ::open(ranges_[i].path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+        open_[i] = fd;
+    return fd;
+}
+
+inline void Readahead::Progress(size_t i, uint64_t done) {
+    if (i >= ranges_.size())
+        return;
+    int fd = Open(i);
+    if (fd < 0)
+        return;
+
+    // Drop what the reader left behind
+    if (done > dropped_[i]) {
+        Advise(fd, ranges_[i].offset + dropped_[i], done - dropped_[i],
+               POSIX_FADV_DONTNEED);
+        dropped_[i] = done;
+    }
+
+    // Request up to a window past the reader, across the upcoming ranges
+    uint64_t target = starts_[i] + done + window_;
+    if (requested_ < starts_[i] + done) {
+        requested_ = starts_[i] + done;
+        ahead_index_ = i;
+    }
+    while (requested_ < target && ahead_index_ < ranges_.size() &&
+           open_.size() < MAX_AHEAD_FILES) {
+        const Range &r = ranges_[ahead_index_];
+        uint64_t end = std::min(starts_[ahead_index_] + r.len, target);
+        int ahead_fd = Open(ahead_index_);
+        if (ahead_fd < 0)
+            break;
+        uint64_t from = requested_ - starts_[ahead_index_];
+        if (end > requested_)
+            Advise(ahead_fd, r.offset + from, end - requested_,
+                   POSIX_FADV_WILLNEED);
+        requested_ = end;
+        if (end == starts_[ahead_index_] + r.len)
+            ahead_index_++;
+    }
+}
+
+inline void Readahead::Done(size_t i) {
+    auto it = open_.find(i);
+    if (it == open_.end())
+        return;
+    if (ranges_[i].len > dropped_[i])
+        Advise(it->second, ranges_[i].offset + dropped_[i],
+               ranges_[i].len - dropped_[i], POSIX_FADV_DONTNEED);
+    dropped_[i] = ranges_[i].len;
+    ::close(it->second);
+    open_.erase(it);
+}
+
+inline void Write_Behind::Written(int fd, uint64_t offset, uint64_t len) {
+    if (len == 0)
+        return;
+#ifdef SYNC_FILE_RANGE_WRITE
+    // Start writeback now, without waiting for it
+    sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
+#endif
+    pending_.push_back({fd, offset, len, len, false});
+    bytes_ += len;
+    while (bytes_ > window_ && !pending_.empty())
+        Retire();
+}
+
+inline void Write_Behind::Close(int fd, uint64_t size) {
+#ifdef SYNC_FILE_RANGE_WRITE
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+    pending_.push_back({fd, 0, 0, size, true});
+    bytes_ += size;
+    while (bytes_ > window_ && !pending_.empty())
+        Retire();
+}
+
+inline void Write_Behind::Retire() {
+    Pending p = pending_.front();
+    pending_.pop_front();
+    bytes_ -= p.bytes;
+#ifdef SYNC_FILE_RANGE_WRITE
+    // Dirty pages cannot be dropped: wait until they reached the disk
+    sync_file_range(p.fd, p.offset, p.len,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+    fdatasync(p.fd);
+#endif
+    Advise(p.fd, p.offset, p.len, POSIX_FADV_DONTNEED);
+    if (p.close)
+        ::close(p.fd);
+}
+
+inline void Write_Behind::Drain() {
+    while (!pending_.empty())
+        Retire();
+}
+} // namespace cache
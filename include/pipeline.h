@@ -0,0 +1,252 @@
+#pragma once
+#include "buffer_pool.h"
+#include "progress.h"
+#include "throttle.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Pipeline module namespace: runs split and combine as overlapping stages.
+ *   read -> transform... -> write
+ * Every stage runs on its own thread and hands chunks to the next one over a
+ * bounded queue. Chunk buffers come from a fixed pool, so at most `in_flight`
+ * chunks exist at once: a slow writer makes the reader wait (backpressure)
+ * instead of buffering the whole file, while reads, transforms (hashing,
+ * compression, ...) and writes of different chunks happen at the same time.
+ * Every read and write is charged to the I/O throttle of the process, and
+ * every chunk written is counted by its progress meter.
+ */
+namespace pipeline {
+
+/*
+ * Chunk: a piece of one packet's payload travelling through the stages.
+ * Big packets are cut into several chunks so memory stays bounded.
+ */
+struct Chunk {
+    uint32_t part = 0;   // packet number
+    uint64_t offset = 0; // offset of the chunk inside the packet payload
+    bool first = false;  // first chunk of its packet
+    bool last = false;   // last chunk of its packet
+    size_t skip = 0;     // payload starts at data + skip (aligned reads)
+    size_t len = 0;      // valid payload bytes
+    uint8_t *data = nullptr; // pooled buffer, chunk size + DIRECT_SLACK
+
+    uint8_t *Payload() const { return data + skip; }
+};
+
+/*
+ * Fills the next chunk (data holds at least the chunk size).
+ * - @return : 1 when a chunk was produced, 0 at the end, -1 on error
+ */
+using Source = std::function<int(Chunk &)>;
+
+/*
+ * Transform or write stage. Called in chunk order.
+ * - @return : false to abort the pipeline
+ */
+using Stage = std::function<bool(Chunk &)>;
+
+/*
+ * Bounded_Queue: blocking FIFO with a fixed capacity.
+ */
+template <typename T> class Bounded_Queue {
+  public:
+    explicit Bounded_Queue(size_t capacity) : capacity_(capacity) {}
+
+    /*
+     * Waits while the queue is full. Returns false once closed.
+     */
+    bool Push(T item);
+
+    /*
+     * Waits while the queue is empty. Returns false once closed and drained.
+     */
+    bool Pop(T &item);
+
+    /*
+     * Wakes every waiter; no more pushes are accepted.
+     */
+    void Close();
+
+  private:
+    size_t capacity_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    std::mutex lock_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+class Engine {
+  public:
+    /*
+     * - @in_flight   : chunks alive at once across all stages
+     * - @chunk_bytes : largest chunk handed to the stages
+     */
+    explicit Engine(size_t in_flight = 16, size_t chunk_bytes = 4 * 1024 * 1024)
+        : in_flight_(in_flight == 0 ? 1 : in_flight),
+          chunk_bytes_(chunk_bytes) {}
+
+    /*
+     * Adds a transform stage between the reader and the writer.
+     */
+    Engine &Transform(Stage stage) {
+        transforms_.push_back(std::move(stage));
+        return *this;
+    }
+
+    size_t Chunk_Bytes() const { return chunk_bytes_; }
+
+    /*
+     * Announces the payload of the next packet of the job, so a small job
+     * leases only the buffers it can fill instead of in_flight of them.
+     */
+    void Expect_Packet(uint64_t bytes) {
+        chunks_ += bytes == 0 ? 1 : (bytes + chunk_bytes_ - 1) / chunk_bytes_;
+    }
+
+    /*
+     * Runs the pipeline to the end. The writer runs on the calling thread.
+     * - @return : false if any stage failed
+     */
+    bool Run(const Source &read, const Stage &write);
+
+  private:
+    size_t in_flight_;
+    size_t chunk_bytes_;
+    uint64_t chunks_ = 0; // chunks the job has in all, 0 when not announced
+    std::vector<Stage> transforms_;
+};
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+template <typename T> bool Bounded_Queue<T>::Push(T item) {
+    std::unique_lock<std::mutex> guard(lock_);
+    not_full_.wait(guard,
+                   [this] { return closed_ || items_.size() < capacity_; });
+    if (closed_)
+        return false;
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+}
+
+template <typename T> bool Bounded_Queue<T>::Pop(T &item) {
+    std::unique_lock<std::mutex> guard(lock_);
+    not_empty_.wait(guard, [this] { return closed_ || !items_.empty(); });
+    if (items_.empty())
+        return false;
+    item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+}
+
+template <typename T> void Bounded_Queue<T>::Close() {
+    std::lock_guard<std::mutex> guard(lock_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+}
+
+inline bool Engine::Run(const Source &read, const Stage &write) {
+    using Ptr = std::unique_ptr<Chunk>;
+    std::atomic<bool> failed{false};
+
+    // Buffer pool: the only chunks that ever exist
+    buffers::Buffer_Pool &pool =
+        buffers::Shared_Pool(chunk_bytes_ + buffers::DIRECT_SLACK);
+    std::vector<uint8_t *> leased;
+    size_t buffers = in_flight_;
+    if (chunks_ > 0 && chunks_ < buffers)
+        buffers = static_cast<size_t>(chunks_);
+    Bounded_Queue<Ptr> free_chunks(in_flight_);
+    for (size_t i = 0; i < buffers; i++) {
+        Ptr chunk = std::make_unique<Chunk>();
+        chunk->data = pool.Acquire();
+        if (!chunk->data)
+            break;
+        leased.push_back(chunk->data);
+        free_chunks.Push(std::move(chunk));
+    }
+    if (leased.empty())
+        return false;
+
+    // queues[i] feeds transform i; the last one feeds the writer
+    std::vector<std::unique_ptr<Bounded_Queue<Ptr>>> queues;
+    for (size_t i = 0; i <= transforms_.size(); i++)
+        queues.push_back(std::make_unique<Bounded_Queue<Ptr>>(in_flight_));
+
+    auto abort = [&] {
+        failed = true;
+        free_chunks.Close();
+        for (auto &q : queues)
+            q->Close();
+    };
+
+    std::vector<std::thread> threads;
+    threads.emplace_back([&] {
+        Ptr chunk;
+        while (free_chunks.Pop(chunk)) {
+            chunk->len = chunk->skip = 0;
+            chunk->first = chunk->last = false;
+            throttle::Charge(0);
+            int got = read(*chunk);
+            if (got < 0)
+                abort();
+            if (got <= 0 || !queues[0]->Push(std::move(chunk)))
+                break;
+        }
+        queues[0]->Close();
+    });
+
+    for (size_t i = 0; i < transforms_.size(); i++) {
+        threads.emplace_back([&, i] {
+            Ptr chunk;
+            while (queues[i]->Pop(chunk)) {
+                if (!transforms_[i](*chunk)) {
+                    abort();
+                    break;
+                }
+                if (!queues[i + 1]->Push(std::move(chunk)))
+                    break;
+            }
+            queues[i + 1]->Close();
+        });
+    }
+
+    Ptr chunk;
+    while (queues.back()->Pop(chunk)) {
+        throttle::Charge(chunk->len);
+        bool ok;
+        {
+            throttle::Write_Timer timer;
+            ok = write(*chunk);
+        }
+        if (!ok) {
+            abort();
+            break;
+        }
+        progress::Add(chunk->len, chunk->last ? 1 : 0);
+        free_chunks.Push(std::move(chunk)); // hand the buffer back
+    }
+    // Unblock a reader still waiting for buffers once writing stopped
+    free_chunks.Close();
+    for (auto &q : queues)
+        q->Close();
+    for (auto &t : threads)
+        t.join();
+    for (uint8_t *buffer : leased)
+        pool.Release(buffer);
+    return !failed.load();
+}
+} // namespace pipeline
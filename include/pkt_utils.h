@@ -1,12 +1,18 @@
 #pragma once
+#include "layout.h"
+#include "throttle.h"
 #include <array>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <iosfwd>
 #include <iostream>
+#include <mutex>
+#include <random>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -17,6 +23,10 @@
 // 3) Append_Bytes
 // 4) Genrate_File_ID
 // 5) Create_Empty_File
+// 6) Packet_File_Name
+// 7) Json_String
+// 8) Packet_Path
+// 9) Safe_File_Name
 //==============================================================================
 namespace utils {
 
@@ -91,6 +101,7 @@ inline std::vector<uint8_t> Fetch_Bytes(const std::string &filename,
         return {};
     }
 
+    throttle::Charge(num_bytes);
     file.read(reinterpret_cast<char *>(bytes.data()), num_bytes);
     if (static_cast<size_t>(file.gcount()) != num_bytes) {
         std::cerr << "Error reading the expected number of bytes. Got: "
@@ -116,42 +127,57 @@ inline void Append_Bytes(const std::string &filename,
     }
 
     // Write the bytes directly to the file
+    throttle::Charge(bytes.size());
     file.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
 }
 
+inline std::string Packet_Path(const std::array<uint8_t, 5> &f_id,
+                               uint32_t number);
+
 /*
  * Generates a random 5-byte alphanumeric file ID.
  * - @return: An array of 5 uint8_t representing the unique file ID.
  * This ID can be used as a unique identifier for a file packets.
  */
 inline std::array<uint8_t, 5> Genrate_File_ID() {
-    static bool seeded = false;
-    if (!seeded) {
-        srand(static_cast<unsigned>(time(0)));
-        seeded = true;
-    }
+    // Seeded from the OS rather than time(0): two splits started in the same
+    // second must not get the same ID. Locked since batch splits run on
+    // several threads.
+    static std::mutex lock;
+    static std::mt19937 generator(std::random_device{}() ^
+                                  static_cast<unsigned>(time(0)));
+    static std::set<std::array<uint8_t, 5>> issued;
 
     const char charset[] =
         "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
 
+    // 40 random bits collide within a big split-all: an ID this process
+    // already handed out, or one with a set on disk (part 0 is written
+    // last, so part 1 is checked as well), is drawn again
     std::array<uint8_t, 5> file_id;
-    for (int i = 0; i < 5; ++i) {
-        file_id[i] =
-            static_cast<uint8_t>(charset[rand() % (sizeof(charset) - 1)]);
-    }
+    std::lock_guard<std::mutex> guard(lock);
+    std::error_code ec;
+    do {
+        for (int i = 0; i < 5; ++i) {
+            file_id[i] = static_cast<uint8_t>(
+                charset[generator() % (sizeof(charset) - 1)]);
+        }
+    } while (issued.count(file_id) ||
+             std::filesystem::exists(Packet_Path(file_id, 0), ec) ||
+             std::filesystem::exists(Packet_Path(file_id, 1), ec));
+    issued.insert(file_id);
 
     return file_id;
 }
 
 /*
- * Creates an empty file with a filename based on the file ID and part number.
- * - @param f_id: The 5-byte file ID (as array of uint8_t).
- * - @param number: The number to append to the filename (e.g., part number).
- * - @return: The generated filename, or an empty string on failure.
- * The filename is in the format <HEX(file_id)>_<number>.
+ * Builds the on-disk name of a packet from its file ID and part number.
+ * - @param f_id   : The 5-byte file ID (as array of uint8_t).
+ * - @param number : The part number of the packet.
+ * - @return       : The filename in the format <HEX(file_id)>_<number>.
  */
-inline std::string CREATE_EMPTY_HEADER_FILE(const std::array<uint8_t, 5> &f_id,
-                                            const int &number) {
+inline std::string Packet_File_Name(const std::array<uint8_t, 5> &f_id,
+                                    uint32_t number) {
     std::string id_str;
     for (uint8_t byte : f_id) {
         // Convert each byte to 2-digit hex string
@@ -159,8 +185,47 @@ inline std::string CREATE_EMPTY_HEADER_FILE(const std::array<uint8_t, 5> &f_id,
         snprintf(buf, sizeof(buf), "%02X", byte);
         id_str += buf;
     }
+    return id_str + "_" + std::to_string(number);
+}
+
+/*
+ * Same as above, for a file ID read back from a header as a raw string.
+ */
+inline std::string Packet_File_Name(const std::string &f_id, uint32_t number) {
+    std::array<uint8_t, 5> id = {0};
+    for (size_t i = 0; i < id.size() && i < f_id.size(); ++i)
+        id[i] = static_cast<uint8_t>(f_id[i]);
+    return Packet_File_Name(id, number);
+}
+
+/*
+ * Path of a packet in the packet directory of this process, shards included.
+ * Every packet file is opened or created through this lookup.
+ * - @param f_id   : The 5-byte file ID (as array of uint8_t).
+ * - @param number : The part number of the packet.
+ */
+inline std::string Packet_Path(const std::array<uint8_t, 5> &f_id,
+                               uint32_t number) {
+    return layout::Path_Of(Packet_File_Name(f_id, number));
+}
+
+inline std::string Packet_Path(const std::string &f_id, uint32_t number) {
+    return layout::Path_Of(Packet_File_Name(f_id, number));
+}
 
-    std::string filename = id_str + "_" + std::to_string(number);
+/*
+ * Creates an empty file with a filename based on the file ID and part number.
+ * - @param f_id: The 5-byte file ID (as array of uint8_t).
+ * - @param number: The number to append to the filename (e.g., part number).
+ * - @return: The generated filename, or an empty string on failure.
+ * The filename is in the format <HEX(file_id)>_<number>.
+ */
+inline std::string CREATE_EMPTY_HEADER_FILE(const std::array<uint8_t, 5> &f_id,
+                                            const int &number) {
+    std::string filename = Packet_Path(f_id, number);
+
+    if (!layout::Prepare(filename))
+        return "";
 
     std::ofstream file(filename, std::ios::binary);
     if (!file) {
@@ -183,6 +248,40 @@ inline std::string CREATE_EMPTY_FILE(const std::string &filename) {
     }
     return filename;
 }
+
+/*
+ * Name a file received from elsewhere (a peer, a blob) may be written as:
+ * its last path component, so it lands in the current directory.
+ * - @param name : name as received
+ * - @return     : the file name, or an empty string when there is none
+ */
+inline std::string Safe_File_Name(const std::string &name) {
+    std::string base = std::filesystem::path(name).filename().string();
+    return base == "." || base == ".." ? "" : base;
+}
+
+/*
+ * Quotes a string as a JSON string literal.
+ * - @param value : raw string
+ * - @return      : the quoted and escaped literal
+ */
+inline std::string Json_String(const std::string &value) {
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
 //============================================================================
 // grave yard of functions
 //============================================================================
@@ -0,0 +1,324 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+/*
+ * Progress module namespace: how far split and combine jobs have got.
+ * Workers add what they finished to a process-wide meter: relaxed atomic
+ * adds on counters sharded per thread, each shard on its own cache line, so
+ * dozens of workers never contend on one line and never take a lock. Jobs
+ * announce their totals up front (several jobs add up, as in split-all).
+ * A reporter thread samples the meter a few times a second and hands a
+ * snapshot (bytes, packets, throughput, ETA) to a callback, a terminal bar
+ * or a line protocol on stderr that a front end can parse:
+ *   progress {"bytes":..,"total":..,"packets":..,"packets_total":..,
+ *             "rate":..,"eta":..,"final":false}
+ * rate is in bytes per second, eta in seconds (-1 while unknown).
+ */
+namespace progress {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t SHARDS = 16;
+constexpr double BAR_INTERVAL = 0.2;   // seconds between bar redraws
+constexpr double LINE_INTERVAL = 1.0;  // seconds between protocol lines
+constexpr double RATE_SMOOTHING = 0.3; // weight of the newest rate sample
+
+struct Snapshot {
+    uint64_t bytes = 0;         // payload bytes done
+    uint64_t bytes_total = 0;   // 0 while unknown (e.g. stdin)
+    uint64_t packets = 0;       // packets done
+    uint64_t packets_total = 0; // 0 while unknown
+    double elapsed = 0;         // seconds since the meter was reset
+    double rate = 0;            // bytes per second, smoothed
+    double eta = -1;            // seconds left, -1 while unknown
+};
+
+using Callback = std::function<void(const Snapshot &)>;
+
+class Meter {
+  public:
+    /*
+     * Adds the totals of a job about to start.
+     */
+    void Expect(uint64_t bytes, uint64_t packets) {
+        bytes_total_.fetch_add(bytes, std::memory_order_relaxed);
+        packets_total_.fetch_add(packets, std::memory_order_relaxed);
+    }
+
+    /*
+     * Counts finished work. Lock-free; called from the workers' hot path.
+     */
+    void Add(uint64_t bytes, uint64_t packets = 0) {
+        Shard &shard = shards_[Slot()];
+        shard.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (packets)
+            shard.packets.fetch_add(packets, std::memory_order_relaxed);
+    }
+
+    /*
+     * Counters as of now; rate and eta are averages since the reset.
+     */
+    Snapshot Read() const;
+
+    void Reset();
+
+  private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> packets{0};
+    };
+
+    static size_t Slot() {
+        static std::atomic<size_t> next{0};
+        thread_local size_t slot =
+            next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+        return slot;
+    }
+
+    Shard shards_[SHARDS];
+    std::atomic<uint64_t> bytes_total_{0};
+    std::atomic<uint64_t> packets_total_{0};
+    Clock::time_point start_ = Clock::now();
+};
+
+/*
+ * Meter of this process.
+ */
+inline Meter &Active();
+
+inline void Expect(uint64_t bytes, uint64_t packets) {
+    Active().Expect(bytes, packets);
+}
+
+inline void Add(uint64_t bytes, uint64_t packets = 0) {
+    Active().Add(bytes, packets);
+}
+
+enum class Style { None, Bar, Lines };
+
+/*
+ * Style named on the command line: "bar", "lines" or "none"; empty picks
+ * the bar when stderr is a terminal.
+ * - @return : false for an unknown name
+ */
+inline bool Style_Of(const std::string &name, Style &style);
+
+/*
+ * Reporter: samples the meter on its own thread until destroyed, then
+ * reports once more, as the final snapshot.
+ */
+class Reporter {
+  public:
+    /*
+     * - @style    : terminal bar, protocol lines or nothing
+     * - @callback : also called with every snapshot, may be empty
+     */
+    explicit Reporter(Style style, Callback callback = nullptr);
+    ~Reporter();
+
+    Reporter(const Reporter &) = delete;
+    Reporter &operator=(const Reporter &) = delete;
+
+  private:
+    void Report(bool final);
+
+    Style style_;
+    Callback callback_;
+    double rate_ = 0;
+    uint64_t last_bytes_ = 0;
+    Clock::time_point last_ = Clock::now();
+
+    bool stop_ = false;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::thread thread_;
+};
+
+/*
+ * Formats a snapshot as one line of the protocol, newline included.
+ */
+inline std::string Protocol_Line(const Snapshot &now, bool final);
+
+/*
+ * Formats a snapshot as a terminal bar, without a newline.
+ */
+inline std::string Bar(const Snapshot &now);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+inline Snapshot Meter::Read() const {
+    Snapshot now;
+    for (const Shard &shard : shards_) {
+        now.bytes += shard.bytes.load(std::memory_order_relaxed);
+        now.packets += shard.packets.load(std::memory_order_relaxed);
+    }
+    now.bytes_total = bytes_total_.load(std::memory_order_relaxed);
+    now.packets_total = packets_total_.load(std::memory_order_relaxed);
+    now.elapsed = std::chrono::duration<double>(Clock::now() - start_).count();
+    if (now.elapsed > 0)
+        now.rate = now.bytes / now.elapsed;
+    if (now.rate > 0 && now.bytes_total >= now.bytes)
+        now.eta = (now.bytes_total - now.bytes) / now.rate;
+    return now;
+}
+
+inline void Meter::Reset() {
+    for (Shard &shard : shards_) {
+        shard.bytes = 0;
+        shard.packets = 0;
+    }
+    bytes_total_ = 0;
+    packets_total_ = 0;
+    start_ = Clock::now();
+}
+
+inline Meter &Active() {
+    static Meter meter;
+    return meter;
+}
+
+inline bool Style_Of(const std::string &name, Style &style) {
+    if (name.empty())
+        style = isatty(STDERR_FILENO) ? Style::Bar : Style::None;
+    else if (name == "bar")
+        style = Style::Bar;
+    else if (name == "lines")
+        style = Style::Lines;
+    else if (name == "none")
+        style = Style::None;
+    else
+        return false;
+    return true;
+}
+
+inline Reporter::Reporter(Style style, Callback callback)
+    : style_(style), callback_(std::move(callback)) {
+    if (style_ == Style::None && !callback_)
+        return;
+    double interval = style_ == Style::Lines ? LINE_INTERVAL : BAR_INTERVAL;
+    thread_ = std::thread([this, interval] {
+        std::unique_lock<std::mutex> guard(lock_);
+        while (!wake_.wait_for(guard, std::chrono::duration<double>(interval),
+                               [this] { return stop_; }))
+            Report(false);
+    });
+}
+
+inline Reporter::~Reporter() {
+    if (!thread_.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+    Report(true);
+}
+
+inline void Reporter::Report(bool final) {
+    Snapshot now = Active().Read();
+
+    // Throughput of the last interval, smoothed, so the ETA follows the
+    // current speed rather than the average since the start
+    Clock::time_point at = Clock::now();
+    double span = std::chrono::duration<double>(at - last_).count();
+    if (span > 0 && now.bytes >= last_bytes_) {
+        double sample = (now.bytes - last_bytes_) / span;
+        rate_ = rate_ == 0 ? sample
+                           : RATE_SMOOTHING * sample +
+                                 (1 - RATE_SMOOTHING) * rate_;
+    }
+    last_ = at;
+    last_bytes_ = now.bytes;
+    if (!final) {
+        now.rate = rate_;
+        now.eta = rate_ > 0 && now.bytes_total >= now.bytes
+                      ? (now.bytes_total - now.bytes) / rate_
+                      : -1;
+    }
+
+    if (callback_)
+        callback_(now);
+    if (style_ == Style::Lines) {
+        std::cerr << Protocol_Line(now, final) << std::flush;
+    } else if (style_ == Style::Bar) {
+        // Drawn from column 0 and left with the cursor there, so other
+        // output overwrites it; the final one is cleared
+        std::cerr << "\r\033[K";
+        if (!final)
+            std::cerr << Bar(now) << "\r";
+        std::cerr << std::flush;
+    }
+}
+
+inline std::string Protocol_Line(const Snapshot &now, bool final) {
+    std::ostringstream line;
+    line << "progress {\"bytes\":" << now.bytes
+         << ",\"total\":" << now.bytes_total
+         << ",\"packets\":" << now.packets
+         << ",\"packets_total\":" << now.packets_total
+         << ",\"rate\":" << static_cast<uint64_t>(now.rate)
+         << ",\"eta\":" << (now.eta < 0 ? -1 : static_cast<int64_t>(now.eta))
+         << ",\"final\":" << (final ? "true" : "false") << "}\n";
+    return line.str();
+}
+
+inline std::string Bar(const Snapshot &now) {
+    auto size = [](double bytes) {
+        const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+        size_t unit = 0;
+        while (bytes >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+            bytes /= 1024;
+            unit++;
+        }
+        char text[32];
+        snprintf(text, sizeof(text), "%.1f %s", bytes, units[unit]);
+        return std::string(text);
+    };
+
+    constexpr int WIDTH = 30;
+    std::string line;
+    if (now.bytes_total > 0) {
+        double part = std::min(1.0, static_cast<double>(now.bytes) /
+                                        static_cast<double>(now.bytes_total));
+        int filled = static_cast<int>(part * WIDTH);
+        char percent[16];
+        snprintf(percent, sizeof(percent), " %5.1f%%  ", part * 100);
+        line = "[" + std::string(filled, '#') +
+               std::string(WIDTH - filled, '.') + "]" + percent +
+               size(now.bytes) + " / " + size(now.bytes_total);
+    } else {
+        line = size(now.bytes);
+    }
+    line += "  " + size(now.rate) + "/s";
+    if (now.eta >= 0) {
+        uint64_t eta = static_cast<uint64_t>(now.eta);
+        char text[32];
+        snprintf(text, sizeof(text), "  ETA %llu:%02llu:%02llu",
+                 static_cast<unsigned long long>(eta / 3600),
+                 static_cast<unsigned long long>(eta / 60 % 60),
+                 static_cast<unsigned long long>(eta % 60));
+        line += text;
+    }
+    if (now.packets_total > 0)
+        line += "  packets " + std::to_string(now.packets) + "/" +
+                std::to_string(now.packets_total);
+    return line;
+}
+} // namespace progress
@@ -0,0 +1,314 @@
+#pragma once
+#include "full_header.h"
+#include "manifest.h"
+#include "mini_header.h"
+#include "pkt_utils.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <list>
+#include <string>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/*
+ * Reader module namespace: serves byte ranges of the original file straight
+ * from its packets, without combining them first.
+ */
+namespace reader {
+
+/*
+ * Packet_Reader: random access view over one packet set.
+ * The part holding any byte is computed from the full header, so the time to
+ * the first byte does not depend on the file size. A few packet descriptors
+ * stay open (least recently used is closed first) and sequential reads ask
+ * the kernel to prefetch the packets that come next. Hole packets read as
+ * zeros.
+ */
+class Packet_Reader {
+  public:
+    explicit Packet_Reader(size_t max_open = 8) : max_open_(max_open) {}
+    ~Packet_Reader() {
+        Close();
+        if (zero_fd_ >= 0)
+            ::close(zero_fd_);
+    }
+
+    Packet_Reader(const Packet_Reader &) = delete;
+    Packet_Reader &operator=(const Packet_Reader &) = delete;
+
+    /*
+     * Opens the packet set with the given file_id (as read from a header).
+     * - @return : false if the 0th split file is missing or invalid
+     */
+    bool Open(const std::string &file_id);
+
+    /*
+     * Reads up to len bytes of the original file starting at offset.
+     * - @return : number of bytes read (0 at end of file), -1 on error
+     */
+    ssize_t Read(uint64_t offset, uint8_t *buf, size_t len);
+
+    /*
+     * Finds where a byte of the original file sits on disk, so callers can
+     * sendfile it without copying through user space. Holes are located
+     * in a zero filled memory file.
+     * - @fd     : packet descriptor, owned by the reader
+     * - @at     : offset of that byte inside the packet file
+     * - @return : bytes stored contiguously from there, 0 at end of file,
+     *             -1 on error
+     */
+    int64_t Locate(uint64_t offset, int &fd, off_t &at);
+
+    uint64_t Size() const { return header::File_Size_Of(header_); }
+    const header::Full_Header &Header() const { return header_; }
+    void Close();
+
+  private:
+    int Packet_FD(uint32_t part);
+    void Read_Ahead(uint64_t from);
+    bool Hole(uint32_t part) const {
+        return part <= holes_.size() && holes_[part - 1];
+    }
+    int Zero_FD();
+
+    std::string file_id_;
+    header::Full_Header header_{};
+    std::vector<bool> holes_; // by part - 1, empty unless the set is sparse
+    int zero_fd_ = -1;
+    size_t max_open_;
+    std::list<std::pair<uint32_t, int>> open_; // most recently used first
+
+    uint64_t next_offset_ = 0;   // where a sequential read would continue
+    uint64_t ahead_ = 0;         // current readahead window in bytes
+    uint64_t advised_until_ = 0; // end of the range already prefetched
+};
+
+/*
+ * Writes a byte range of the original file to stdout.
+ * - @file_id : file_id of the packet set
+ * - @offset  : first byte to print
+ * - @length  : number of bytes, -1 for everything up to the end of file
+ */
+inline bool CAT(const std::string &file_id, uint64_t offset, int64_t length);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+constexpr uint64_t MIN_READ_AHEAD = 128 * 1024;
+constexpr uint64_t MAX_READ_AHEAD = 8 * 1024 * 1024;
+constexpr uint64_t ZERO_FILE = 1024 * 1024; // size of the file holes map to
+
+inline bool Packet_Reader::Open(const std::string &file_id) {
+    Close();
+    file_id_ = file_id;
+    next_offset_ = ahead_ = advised_until_ = 0;
+
+    std::string fname = utils::Packet_Path(file_id, 0);
+    if (!header::READ_FULL_HEADER(fname, header_)) {
+        std::cerr << "Could not read full header: " << fname << "\n";
+        return false;
+    }
+
+    // Only sparse sets need the manifest: which parts are holes
+    holes_.clear();
+    manifest::Manifest table;
+    if (header_.flags[0] & header::FLAG_SPARSE) {
+        if (!manifest::READ_MANIFEST(fname, header_, table)) {
+            std::cerr << "Could not read manifest: " << fname << "\n";
+            return false;
+        }
+        for (const auto &packet : table.packets)
+            holes_.push_back(packet.flags & header::PACKET_HOLE);
+    }
+    return true;
+}
+
+inline int Packet_Reader::Zero_FD() {
+#ifdef MFD_CLOEXEC
+    // Never written, so it stays all zeros without using memory
+    if (zero_fd_ < 0) {
+        zero_fd_ = ::memfd_create("pktcore-hole", MFD_CLOEXEC);
+        if (zero_fd_ >= 0 && ::ftruncate(zero_fd_, ZERO_FILE) != 0) {
+            ::close(zero_fd_);
+            zero_fd_ = -1;
+        }
+    }
+#endif
+    return zero_fd_;
+}
+
+inline void Packet_Reader::Close() {
+    for (auto &entry : open_)
+        ::close(entry.second);
+    open_.clear();
+}
+
+inline int Packet_Reader::Packet_FD(uint32_t part) {
+    for (auto it = open_.begin(); it != open_.end(); ++it) {
+        if (it->first == part) {
+            open_.splice(open_.begin(), open_, it);
+            return it->second;
+        }
+    }
+
+    std::string fname = utils::Packet_Path(file_id_, part);
+    int fd = ::open(fname.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Could not open packet: " << fname << "\n";
+        return -1;
+    }
+
+    if (open_.size() >= max_open_) {
+        ::close(open_.back().second);
+        open_.pop_back();
+    }
+    open_.emplace_front(part, fd);
+    return fd;
+}
+
+inline void Packet_Reader::Read_Ahead(uint64_t from) {
+    uint64_t until = from + ahead_;
+    if (until > Size())
+        until = Size();
+    if (advised_until_ > from)
+        from = advised_until_;
+
+    while (from < until) {
+        uint32_t part = header::Packet_For_Offset(header_, from);
+        uint64_t start = header::Packet_Start(header_, part);
+        uint64_t end = header::Packet_Start(header_, part + 1);
+        if (end > until)
+            end = until;
+
+        int fd = Hole(part) ? -1 : Packet_FD(part);
+        if (fd < 0) {
+            from = end;
+            continue;
+        }
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(fd,
+                      header::Packet_Header_Size(header_, part) + (from - start),
+                      end - from, POSIX_FADV_WILLNEED);
+#endif
+        from = end;
+    }
+    advised_until_ = from;
+}
+
+inline ssize_t Packet_Reader::Read(uint64_t offset, uint8_t *buf, size_t len) {
+    if (offset >= Size() || len == 0)
+        return 0;
+    if (len > Size() - offset)
+        len = Size() - offset;
+
+    // Grow the prefetch window while the access pattern stays sequential
+    if (offset == next_offset_ && offset != 0) {
+        ahead_ = ahead_ == 0 ? MIN_READ_AHEAD : ahead_ * 2;
+        if (ahead_ > MAX_READ_AHEAD)
+            ahead_ = MAX_READ_AHEAD;
+    } else {
+        ahead_ = 0;
+        advised_until_ = 0;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint32_t part = header::Packet_For_Offset(header_, pos);
+        uint64_t start = header::Packet_Start(header_, part);
+        uint64_t end = header::Packet_Start(header_, part + 1);
+        size_t chunk = static_cast<size_t>(
+            std::min<uint64_t>(len - done, end - pos));
+        if (Hole(part)) {
+            std::memset(buf + done, 0, chunk);
+            done += chunk;
+            continue;
+        }
+
+        int fd = Packet_FD(part);
+        if (fd < 0)
+            return -1;
+
+        ssize_t got =
+            ::pread(fd, buf + done, chunk,
+                    header::Packet_Header_Size(header_, part) + (pos - start));
+        if (got <= 0) {
+            std::cerr << "Packet " << part << " is shorter than its header "
+                      << "says\n";
+            return -1;
+        }
+        done += static_cast<size_t>(got);
+    }
+
+    next_offset_ = offset + done;
+    if (ahead_ > 0)
+        Read_Ahead(next_offset_);
+    return static_cast<ssize_t>(done);
+}
+
+inline int64_t Packet_Reader::Locate(uint64_t offset, int &fd, off_t &at) {
+    if (offset >= Size())
+        return 0;
+    uint32_t part = header::Packet_For_Offset(header_, offset);
+    uint64_t start = header::Packet_Start(header_, part);
+    if (Hole(part)) {
+        fd = Zero_FD();
+        at = 0;
+        return fd < 0 ? -1
+                      : static_cast<int64_t>(std::min<uint64_t>(
+                            header::Packet_Start(header_, part + 1) - offset,
+                            ZERO_FILE));
+    }
+    fd = Packet_FD(part);
+    if (fd < 0)
+        return -1;
+    at = static_cast<off_t>(header::Packet_Header_Size(header_, part) +
+                            (offset - start));
+    return static_cast<int64_t>(header::Packet_Start(header_, part + 1) - offset);
+}
+
+inline bool CAT(const std::string &file_id, uint64_t offset, int64_t length) {
+    Packet_Reader pkt_reader;
+    if (!pkt_reader.Open(file_id))
+        return false;
+
+    uint64_t end = pkt_reader.Size();
+    if (offset > end) {
+        std::cerr << "Offset " << offset << " is past the end of the file ("
+                  << end << " bytes)\n";
+        return false;
+    }
+    // Clamped before adding, so a huge length cannot wrap around
+    if (length >= 0)
+        end = offset + std::min(static_cast<uint64_t>(length), end - offset);
+
+    std::vector<uint8_t> buffer(1024 * 1024);
+    while (offset < end) {
+        size_t want =
+            static_cast<size_t>(std::min<uint64_t>(buffer.size(), end - offset));
+        ssize_t got = pkt_reader.Read(offset, buffer.data(), want);
+        if (got <= 0)
+            return got == 0;
+
+        size_t written = 0;
+        while (written < static_cast<size_t>(got)) {
+            ssize_t w = ::write(STDOUT_FILENO, buffer.data() + written,
+                                static_cast<size_t>(got) - written);
+            if (w < 0) {
+                std::cerr << "Failed to write to stdout\n";
+                return false;
+            }
+            written += static_cast<size_t>(w);
+        }
+        offset += static_cast<uint64_t>(got);
+    }
+    return true;
+}
+} // namespace reader
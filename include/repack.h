@@ -0,0 +1,287 @@
+#pragma once
+#include "batch.h"
+#include "buffer_pool.h"
+#include "combiner.h"
+#include "full_header.h"
+#include "manifest.h"
+#include "mini_header.h"
+#include "pkt_utils.h"
+#include "progress.h"
+#include "scheduler.h"
+#include "splitter.h"
+#include "throttle.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Repack module namespace: cuts an existing packet set into packets of a
+ * new size without combining it first. The old payloads are the original
+ * file in pieces; every new packet is a byte range of that file, so it is
+ * filled straight from the old packets covering the range. Ranges of new
+ * packets are independent tasks on the work-stealing pool, and each task
+ * goes through one pooled buffer: memory stays bounded and the original
+ * file is never written anywhere. New packets lying wholly in hole packets
+ * are hole packets again.
+ */
+namespace repack {
+
+/*
+ * Repacks one packet set.
+ * - @file_id     : file_id of the set
+ * - @packet_size : payload bytes per new packet
+ * - @compact     : compact headers for the new packets
+ * - @keep        : keep the old set (it shares the name with the new one)
+ * - @threads     : workers, 0 for one per hardware thread
+ * - @return      : false if the old set is incomplete or a packet or part 0
+ *                  of the new set could not be written; the old set is left
+ *                  alone then
+ */
+inline bool REPACK(const std::string &file_id, uint32_t packet_size,
+                   bool compact = false, bool keep = false,
+                   size_t threads = 0);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+
+// Payload copies go through pooled buffers of this size
+constexpr size_t COPY_BUFFER = 1024 * 1024;
+
+/*
+ * Copies [from, to) of the original file out of the old packets, to the end
+ * of out_fd. Old packets are found by their output offset; the descriptor
+ * of the last one used stays open for the next range.
+ */
+class Range_Reader {
+  public:
+    explicit Range_Reader(const combiner::Combine_Plan &plan)
+        : plan_(plan), pool_(buffers::Shared_Pool(COPY_BUFFER)),
+          buf_(pool_.Acquire()) {}
+    ~Range_Reader() {
+        if (fd_ >= 0)
+            ::close(fd_);
+        pool_.Release(buf_);
+    }
+
+    Range_Reader(const Range_Reader &) = delete;
+    Range_Reader &operator=(const Range_Reader &) = delete;
+
+    bool Copy(uint64_t from, uint64_t to, int out_fd, uint32_t &crc);
+
+    /*
+     * True when [from, to) lies wholly in hole packets.
+     */
+    bool Hole(uint64_t from, uint64_t to) const;
+
+  private:
+    size_t Packet_At(uint64_t from) const {
+        // Last old packet starting at or before `from`
+        return std::upper_bound(plan_.offsets.begin(), plan_.offsets.end(),
+                                from) -
+               plan_.offsets.begin() - 1;
+    }
+
+    const combiner::Combine_Plan &plan_;
+    buffers::Buffer_Pool &pool_;
+    uint8_t *buf_;
+    size_t index_ = 0; // old packet open in fd_
+    int fd_ = -1;
+};
+
+inline bool Range_Reader::Copy(uint64_t from, uint64_t to, int out_fd,
+                               uint32_t &crc) {
+    const auto &offsets = plan_.offsets;
+    while (buf_ && from < to) {
+        size_t i = Packet_At(from);
+        uint64_t end = std::min(to, offsets[i] + plan_.sizes[i]);
+        size_t want = static_cast<size_t>(
+            std::min<uint64_t>(end - from, pool_.Buffer_Bytes()));
+        ssize_t got = static_cast<ssize_t>(want);
+        throttle::Charge(want, plan_.Hole(i) ? 1 : 2);
+        if (plan_.Hole(i)) {
+            std::memset(buf_, 0, want);
+        } else {
+            if (i != index_ || fd_ < 0) {
+                if (fd_ >= 0)
+                    ::close(fd_);
+                index_ = i;
+                fd_ = ::open(plan_.packets[i].c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd_ < 0) {
+                    std::cerr << "Failed to open packet: " << plan_.packets[i]
+                              << "\n";
+                    return false;
+                }
+            }
+            got = ::pread(fd_, buf_, want,
+                          plan_.heads[i] + (from - offsets[i]));
+        }
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0) {
+            std::cerr << "Failed to read packet: " << plan_.packets[i] << "\n";
+            return false;
+        }
+        for (ssize_t done = 0; done < got;) {
+            ssize_t w = ::write(out_fd, buf_ + done, got - done);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            done += w;
+        }
+        crc = manifest::Crc32c(buf_, static_cast<size_t>(got), crc);
+        from += static_cast<uint64_t>(got);
+    }
+    return buf_ != nullptr;
+}
+
+inline bool Range_Reader::Hole(uint64_t from, uint64_t to) const {
+    for (size_t i = Packet_At(from);
+         from < to && i < plan_.packets.size(); i++) {
+        if (plan_.sizes[i] == 0)
+            continue;
+        if (!plan_.Hole(i))
+            return false;
+        from = plan_.offsets[i] + plan_.sizes[i];
+    }
+    return from >= to;
+}
+
+/*
+ * Flushes a file written through another descriptor to the disk.
+ */
+inline bool Sync_Path(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    bool ok = fd >= 0 && ::fdatasync(fd) == 0;
+    if (fd >= 0)
+        ::close(fd);
+    return ok;
+}
+
+inline bool REPACK(const std::string &file_id, uint32_t packet_size,
+                   bool compact, bool keep, size_t threads) {
+    if (packet_size == 0) {
+        std::cerr << "Packet size must be greater than zero\n";
+        return false;
+    }
+
+    // Where every byte of the original file sits in the old packets
+    header::Full_Header old_full;
+    manifest::Manifest old_table;
+    combiner::Combine_Plan plan;
+    if (!combiner::Plan_Set(file_id, old_full, old_table, plan))
+        return false;
+    uint64_t size = header::File_Size_Of(old_full);
+    uint64_t planned = 0;
+    for (uint64_t len : plan.sizes)
+        planned += len;
+    if (plan.packets.size() != header::Packets_Of(old_full) ||
+        planned != size) {
+        std::cerr << "Incomplete packet set: " << old_table.name << "\n";
+        return false;
+    }
+
+    // The new set: same file, same entries, new packet size
+    auto new_id = utils::Genrate_File_ID();
+    uint32_t packets = static_cast<uint32_t>((size + packet_size - 1) /
+                                             packet_size);
+    uint8_t flags = old_full.flags[0] & header::FLAG_PACKED;
+    if (compact)
+        flags |= header::FLAG_COMPACT;
+    header::Full_Header full = header::FULL_HEADER(
+        new_id, 0, packets, flags, packet_size, size, old_table.name);
+
+    std::vector<uint32_t> crcs(static_cast<size_t>(packets) + 1, 0);
+    std::vector<uint8_t> part_flags(static_cast<size_t>(packets) + 1, 0);
+    progress::Expect(size, packets);
+    std::atomic<bool> failed{false};
+    sched::Work_Stealing_Pool pool(threads);
+    uint32_t per_task = batch::Packets_Per_Task(packet_size);
+    for (uint32_t first = 1; first <= packets; first += per_task) {
+        uint32_t last = std::min<uint64_t>(uint64_t(first) + per_task - 1,
+                                           packets);
+        pool.Submit([&, first, last] {
+            Range_Reader reader(plan);
+            for (uint32_t part = first; part <= last && !failed; part++) {
+                std::string fname = utils::Packet_Path(new_id, part);
+                uint64_t start = header::Packet_Start(full, part);
+                uint64_t end = header::Packet_Start(full, part + 1);
+                if (reader.Hole(start, end)) {
+                    part_flags[part] = header::PACKET_HOLE;
+                    if (!splitter::Write_Hole_Packet(
+                            new_id, part, static_cast<uint32_t>(end - start),
+                            compact) ||
+                        (!keep && !Sync_Path(fname)))
+                        failed = true;
+                    progress::Add(end - start, 1);
+                    continue;
+                }
+                int fd = -1;
+                if (layout::Prepare(fname))
+                    fd = ::open(fname.c_str(),
+                                O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                uint8_t head[header::MAX_PACKET_HEADER];
+                size_t head_len = header::Encode_Packet_Header(
+                    new_id, part, static_cast<uint32_t>(end - start), compact,
+                    head);
+                bool ok = fd >= 0 &&
+                          ::write(fd, head, head_len) ==
+                              static_cast<ssize_t>(head_len) &&
+                          reader.Copy(start, end, fd, crcs[part]) &&
+                          (keep || ::fdatasync(fd) == 0);
+                if (fd >= 0)
+                    ::close(fd);
+                if (!ok) {
+                    std::cerr << "Failed to write packet: " << fname << "\n";
+                    failed = true;
+                }
+                progress::Add(end - start, 1);
+            }
+        });
+    }
+    pool.Wait();
+
+    auto drop_new = [&] {
+        for (uint32_t part = 0; part <= packets; part++)
+            ::unlink(utils::Packet_Path(new_id, part).c_str());
+    };
+    if (failed) {
+        drop_new();
+        return false;
+    }
+    if (std::find(part_flags.begin(), part_flags.end(), header::PACKET_HOLE) !=
+        part_flags.end())
+        flags |= header::FLAG_SPARSE;
+    if (!splitter::full_header(new_id, packets, old_table.name, packet_size,
+                               size, flags, crcs, old_table.entries,
+                               part_flags)) {
+        std::cerr << "Failed to write part 0 of the new set, keeping "
+                  << old_table.name << " as it was\n";
+        drop_new();
+        return false;
+    }
+
+    // The old set goes once the new one is whole and on disk (its packets
+    // synced above, part 0 by WRITE_MANIFEST), its full header first so it
+    // never looks complete while half deleted
+    if (!keep) {
+        ::unlink(utils::Packet_Path(file_id, 0).c_str());
+        for (const auto &packet : plan.packets)
+            ::unlink(packet.c_str());
+    }
+    std::cout << "repacked " << old_table.name << ": " << plan.packets.size()
+              << " -> " << packets << " packets of " << packet_size
+              << " bytes\n";
+    return true;
+}
+} // namespace repack
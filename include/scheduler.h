@@ -0,0 +1,170 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Scheduler module namespace: a small work-stealing thread pool shared by the
+ * batch commands. Each worker owns a deque: it pushes and pops its own tasks
+ * at the back (newest first, cache friendly) and idle workers steal from the
+ * front of the others (oldest first, usually the biggest pieces of work).
+ */
+namespace sched {
+
+class Work_Stealing_Pool {
+  public:
+    using Task = std::function<void()>;
+
+    /*
+     * - @threads : number of workers, 0 picks one per hardware thread
+     */
+    explicit Work_Stealing_Pool(size_t threads = 0);
+    ~Work_Stealing_Pool();
+
+    Work_Stealing_Pool(const Work_Stealing_Pool &) = delete;
+    Work_Stealing_Pool &operator=(const Work_Stealing_Pool &) = delete;
+
+    /*
+     * Queues a task. Called from a worker, the task goes to that worker's
+     * own deque; from outside, queues are filled round-robin.
+     */
+    void Submit(Task task);
+
+    /*
+     * Blocks until every submitted task, including the ones submitted by
+     * other tasks, has finished.
+     */
+    void Wait();
+
+    size_t Size() const { return queues_.size(); }
+
+  private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    bool Pop(size_t self, Task &task);
+    void Run(size_t self);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_queue_{0};
+    std::atomic<size_t> pending_{0}; // submitted but not finished
+    std::atomic<size_t> queued_{0};  // submitted but not started
+
+    std::mutex idle_lock_;
+    std::condition_variable work_ready_;
+    std::condition_variable all_done_;
+    bool stopping_ = false;
+};
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+namespace detail {
+// Pool and worker index of the current thread, null outside of any pool
+inline thread_local const Work_Stealing_Pool *current_pool = nullptr;
+inline thread_local size_t current_worker = 0;
+} // namespace detail
+
+inline Work_Stealing_Pool::Work_Stealing_Pool(size_t threads) {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    for (size_t i = 0; i < threads; i++)
+        queues_.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < threads; i++)
+        workers_.emplace_back([this, i] { Run(i); });
+}
+
+inline Work_Stealing_Pool::~Work_Stealing_Pool() {
+    {
+        std::lock_guard<std::mutex> guard(idle_lock_);
+        stopping_ = true;
+    }
+    work_ready_.notify_all();
+    for (auto &worker : workers_)
+        worker.join();
+}
+
+inline void Work_Stealing_Pool::Submit(Task task) {
+    size_t target;
+    if (detail::current_pool == this)
+        target = detail::current_worker;
+    else
+        target = next_queue_.fetch_add(1) % queues_.size();
+
+    pending_.fetch_add(1);
+    {
+        // Counted before it is visible, so queued_ never drops below zero
+        std::lock_guard<std::mutex> guard(idle_lock_);
+        queued_.fetch_add(1);
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues_[target]->lock);
+        queues_[target]->tasks.push_back(std::move(task));
+    }
+    work_ready_.notify_one();
+}
+
+inline bool Work_Stealing_Pool::Pop(size_t self, Task &task) {
+    {
+        Queue &own = *queues_[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues_.size(); i++) {
+        Queue &victim = *queues_[(self + i) % queues_.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void Work_Stealing_Pool::Run(size_t self) {
+    detail::current_pool = this;
+    detail::current_worker = self;
+
+    while (true) {
+        Task task;
+        if (Pop(self, task)) {
+            queued_.fetch_sub(1);
+            task();
+            if (pending_.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> guard(idle_lock_);
+                all_done_.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(idle_lock_);
+        work_ready_.wait(guard,
+                         [this] { return stopping_ || queued_.load() > 0; });
+        if (stopping_ && queued_.load() == 0)
+            return;
+    }
+}
+
+inline void Work_Stealing_Pool::Wait() {
+    std::unique_lock<std::mutex> guard(idle_lock_);
+    all_done_.wait(guard, [this] { return pending_.load() == 0; });
+}
+} // namespace sched
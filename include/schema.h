@@ -0,0 +1,164 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Header schema: the byte layout of every packet header, defined once at
+ * compile time. Each field knows its offset and size, numbers are encoded
+ * little-endian whatever the host is, and the header structs are checked
+ * against the schema with static_asserts, so readers use named fields
+ * instead of magic offsets and the format does not depend on how a compiler
+ * lays a struct out. Loads and stores compile to a few fixed-offset moves.
+ */
+namespace header {
+
+/*
+ * Field: `Size` bytes at `Offset` of an encoded header.
+ */
+template <size_t Offset, size_t Size> struct Field {
+    static constexpr size_t offset = Offset;
+    static constexpr size_t size = Size;
+    static constexpr size_t end = Offset + Size;
+
+    /*
+     * Little-endian number stored in the field.
+     */
+    template <typename T> static T Get(const uint8_t *base) {
+        static_assert(Size <= sizeof(T), "field wider than the type");
+        T value = 0;
+        for (size_t i = 0; i < Size; i++)
+            value |= static_cast<T>(base[Offset + i]) << (8 * i);
+        return value;
+    }
+
+    template <typename T> static void Put(uint8_t *base, T value) {
+        static_assert(Size <= sizeof(T), "field wider than the type");
+        for (size_t i = 0; i < Size; i++)
+            base[Offset + i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+
+    /*
+     * Raw bytes of the field (magic, file_id, name).
+     */
+    static void Copy_Out(const uint8_t *base, uint8_t *to) {
+        std::memcpy(to, base + Offset, Size);
+    }
+    static void Copy_In(uint8_t *base, const uint8_t *from) {
+        std::memcpy(base + Offset, from, Size);
+    }
+};
+
+/*
+ * Schema: fields laid out back to back in declaration order.
+ */
+template <size_t... Sizes> struct Schema {
+    static constexpr size_t SIZE = (Sizes + ... + 0);
+
+    static constexpr size_t Offset_Of(size_t index) {
+        constexpr size_t sizes[] = {Sizes...};
+        size_t offset = 0;
+        for (size_t i = 0; i < index; i++)
+            offset += sizes[i];
+        return offset;
+    }
+
+    static constexpr size_t Size_Of(size_t index) {
+        constexpr size_t sizes[] = {Sizes...};
+        return sizes[index];
+    }
+
+    template <size_t I> using At = Field<Offset_Of(I), Size_Of(I)>;
+};
+
+/*
+ * Full header (split 0): one per packet set.
+ */
+struct Full_Fields {
+    using Layout = Schema<5, 5, 4, 4, 1, 4, 8, 19>;
+    using Magic = Layout::At<0>;     // "PCORE"
+    using File_ID = Layout::At<1>;
+    using Part = Layout::At<2>;      // always 0
+    using Packets = Layout::At<3>;
+    using Flags = Layout::At<4>;
+    using Payload = Layout::At<5>;   // common payload size
+    using File_Size = Layout::At<6>;
+    using Name = Layout::At<7>;      // original name, zero padded
+    static constexpr size_t SIZE = Layout::SIZE;
+};
+
+/*
+ * Standard packet header, in front of every payload.
+ */
+struct Mini_Fields {
+    using Layout = Schema<5, 5, 4, 4, 1>;
+    using Magic = Layout::At<0>; // "PCORE"
+    using File_ID = Layout::At<1>;
+    using Part = Layout::At<2>;
+    using Payload = Layout::At<3>;
+    using Flag = Layout::At<4>;
+    static constexpr size_t SIZE = Layout::SIZE;
+};
+
+/*
+ * Compact packet header: a one byte magic and a varint part number, and no
+ * payload length (the file size gives it). 8 bytes for the first 127 parts
+ * instead of 19, which matters for small packets.
+ *   magic(1) file_id(5) flag(1) part(varint, 1-5)
+ */
+struct Compact_Fields {
+    using Layout = Schema<1, 5, 1>;
+    using Magic = Layout::At<0>;
+    using File_ID = Layout::At<1>;
+    using Flag = Layout::At<2>;
+    static constexpr size_t SIZE = Layout::SIZE; // without the part number
+    static constexpr size_t MAX_SIZE = SIZE + 5;
+};
+
+constexpr uint8_t COMPACT_MAGIC = 0xC5;
+constexpr size_t FULL_HEADER_SIZE = Full_Fields::SIZE;
+constexpr size_t MINI_HEADER_SIZE = Mini_Fields::SIZE;
+constexpr size_t MAX_PACKET_HEADER = MINI_HEADER_SIZE;
+
+static_assert(FULL_HEADER_SIZE == 50, "full header format changed");
+static_assert(MINI_HEADER_SIZE == 19, "mini header format changed");
+static_assert(Full_Fields::Name::offset == 31, "full header format changed");
+static_assert(Compact_Fields::MAX_SIZE <= MAX_PACKET_HEADER,
+              "a packet header read must cover both variants");
+
+/*
+ * LEB128 varint: 7 bits per byte, high bit set on all but the last.
+ */
+constexpr size_t Varint_Size(uint32_t value) {
+    size_t n = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+inline size_t Put_Varint(uint8_t *out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+    return n;
+}
+
+/*
+ * - @return : bytes used, 0 if the varint is truncated or too long
+ */
+inline size_t Get_Varint(const uint8_t *in, size_t avail, uint32_t &value) {
+    value = 0;
+    for (size_t i = 0; i < avail && i < 5; i++) {
+        value |= static_cast<uint32_t>(in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80))
+            return i + 1;
+    }
+    return 0;
+}
+} // namespace header
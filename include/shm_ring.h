@@ -0,0 +1,513 @@
+#pragma once
+#include "full_header.h"
+#include "mini_header.h"
+#include "pkt_utils.h"
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <linux/futex.h>
+#include <poll.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+/*
+ * Shared memory module namespace: hands packets to other processes on the
+ * same host without going through the filesystem.
+ * The producer lays a ring of packet slots over a memfd; each slot holds a
+ * Mini_Header and its payload inline. Any number of consumers map the same
+ * memfd (passed over a Unix socket) and take packets from the ring. The ring
+ * is a bounded MPMC queue with a sequence number per slot; idle sides sleep
+ * on futexes instead of spinning.
+ */
+namespace shm {
+
+/*
+ * Packet taken from the ring. The memory belongs to the ring until the view
+ * is released.
+ */
+struct Packet_View {
+    const header::Mini_Header *mini = nullptr;
+    const uint8_t *payload = nullptr;
+    uint32_t part = 0;
+    uint32_t len = 0;
+    uint64_t pos = 0; // ring position, used to release the slot
+};
+
+/*
+ * Splits a file straight into a shared ring and serves the ring to consumers
+ * connecting to socket_path. Returns once every packet was consumed.
+ * - @file         : file to split
+ * - @socket_path  : Unix socket consumers connect to
+ * - @payload_size : payload bytes per packet
+ * - @slots        : ring capacity in packets (rounded up to a power of two)
+ */
+inline bool SPLIT_TO_RING(const std::string &file,
+                          const std::string &socket_path,
+                          uint32_t payload_size, uint32_t slots = 64);
+
+/*
+ * Consumes packets from a ring served at socket_path and writes them to
+ * output (the original filename when empty). Several consumers can share one
+ * ring; each writes the packets it took.
+ */
+inline bool CONSUME_RING(const std::string &socket_path,
+                         const std::string &output);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+constexpr char RING_MAGIC[8] = "PCRING1";
+constexpr uint32_t DEFAULT_RING_PAYLOAD = 256 * 1024;
+
+inline long Futex(std::atomic<uint32_t> &word, int op, uint32_t value,
+                  const timespec *timeout = nullptr) {
+    // Shared futex (no FUTEX_PRIVATE_FLAG): waiters live in other processes
+    return ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), op, value,
+                     timeout, nullptr, 0);
+}
+
+/*
+ * Lives at offset 0 of the memfd. Counters touched by different sides sit on
+ * their own cache lines.
+ */
+struct Ring_Header {
+    char magic[8];
+    uint32_t slots;     // power of two
+    uint32_t slot_size; // bytes per slot, Slot_Header included
+    uint64_t map_size;
+    uint8_t full[sizeof(header::Full_Header)];
+
+    alignas(64) std::atomic<uint64_t> enqueue_pos;
+    alignas(64) std::atomic<uint64_t> dequeue_pos;
+    alignas(64) std::atomic<uint32_t> data_gen; // bumped on every publish
+    std::atomic<uint32_t> data_waiters;
+    alignas(64) std::atomic<uint32_t> space_gen; // bumped on every release
+    std::atomic<uint32_t> space_waiters;
+    alignas(64) std::atomic<uint32_t> done_gen; // bumped on every consumed packet
+    std::atomic<uint32_t> done_waiters;
+    std::atomic<uint64_t> done;
+    std::atomic<uint32_t> closed; // producer will publish nothing more
+};
+
+struct Slot_Header {
+    std::atomic<uint64_t> seq;
+    uint32_t len; // Mini_Header + payload
+    uint32_t pad;
+};
+
+class Ring {
+  public:
+    Ring() = default;
+    Ring(const Ring &) = delete;
+    Ring &operator=(const Ring &) = delete;
+    ~Ring() { Unmap(); }
+
+    /*
+     * Creates a ring for packets of up to payload_size bytes.
+     */
+    bool Create(const header::Full_Header &full, uint32_t payload_size,
+                uint32_t slots) {
+        uint32_t count = 1;
+        while (count < slots)
+            count <<= 1;
+        uint64_t slot_size = sizeof(Slot_Header) + sizeof(header::Mini_Header) +
+                             payload_size;
+        slot_size = (slot_size + 63) & ~uint64_t(63);
+        uint64_t header_size = (sizeof(Ring_Header) + 4095) & ~uint64_t(4095);
+        uint64_t size = header_size + count * slot_size;
+        if (slot_size > UINT32_MAX) {
+            std::cerr << "Packet size too large for a shared ring\n";
+            return false;
+        }
+
+        fd_ = ::memfd_create("pktcore-ring", MFD_CLOEXEC);
+        if (fd_ < 0 || ::ftruncate(fd_, size) != 0 || !Map(size)) {
+            std::cerr << "Could not create shared ring\n";
+            return false;
+        }
+
+        Ring_Header *h = new (base_) Ring_Header();
+        std::memcpy(h->magic, RING_MAGIC, sizeof(RING_MAGIC));
+        h->slots = count;
+        h->slot_size = static_cast<uint32_t>(slot_size);
+        h->map_size = size;
+        std::memcpy(h->full, &full, sizeof(full));
+        slots_ = base_ + header_size;
+        for (uint32_t i = 0; i < count; i++)
+            new (Slot(i)) Slot_Header{{i}, 0, 0};
+        return true;
+    }
+
+    /*
+     * Maps a ring received from its producer. Takes ownership of fd.
+     */
+    bool Attach(int fd) {
+        fd_ = fd;
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || static_cast<size_t>(st.st_size) <
+                                        sizeof(Ring_Header) ||
+            !Map(st.st_size) ||
+            std::memcmp(Header()->magic, RING_MAGIC, sizeof(RING_MAGIC)) != 0) {
+            std::cerr << "Not a pktcore ring\n";
+            return false;
+        }
+        slots_ = base_ + ((sizeof(Ring_Header) + 4095) & ~uint64_t(4095));
+        return true;
+    }
+
+    int Fd() const { return fd_; }
+    Ring_Header *Header() const { return reinterpret_cast<Ring_Header *>(base_); }
+    header::Full_Header Full() const {
+        header::Full_Header full;
+        std::memcpy(&full, Header()->full, sizeof(full));
+        return full;
+    }
+
+    /*
+     * Producer: claims the next free slot, sleeping while the ring is full.
+     * - @return : slot data (Mini_Header then payload) and its position
+     */
+    uint8_t *Claim(uint64_t &pos) {
+        Ring_Header *h = Header();
+        while (true) {
+            uint32_t gen = h->space_gen.load();
+            pos = h->enqueue_pos.load(std::memory_order_relaxed);
+            Slot_Header *slot = Slot(pos);
+            int64_t diff = static_cast<int64_t>(
+                slot->seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0 && h->enqueue_pos.compare_exchange_weak(
+                                 pos, pos + 1, std::memory_order_relaxed))
+                return reinterpret_cast<uint8_t *>(slot + 1);
+            if (diff < 0)
+                Wait(h->space_gen, h->space_waiters, gen);
+        }
+    }
+
+    /*
+     * Producer: makes a claimed slot visible to consumers.
+     */
+    void Publish(uint64_t pos, uint32_t len) {
+        Ring_Header *h = Header();
+        Slot_Header *slot = Slot(pos);
+        slot->len = len;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        Wake(h->data_gen, h->data_waiters, 1);
+    }
+
+    /*
+     * Producer: no more packets; wakes every consumer so it can drain and stop.
+     */
+    void Close() {
+        Ring_Header *h = Header();
+        h->closed.store(1);
+        Wake(h->data_gen, h->data_waiters, INT_MAX);
+    }
+
+    /*
+     * Consumer: takes the next packet, sleeping while the ring is empty.
+     * - @return : false once the ring is closed and drained
+     */
+    bool Pop(Packet_View &view) {
+        Ring_Header *h = Header();
+        while (true) {
+            uint32_t gen = h->data_gen.load();
+            uint64_t pos = h->dequeue_pos.load(std::memory_order_relaxed);
+            Slot_Header *slot = Slot(pos);
+            int64_t diff = static_cast<int64_t>(
+                slot->seq.load(std::memory_order_acquire) - (pos + 1));
+            if (diff == 0 && h->dequeue_pos.compare_exchange_weak(
+                                 pos, pos + 1, std::memory_order_relaxed)) {
+                const uint8_t *data = reinterpret_cast<const uint8_t *>(slot + 1);
+                view.mini = reinterpret_cast<const header::Mini_Header *>(data);
+                view.payload = data + sizeof(header::Mini_Header);
+                view.len = slot->len - sizeof(header::Mini_Header);
+                view.part = header::Part_Of(*view.mini);
+                view.pos = pos;
+                return true;
+            }
+            if (diff < 0) {
+                if (h->closed.load() &&
+                    h->dequeue_pos.load() == h->enqueue_pos.load())
+                    return false;
+                Wait(h->data_gen, h->data_waiters, gen);
+            }
+        }
+    }
+
+    /*
+     * Consumer: hands the slot of a popped packet back to the producer.
+     */
+    void Release(const Packet_View &view) {
+        Ring_Header *h = Header();
+        Slot(view.pos)->seq.store(view.pos + h->slots,
+                                  std::memory_order_release);
+        Wake(h->space_gen, h->space_waiters, 1);
+        h->done.fetch_add(1);
+        Wake(h->done_gen, h->done_waiters, INT_MAX);
+    }
+
+    /*
+     * Producer: sleeps until consumers released this many packets.
+     */
+    void Wait_Done(uint64_t packets) {
+        Ring_Header *h = Header();
+        while (true) {
+            uint32_t gen = h->done_gen.load();
+            if (h->done.load() >= packets)
+                return;
+            Wait(h->done_gen, h->done_waiters, gen);
+        }
+    }
+
+  private:
+    bool Map(uint64_t size) {
+        void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED)
+            return false;
+        base_ = static_cast<uint8_t *>(p);
+        size_ = size;
+        return true;
+    }
+
+    void Unmap() {
+        if (base_)
+            ::munmap(base_, size_);
+        if (fd_ >= 0)
+            ::close(fd_);
+        base_ = nullptr;
+        fd_ = -1;
+    }
+
+    Slot_Header *Slot(uint64_t pos) const {
+        uint32_t mask = Header()->slots - 1;
+        return reinterpret_cast<Slot_Header *>(
+            slots_ + (pos & mask) * Header()->slot_size);
+    }
+
+    /*
+     * Sleeps until gen moves on. The timeout only guards against a peer
+     * process dying between its state change and its wake-up call.
+     */
+    static void Wait(std::atomic<uint32_t> &gen, std::atomic<uint32_t> &waiters,
+                     uint32_t seen) {
+        timespec timeout{0, 100 * 1000 * 1000};
+        waiters.fetch_add(1);
+        if (gen.load() == seen)
+            Futex(gen, FUTEX_WAIT, seen, &timeout);
+        waiters.fetch_sub(1);
+    }
+
+    static void Wake(std::atomic<uint32_t> &gen, std::atomic<uint32_t> &waiters,
+                     int count) {
+        gen.fetch_add(1);
+        if (waiters.load() > 0)
+            Futex(gen, FUTEX_WAKE, static_cast<uint32_t>(count));
+    }
+
+    int fd_ = -1;
+    uint8_t *base_ = nullptr;
+    uint64_t size_ = 0;
+    uint8_t *slots_ = nullptr;
+};
+
+inline bool Unix_Address(const std::string &path, sockaddr_un &addr) {
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << path << "\n";
+        return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+/*
+ * Passes a file descriptor over a Unix socket (SCM_RIGHTS).
+ */
+inline bool Send_Fd(int sock, int fd) {
+    char byte = 'R';
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    return ::sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+inline int Receive_Fd(int sock) {
+    char byte;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1)
+        return -1;
+    cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+        return -1;
+    int fd;
+    std::memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+    return fd;
+}
+
+inline bool SPLIT_TO_RING(const std::string &file,
+                          const std::string &socket_path,
+                          uint32_t payload_size, uint32_t slots) {
+    if (payload_size == 0 || slots == 0) {
+        std::cerr << "Packet size and ring slots must be greater than zero\n";
+        return false;
+    }
+    int file_fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file_fd < 0 || fstat(file_fd, &st) != 0) {
+        std::cerr << "Could not open file: " << file << "\n";
+        if (file_fd >= 0)
+            ::close(file_fd);
+        return false;
+    }
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    uint32_t packets =
+        static_cast<uint32_t>((size + payload_size - 1) / payload_size);
+    header::Full_Header full = header::FULL_HEADER(
+        utils::Genrate_File_ID(), 0, packets, 0, payload_size, size,
+        std::filesystem::path(file).filename().string());
+
+    Ring ring;
+    sockaddr_un addr;
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (!ring.Create(full, payload_size, slots) ||
+        !Unix_Address(socket_path, addr) || listener < 0) {
+        ::close(file_fd);
+        if (listener >= 0)
+            ::close(listener);
+        return false;
+    }
+    ::unlink(socket_path.c_str());
+    if (::bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) !=
+            0 ||
+        ::listen(listener, 16) != 0) {
+        std::cerr << "Could not listen on " << socket_path << "\n";
+        ::close(file_fd);
+        ::close(listener);
+        return false;
+    }
+
+    // Consumers may attach at any time while the ring is alive
+    std::atomic<bool> serving{true};
+    std::thread acceptor([&] {
+        while (serving) {
+            pollfd p{listener, POLLIN, 0};
+            if (::poll(&p, 1, 100) <= 0)
+                continue;
+            int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0)
+                continue;
+            Send_Fd(client, ring.Fd());
+            ::close(client);
+        }
+    });
+
+    // The payload is read straight into the shared slot
+    bool ok = true;
+    for (uint32_t part = 1; part <= packets; part++) {
+        uint64_t start = header::Packet_Start(full, part);
+        uint32_t len = static_cast<uint32_t>(
+            header::Packet_Start(full, part + 1) - start);
+        uint64_t pos;
+        uint8_t *data = ring.Claim(pos);
+        new (data) header::Mini_Header(full.file_id, part, len);
+        if (::pread(file_fd, data + sizeof(header::Mini_Header), len, start) !=
+            static_cast<ssize_t>(len)) {
+            std::cerr << "Failed to read packet " << part << "\n";
+            ok = false;
+            len = 0; // still publish, so consumers are not left waiting
+        }
+        ring.Publish(pos, sizeof(header::Mini_Header) + len);
+        if (!ok)
+            break;
+    }
+    ring.Close();
+    if (ok)
+        ring.Wait_Done(packets);
+
+    serving = false;
+    acceptor.join();
+    ::close(listener);
+    ::unlink(socket_path.c_str());
+    ::close(file_fd);
+    return ok;
+}
+
+inline bool CONSUME_RING(const std::string &socket_path,
+                         const std::string &output) {
+    sockaddr_un addr;
+    int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || !Unix_Address(socket_path, addr) ||
+        ::connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) !=
+            0) {
+        std::cerr << "Could not connect to " << socket_path << "\n";
+        if (sock >= 0)
+            ::close(sock);
+        return false;
+    }
+    int fd = Receive_Fd(sock);
+    ::close(sock);
+    Ring ring;
+    if (fd < 0 || !ring.Attach(fd))
+        return false;
+
+    header::Full_Header full = ring.Full();
+    std::string name = output;
+    if (name.empty()) {
+        name.assign(reinterpret_cast<const char *>(full.filename.data()),
+                    full.filename.size());
+        name = name.c_str(); // drop the zero padding
+    }
+    // No O_TRUNC: other consumers of the same ring write the same file
+    int out_fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (out_fd < 0 || ::ftruncate(out_fd, header::File_Size_Of(full)) != 0) {
+        std::cerr << "Failed to create file: " << name << "\n";
+        if (out_fd >= 0)
+            ::close(out_fd);
+        return false;
+    }
+
+    bool ok = true;
+    Packet_View view;
+    while (ring.Pop(view)) {
+        uint64_t start = header::Packet_Start(full, view.part);
+        uint64_t expected = header::Packet_Start(full, view.part + 1) - start;
+        if (view.len != expected ||
+            ::pwrite(out_fd, view.payload, view.len, start) !=
+                static_cast<ssize_t>(view.len)) {
+            std::cerr << "Failed to write packet " << view.part << "\n";
+            ok = false;
+        }
+        ring.Release(view);
+    }
+    ::close(out_fd);
+    return ok;
+}
+} // namespace shm
@@ -0,0 +1,100 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Sparse module namespace: holes of sparse files (VM images, database
+ * files). Split asks the filesystem where the data is (SEEK_DATA /
+ * SEEK_HOLE) instead of reading zeros, parts that are all hole become hole
+ * packets with no payload stored, and combine leaves their range unwritten
+ * so the output gets the holes back.
+ */
+namespace sparse {
+
+/*
+ * True when a regular file has fewer blocks allocated than its size, i.e.
+ * it may have holes worth looking for.
+ */
+inline bool Has_Holes(int fd);
+
+/*
+ * True when [offset, offset + len) of a file holds no data at all.
+ */
+inline bool Is_Hole(int fd, uint64_t offset, uint64_t len);
+
+/*
+ * Finds the next data extent of a file at or after `from`.
+ * - @size   : file size, extents are clipped to it
+ * - @return : false when only hole is left
+ */
+inline bool Next_Data(int fd, uint64_t from, uint64_t size, uint64_t &start,
+                      uint64_t &end);
+
+/*
+ * Deallocates a range of a file, keeping its size.
+ * - @return : false where the filesystem cannot punch holes
+ */
+inline bool Punch_Hole(int fd, uint64_t offset, uint64_t len);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+inline bool Has_Holes(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+           static_cast<uint64_t>(st.st_blocks) * 512 <
+               static_cast<uint64_t>(st.st_size);
+}
+
+inline bool Is_Hole(int fd, uint64_t offset, uint64_t len) {
+#ifdef SEEK_DATA
+    if (len == 0)
+        return false;
+    off_t data = ::lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+    if (data < 0)
+        return errno == ENXIO; // no data up to the end of the file
+    return static_cast<uint64_t>(data) >= offset + len;
+#else
+    (void)fd, (void)offset, (void)len;
+    return false;
+#endif
+}
+
+inline bool Next_Data(int fd, uint64_t from, uint64_t size, uint64_t &start,
+                      uint64_t &end) {
+    start = from;
+    end = size;
+#ifdef SEEK_DATA
+    off_t data = ::lseek(fd, static_cast<off_t>(from), SEEK_DATA);
+    if (data < 0) {
+        // ENXIO: nothing but hole left; anything else: treat as data
+        if (errno == ENXIO)
+            start = size;
+    } else {
+        start = static_cast<uint64_t>(data);
+        off_t hole = ::lseek(fd, data, SEEK_HOLE);
+        if (hole >= 0 && static_cast<uint64_t>(hole) < size)
+            end = static_cast<uint64_t>(hole);
+    }
+#endif
+    if (start > size)
+        start = size;
+    return start < size;
+}
+
+inline bool Punch_Hole(int fd, uint64_t offset, uint64_t len) {
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+    return len == 0 ||
+           ::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                       static_cast<off_t>(offset),
+                       static_cast<off_t>(len)) == 0;
+#else
+    (void)fd, (void)offset, (void)len;
+    return false;
+#endif
+}
+} // namespace sparse
@@ -1,12 +1,31 @@
 #pragma once
+#include "buffer_pool.h"
 #include "explorer.h"
 #include "full_header.h"
+#include "journal.h"
+#include "manifest.h"
 #include "mini_header.h"
+#include "page_cache.h"
+#include "pipeline.h"
 #include "pkt_utils.h"
+#include "progress.h"
+#include "sparse.h"
+#include "throttle.h"
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cerrno>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
 #include <iosfwd>
+#include <memory>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 /*
@@ -28,16 +47,24 @@ inline std::string input_file();
 inline int input_splits();
 
 /*
- * Create and write the full header into the 0th split file.
+ * Create and write the full header and the manifest into the 0th split file.
  * param file_id: unique ID for the file (5 bytes)
  * param splits: total number of splits/chunks
  * param file_name: name of the original file
  * param payload_len: size of each chunk (excluding header)
  * param file_size: total original file size
+ * param flags: header::FLAG_* bits describing the packet set
+ * param crcs: crc32c of the payload of every part, crcs[part]
+ * param entries: entry table of a packed set
+ * param part_flags: header::PACKET_* bits of every part, part_flags[part]
+ * return: false if part 0 could not be written
  */
-inline void full_header(std::array<uint8_t, 5> file_id, int splits,
+inline bool full_header(std::array<uint8_t, 5> file_id, int splits,
                         std::string file_name, std::streampos payload_len,
-                        std::streampos file_size);
+                        std::streampos file_size, uint8_t flags = 0,
+                        const std::vector<uint32_t> &crcs = {},
+                        const std::vector<uint8_t> &entries = {},
+                        const std::vector<uint8_t> &part_flags = {});
 
 /*
  * Create an individual packet file with a mini header and corresponding data.
@@ -46,31 +73,145 @@ inline void full_header(std::array<uint8_t, 5> file_id, int splits,
  * param splits: current split number
  * param starting_ptr: start byte offset for this chunk
  * param end_ptr: end byte offset for this chunk
+ * param crc: if given, receives the crc32c of the payload
+ * return: false when the packet could not be written
  */
-inline void create_packet(std::string file, std::array<uint8_t, 5> file_id,
+inline bool create_packet(std::string file, std::array<uint8_t, 5> file_id,
                           int splits, std::streampos starting_ptr,
-                          std::streampos end_ptr);
+                          std::streampos end_ptr, uint32_t *crc = nullptr);
+
+/*
+ * Writes a hole packet: the packet header alone, flagged PACKET_HOLE.
+ * - @len : length of the hole it stands for
+ */
+inline bool Write_Hole_Packet(const std::array<uint8_t, 5> &file_id,
+                              uint32_t part, uint32_t len, bool compact);
+
+/*
+ * Splits a file into `splits` packets on the pipeline engine: reading the
+ * next chunks overlaps with writing the current packet files. The first
+ * size % splits packets carry one extra byte. Parts lying in a hole of a
+ * sparse file are not read; they become hole packets.
+ * - @file      : file to split
+ * - @splits    : number of packets
+ * - @in_flight : chunks alive at once between the read and write stages
+ * - @direct    : bypass the page cache (O_DIRECT) for bulk jobs
+ * - @compact   : compact packet headers (8 bytes instead of 19)
+ */
+inline bool SPLIT_FILE(const std::string &file, int splits,
+                       size_t in_flight = 16, bool direct = false,
+                       bool compact = false);
+
+/*
+ * Opens the journal of a big split, kept at the first packet root and named
+ * after the input's path. When the same file (same size and mtime) is split
+ * again the same way, the split resumes: file_id is replaced by the one of
+ * the interrupted run and the packets journaled as done are kept. Packets
+ * of an interrupted split of another version of the file are deleted.
+ * - @file_id : in: id of a new split; out: id to write the packets with
+ * - @return  : nullptr when no journal could be written
+ */
+inline std::unique_ptr<journal::Journal>
+Open_Split_Journal(const std::string &file, const struct stat &st, int splits,
+                   bool compact, std::array<uint8_t, 5> &file_id);
 
 /*
  * Main driver function to perform the file splitting operation.
  * It selects a file, asks for number of splits, generates headers, and creates
  * packet files.
+ * return: false if the split failed
  */
-inline void SPLITTER();
+inline bool SPLITTER();
 
 /*
  * Main driver function to perform the file splitting operation.
  * it takes file name inside parameters
  * packet files.
  */
-inline void SPLITTER(const std::string &file);
+inline bool SPLITTER(const std::string &file);
 
 /*
  * Main driver function to perform the file splitting operation.
  * it takes file name and no of splits inside parameters
  * packet files.
  */
-inline void SPLITTER(const std::string &file, int splits);
+inline bool SPLITTER(const std::string &file, int splits,
+                     size_t in_flight = 16, bool direct = false,
+                     bool compact = false);
+
+/*
+ * Stream_Splitter: packetizes data as it arrives, for inputs whose total size
+ * is unknown up front (pipes, sockets). Every packet carries packet_size bytes
+ * of payload except the last one. A packet file is complete as soon as it is
+ * closed, so it can be shipped while the producer is still running; the full
+ * header (split 0) is only written by Finish() once the size is known.
+ */
+class Stream_Splitter {
+  public:
+    Stream_Splitter(const std::string &name, uint32_t packet_size,
+                    bool compact = false);
+    ~Stream_Splitter();
+
+    Stream_Splitter(const Stream_Splitter &) = delete;
+    Stream_Splitter &operator=(const Stream_Splitter &) = delete;
+
+    /*
+     * Appends bytes to the stream, closing packets as they fill up.
+     * - @return : false if a packet file could not be written
+     */
+    bool Feed(const uint8_t *data, size_t len);
+
+    /*
+     * Appends len zero bytes that are a hole of the input: packets lying
+     * wholly inside it become hole packets, the rest is fed as zeros.
+     */
+    bool Skip(uint64_t len);
+
+    /*
+     * Fixes up the length of the last packet and writes the full header and
+     * the manifest.
+     * - @flags   : header::FLAG_* bits stored in the full header
+     * - @entries : entry table of a packed set, stored in the manifest
+     */
+    bool Finish(uint8_t flags = 0, const std::vector<uint8_t> &entries = {});
+
+    /*
+     * Gives up on the stream: removes every packet written so far, part 0
+     * too, so no partial set is left behind.
+     */
+    void Abort();
+
+    const std::array<uint8_t, 5> &File_ID() const { return file_id_; }
+    uint32_t Packets() const { return part_; }
+    uint64_t Bytes() const { return total_; }
+
+  private:
+    bool Close_Packet();
+
+    std::string name_;
+    uint32_t packet_size_;
+    bool compact_;
+    std::array<uint8_t, 5> file_id_;
+    int fd_ = -1;        // packet currently being filled
+    uint32_t part_ = 0;  // last part number handed out
+    uint32_t fill_ = 0;  // payload bytes in the current packet
+    uint64_t total_ = 0; // bytes seen so far
+    std::vector<uint32_t> crcs_ = {0}; // crc32c of every part, by part
+    std::vector<uint8_t> part_flags_ = {0}; // header::PACKET_* bits, by part
+    bool holes_ = false;                    // some part is a hole packet
+};
+
+/*
+ * Splits everything readable from a file descriptor (e.g. stdin) into
+ * packets of packet_size bytes. Holes of a sparse regular file are skipped
+ * rather than read.
+ * - @fd          : descriptor to read until end of stream
+ * - @name        : filename stored in the full header
+ * - @packet_size : payload bytes per packet
+ * - @compact     : compact packet headers
+ */
+inline bool SPLITTER_STREAM(int fd, const std::string &name,
+                            uint32_t packet_size, bool compact = false);
 //=================================================================================
 //=================================================================================
 // function coding here
@@ -78,6 +219,9 @@ inline void SPLITTER(const std::string &file, int splits);
 // later when the projects gets bigger and this part is bug free
 // we will move this section to different file
 //
+// Payload copies of create_packet go through pooled buffers of this size
+constexpr size_t COPY_BUFFER = 1024 * 1024;
+
 std::string input_file() {
     std::cout << "Enter the file name " << '\n';
     std::string filename;
@@ -92,139 +236,610 @@ int input_splits() {
     return no_of_splits;
 }
 
-void full_header(std::array<uint8_t, 5> file_id, int splits,
+bool full_header(std::array<uint8_t, 5> file_id, int splits,
                  std::string file_name, std::streampos payload_len,
-                 std::streampos file_size) {
+                 std::streampos file_size, uint8_t flags,
+                 const std::vector<uint32_t> &crcs,
+                 const std::vector<uint8_t> &entries,
+                 const std::vector<uint8_t> &part_flags) {
     std::string fname = utils::CREATE_EMPTY_HEADER_FILE(file_id, 0);
+    if (fname.empty())
+        return false;
     header::Full_Header file_header = header::FULL_HEADER(
-        file_id, 0, splits, 0, payload_len, file_size, file_name);
-    header::WRITE_FULL_HEADER(fname, file_header);
+        file_id, 0, splits, flags, payload_len, file_size, file_name);
+    manifest::Manifest table =
+        manifest::Build(file_header, file_name, crcs, part_flags);
+    table.entries = entries;
+    if (!manifest::WRITE_MANIFEST(fname, file_header, table))
+        return false;
     header::Print_Full_Header(fname);
+    return true;
 }
 
-void create_packet(std::string file, std::array<uint8_t, 5> file_id, int splits,
-                   std::streampos starting_ptr, std::streampos end_ptr) {
+bool create_packet(std::string file, std::array<uint8_t, 5> file_id, int splits,
+                   std::streampos starting_ptr, std::streampos end_ptr,
+                   uint32_t *crc) {
     std::string fname = utils::CREATE_EMPTY_HEADER_FILE(file_id, splits);
+    if (fname.empty())
+        return false;
     std::streampos payload_len = end_ptr - starting_ptr;
 
     // Write mini header
     header::WRITE_MINI_HEADER(
         fname, header::Mini_Header(file_id, splits, payload_len));
 
-    // Read payload data from file
-    auto data = utils::Fetch_Bytes(file, starting_ptr, end_ptr);
-
-    // Append payload data to new file
-    utils::Append_Bytes(fname, data);
+    // Copy the payload through a pooled buffer instead of a fresh vector
+    buffers::Buffer_Pool &pool = buffers::Shared_Pool(COPY_BUFFER);
+    uint8_t *buf = pool.Acquire();
+    int in_fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    int out_fd = ::open(fname.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    off_t pos = starting_ptr;
+    bool ok = buf && in_fd >= 0 && out_fd >= 0;
+    if (crc)
+        *crc = 0;
+    while (ok && pos < end_ptr) {
+        size_t want = std::min<uint64_t>(pool.Buffer_Bytes(), end_ptr - pos);
+        throttle::Charge(want, 2);
+        ssize_t got = ::pread(in_fd, buf, want, pos);
+        ok = got > 0 && ::write(out_fd, buf, got) == got;
+        if (ok && crc)
+            *crc = manifest::Crc32c(buf, got, *crc);
+        pos += got;
+    }
+    if (!ok)
+        std::cerr << "Failed to write packet: " << fname << "\n";
+    pool.Release(buf);
+    if (in_fd >= 0)
+        ::close(in_fd);
+    if (out_fd >= 0)
+        ::close(out_fd);
+    return ok;
 }
 
-void SPLITTER() {
-    // File selection
-    std::vector<std::string> files = utils::FETCH_FILES(".");
-    std::string file = tui::SHOW_SELECT_FILES(files);
-    int splits = input_splits();
+inline bool SPLIT_FILE(const std::string &file, int splits,
+                       size_t in_flight, bool direct, bool compact) {
+    if (splits <= 0) {
+        std::cerr << "Number of splits must be greater than zero\n";
+        return false;
+    }
+    int in_fd = direct ? buffers::Open_Direct(file, O_RDONLY)
+                       : ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in_fd < 0 || fstat(in_fd, &st) != 0) {
+        std::cerr << "Could not open file: " << file << "\n";
+        if (in_fd >= 0)
+            ::close(in_fd);
+        return false;
+    }
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    std::cout << "File size: " << size << std::endl;
 
     // Generate unique file ID
     auto file_id = utils::Genrate_File_ID();
 
-    // Get file size
-    auto size = utils::Get_File_Size(file);
-    std::cout << size << std::endl;
+    // Big splits keep a journal, so a rerun after a crash only writes the
+    // packets not journaled as done
+    std::unique_ptr<journal::Journal> log;
+    if (size >= journal::JOURNAL_MIN)
+        log = Open_Split_Journal(file, st, splits, compact, file_id);
+
+    // The full header (split 0) is written once every packet is, with the
+    // checksums the engines computed on the way
+    uint64_t payload_len = size / splits;
+    uint8_t set_flags = compact ? header::FLAG_COMPACT : 0;
+    header::Full_Header layout = header::FULL_HEADER(
+        file_id, 0, splits, set_flags, payload_len, size, file);
+    std::vector<uint32_t> crcs(static_cast<size_t>(splits) + 1, 0);
+
+    // Parts that are all hole cost one lseek each instead of a read and a
+    // write of zeros
+    std::vector<uint8_t> part_flags;
+    if (sparse::Has_Holes(in_fd)) {
+        part_flags.assign(static_cast<size_t>(splits) + 1, 0);
+        for (uint32_t p = 1; p <= static_cast<uint32_t>(splits); p++) {
+            uint64_t start = header::Packet_Start(layout, p);
+            if (sparse::Is_Hole(in_fd, start,
+                                header::Packet_Start(layout, p + 1) - start)) {
+                part_flags[p] = header::PACKET_HOLE;
+                set_flags |= header::FLAG_SPARSE;
+            }
+        }
+    }
+
+    // Packets of the runs before are kept, their checksums reused and
+    // their bytes counted as done
+    progress::Expect(size, splits);
+    if (log && log->Resumed()) {
+        for (const auto &[part, crc] : log->Done())
+            if (part <= static_cast<uint32_t>(splits)) {
+                crcs[part] = crc;
+                progress::Add(header::Packet_Start(layout, part + 1) -
+                                  header::Packet_Start(layout, part),
+                              1);
+            }
+        std::cout << "Resuming split: " << log->Done().size() << " of "
+                  << splits << " packets already written\n";
+    }
 
-    // Calculate split size and leftover bytes
-    auto payload_len = size / splits;
-    auto leftover_bytes = size % splits;
+    // Result of every I/O group; one that fails stops the others
+    std::atomic<bool> ok{true};
+
+    // Writes the given parts on one engine: the I/O group of one root
+    auto run = [&](const std::vector<uint32_t> &parts) {
+        pipeline::Engine engine(in_flight);
+        for (uint32_t part : parts)
+            engine.Expect_Packet(header::Packet_Start(layout, part + 1) -
+                                 header::Packet_Start(layout, part));
+        engine.Transform([&](pipeline::Chunk &chunk) {
+            uint32_t &crc = crcs[chunk.part];
+            crc = manifest::Crc32c(chunk.Payload(), chunk.len,
+                                   chunk.first ? 0 : crc);
+            return true;
+        });
+
+        // Buffered jobs read ahead of the splitter and drop what it consumed,
+        // and every finished packet is written back and evicted in the
+        // background
+        std::vector<cache::Range> ranges;
+        for (uint32_t p : parts) {
+            uint64_t start = header::Packet_Start(layout, p);
+            ranges.push_back(
+                {file, start, header::Packet_Start(layout, p + 1) - start});
+        }
+        cache::Readahead ahead(ranges);
+        cache::Write_Behind behind;
+
+        // Read stage: walks the packets in order, one chunk at a time
+        size_t next = 0;   // index of the packet being read in parts
+        uint64_t done = 0; // payload bytes of it already read
+        auto read = [&](pipeline::Chunk &chunk) -> int {
+            if (!ok)
+                return -1; // another group failed
+            if (next == parts.size())
+                return 0;
+            uint64_t start = ranges[next].offset, len = ranges[next].len;
+            chunk.part = parts[next];
+            chunk.offset = done;
+            chunk.len = static_cast<size_t>(
+                std::min<uint64_t>(engine.Chunk_Bytes(), len - done));
+            chunk.first = done == 0;
+            bool ok = direct ? buffers::Read_Aligned(in_fd, start + done,
+                                                     chunk.len, chunk.data,
+                                                     chunk.skip)
+                             : ::pread(in_fd, chunk.data, chunk.len,
+                                       start + done) ==
+                                   static_cast<ssize_t>(chunk.len);
+            if (!ok) {
+                std::cerr << "Failed to read: " << file << "\n";
+                return -1;
+            }
+            if (!direct)
+                ahead.Progress(next, done + chunk.len);
+            done += chunk.len;
+            chunk.last = done == len;
+            if (chunk.last) {
+                ahead.Done(next);
+                next++;
+                done = 0;
+            }
+            return 1;
+        };
+
+        // Write stage: one packet file per part, packet header first. Direct
+        // writes are staged into whole blocks, as the payload sits right
+        // after the header.
+        int out_fd = -1;
+        std::unique_ptr<buffers::Direct_Writer> staged;
+        if (direct)
+            staged = std::make_unique<buffers::Direct_Writer>(buffers::Shared_Pool(
+                engine.Chunk_Bytes() + buffers::DIRECT_SLACK));
+        auto put = [&](const void *data, size_t len) {
+            return staged ? staged->Write(data, len)
+                          : ::write(out_fd, data, len) ==
+                                static_cast<ssize_t>(len);
+        };
+        size_t head_len = 0; // packet header of the current file
+        auto write = [&](pipeline::Chunk &chunk) {
+            if (chunk.first) {
+                std::string fname = utils::Packet_Path(file_id, chunk.part);
+                int flags = O_WRONLY | O_CREAT | O_TRUNC;
+                if (layout::Prepare(fname))
+                    out_fd = direct ? buffers::Open_Direct(fname, flags)
+                                    : ::open(fname.c_str(), flags | O_CLOEXEC,
+                                             0644);
+                if (staged)
+                    staged->Open(out_fd);
+                uint64_t len = header::Packet_Start(layout, chunk.part + 1) -
+                               header::Packet_Start(layout, chunk.part);
+                uint8_t head[header::MAX_PACKET_HEADER];
+                head_len = header::Encode_Packet_Header(file_id, chunk.part,
+                                                        len, compact, head);
+                if (out_fd < 0 || !put(head, head_len)) {
+                    std::cerr << "Failed to create file: " << fname << "\n";
+                    return false;
+                }
+            }
+            bool ok = put(chunk.Payload(), chunk.len);
+            if (ok && chunk.last && staged)
+                ok = staged->Finish();
+            if (ok && chunk.last && log)
+                ok = log->Complete(chunk.part, crcs[chunk.part],
+                                   chunk.offset + chunk.len);
+            if (chunk.last && ok && !direct) {
+                behind.Close(out_fd, head_len + chunk.offset + chunk.len);
+                out_fd = -1;
+            } else if (chunk.last || !ok) {
+                ::close(out_fd);
+                out_fd = -1;
+            }
+            if (!ok)
+                std::cerr << "Failed to write packet " << chunk.part << "\n";
+            return ok;
+        };
+
+        bool ok = engine.Run(read, write);
+        if (out_fd >= 0)
+            ::close(out_fd);
+        return ok;
+    };
+
+    // Packets striped over several roots: every root gets its own reader and
+    // writer, so all drives work at once
+    std::vector<std::vector<uint32_t>> stripes(layout::Active().roots.size());
+    for (uint32_t p = 1; p <= static_cast<uint32_t>(splits); p++) {
+        if (log && log->Done().count(p))
+            continue;
+        uint64_t len = header::Packet_Start(layout, p + 1) -
+                       header::Packet_Start(layout, p);
+        if (part_flags.empty() || !(part_flags[p] & header::PACKET_HOLE))
+            stripes[layout::Stripe_Of(p)].push_back(p);
+        else if (!Write_Hole_Packet(file_id, p, static_cast<uint32_t>(len),
+                                    compact))
+            ok = false;
+        else
+            progress::Add(len, 1);
+    }
 
-    // Create full header (split 0)
-    full_header(file_id, splits, file, payload_len, size);
+    std::vector<std::thread> groups;
+    for (size_t i = 1; i < stripes.size(); i++) {
+        if (!stripes[i].empty())
+            groups.emplace_back([&, i] {
+                if (!run(stripes[i]))
+                    ok = false;
+            });
+    }
+    if (!stripes[0].empty() && !run(stripes[0]))
+        ok = false;
+    for (auto &group : groups)
+        group.join();
+
+    if (direct)
+        buffers::Drop_Cache(in_fd);
+    ::close(in_fd);
+    // Without part 0 the journal is all a rerun has to resume from
+    if (ok && !full_header(file_id, splits, file, payload_len, size,
+                           set_flags, crcs, {}, part_flags))
+        ok = false;
+    if (log && ok)
+        log->Remove();
+    else if (log)
+        log->Checkpoint();
+    return ok.load();
+}
 
-    // Splitting logic
-    std::streampos starting_ptr = 0, end_ptr = 0;
+inline std::unique_ptr<journal::Journal>
+Open_Split_Journal(const std::string &file, const struct stat &st, int splits,
+                   bool compact, std::array<uint8_t, 5> &file_id) {
+    std::error_code ec;
+    std::string input = std::filesystem::absolute(file, ec).lexically_normal();
+    uint64_t hash = 14695981039346656037ull; // FNV-1a of the input's path
+    for (unsigned char c : input)
+        hash = (hash ^ c) * 1099511628211ull;
+    char name[40];
+    snprintf(name, sizeof(name), "/.pktcore-split-%016llx",
+             static_cast<unsigned long long>(hash));
+    std::string path = layout::Active().roots[0] + name;
+
+    std::string job = "split " + std::to_string(splits) +
+                      (compact ? " compact " : " standard ") +
+                      std::to_string(st.st_size) + " " +
+                      std::to_string(st.st_mtim.tv_sec) + "." +
+                      std::to_string(st.st_mtim.tv_nsec) + " " + input;
+    // The state is read back from disk: anything but the hex of an id is a
+    // damaged journal
+    auto id_of = [](const std::string &hex, std::array<uint8_t, 5> &id) {
+        if (hex.size() != 2 * id.size() ||
+            hex.find_first_not_of("0123456789ABCDEFabcdef") !=
+                std::string::npos)
+            return false;
+        for (size_t i = 0; i < id.size(); i++)
+            id[i] = static_cast<uint8_t>(
+                std::stoul(hex.substr(2 * i, 2), nullptr, 16));
+        return true;
+    };
+
+    // An interrupted split of another version of the file leaves packets
+    // nobody will finish; a set with a full header is whole and stays
+    std::string old_job, old_state;
+    std::map<uint32_t, uint32_t> old_done;
+    uint32_t old_last = 0;
+    std::array<uint8_t, 5> old_id{};
+    if (journal::Load(path, old_job, old_state, old_done, old_last) &&
+        old_job != job && id_of(old_state, old_id) &&
+        ::access(utils::Packet_Path(old_id, 0).c_str(), F_OK) != 0) {
+        int old_splits = std::atoi(old_job.c_str() + 6);
+        for (int p = 1; p <= old_splits; p++)
+            ::unlink(utils::Packet_Path(old_id, static_cast<uint32_t>(p)).c_str());
+    }
 
-    for (int i = 1; i < splits + 1; i++) {
-        if (leftover_bytes > 0) {
-            end_ptr += payload_len + 1;
-            leftover_bytes--;
-        } else {
-            end_ptr += payload_len;
-        }
+    auto log = std::make_unique<journal::Journal>();
+    std::string fresh = utils::Packet_File_Name(file_id, 0).substr(0, 10);
+    std::string state = fresh;
+    if (!log->Open(path, job, state,
+                   journal::Sync_Filesystems(layout::Active().roots)))
+        return nullptr;
+    if (!log->Resumed())
+        return log;
+    if (!id_of(state, file_id)) {
+        // Nothing to resume from: start over under the new id
+        std::cerr << "Ignoring damaged split journal: " << path << "\n";
+        log->Remove();
+        log = std::make_unique<journal::Journal>();
+        state = fresh;
+        if (!log->Open(path, job, state,
+                       journal::Sync_Filesystems(layout::Active().roots)) ||
+            log->Resumed())
+            return nullptr;
+        return log;
+    }
 
-        create_packet(file, file_id, i, starting_ptr, end_ptr);
-        starting_ptr = end_ptr;
+    // The packet journaled last may be where the crash hit: it is kept only
+    // when it reads back whole and with the journaled checksum
+    uint32_t last = log->Boundary();
+    auto done = log->Done().find(last);
+    if (done != log->Done().end()) {
+        header::Packet_Info info;
+        uint32_t crc = 0;
+        int fd = ::open(utils::Packet_Path(file_id, last).c_str(),
+                        O_RDONLY | O_CLOEXEC);
+        struct stat packet;
+        bool whole = fd >= 0 && header::Read_Packet_Header(fd, info) &&
+                     info.file_id == file_id && info.part == last &&
+                     fstat(fd, &packet) == 0 &&
+                     journal::Crc_Of(fd, info.header_len,
+                                     packet.st_size - info.header_len, crc) &&
+                     crc == done->second;
+        if (fd >= 0)
+            ::close(fd);
+        if (!whole)
+            log->Forget(last);
     }
+    return log;
 }
 
-void SPLITTER(const std::string &file) {
+inline bool Write_Hole_Packet(const std::array<uint8_t, 5> &file_id,
+                              uint32_t part, uint32_t len, bool compact) {
+    std::string fname = utils::Packet_Path(file_id, part);
+    int fd = -1;
+    if (layout::Prepare(fname))
+        fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    uint8_t head[header::MAX_PACKET_HEADER];
+    size_t head_len = header::Encode_Packet_Header(file_id, part, len, compact,
+                                                   head, header::PACKET_HOLE);
+    throttle::Charge(head_len);
+    bool ok = fd >= 0 &&
+              ::write(fd, head, head_len) == static_cast<ssize_t>(head_len);
+    if (fd >= 0)
+        ::close(fd);
+    if (!ok)
+        std::cerr << "Failed to create file: " << fname << "\n";
+    return ok;
+}
+
+bool SPLITTER() {
     // File selection
     std::vector<std::string> files = utils::FETCH_FILES(".");
+    std::string file = tui::SHOW_SELECT_FILES(files);
+    int splits = input_splits();
+
+    return SPLIT_FILE(file, splits);
+}
+
+bool SPLITTER(const std::string &file) {
     // Since the file is already passed in as a parameter, we skip file
     // selection
     int splits = input_splits();
 
-    // Generate unique file ID
-    auto file_id = utils::Genrate_File_ID();
+    return SPLIT_FILE(file, splits);
+}
 
-    // Get file size
-    auto size = utils::Get_File_Size(file);
-    std::cout << "File size: " << size << std::endl;
+bool SPLITTER(const std::string &file, int no_of_splits, size_t in_flight,
+              bool direct, bool compact) {
+    return SPLIT_FILE(file, no_of_splits, in_flight, direct, compact);
+}
 
-    // Calculate split size and leftover bytes
-    auto payload_len = size / splits;
-    auto leftover_bytes = size % splits;
+inline Stream_Splitter::Stream_Splitter(const std::string &name,
+                                        uint32_t packet_size, bool compact)
+    : name_(name), packet_size_(packet_size), compact_(compact),
+      file_id_(utils::Genrate_File_ID()) {}
 
-    // Create full header (split 0)
-    full_header(file_id, splits, file, payload_len, size);
+inline Stream_Splitter::~Stream_Splitter() {
+    if (fd_ >= 0)
+        ::close(fd_);
+}
 
-    // Splitting logic
-    std::streampos starting_ptr = 0, end_ptr = 0;
+inline void Stream_Splitter::Abort() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    for (uint32_t part = 0; part <= part_; part++)
+        ::unlink(utils::Packet_Path(file_id_, part).c_str());
+}
 
-    for (int i = 1; i <= splits; i++) {
-        if (leftover_bytes > 0) {
-            end_ptr += payload_len + 1;
-            leftover_bytes--;
-        } else {
-            end_ptr += payload_len;
+inline bool Stream_Splitter::Close_Packet() {
+    bool ok = true;
+    if (fill_ < packet_size_ && !compact_) {
+        // Short last packet: the header written up front claimed a full one
+        header::Mini_Header mini(file_id_, part_, fill_);
+        ok = ::pwrite(fd_, &mini, sizeof(mini), 0) ==
+             static_cast<ssize_t>(sizeof(mini));
+    }
+    ::close(fd_);
+    fd_ = -1;
+    fill_ = 0;
+    progress::Add(0, 1);
+    return ok;
+}
+
+inline bool Stream_Splitter::Feed(const uint8_t *data, size_t len) {
+    while (len > 0) {
+        if (fd_ < 0) {
+            std::string fname = utils::Packet_Path(file_id_, ++part_);
+            if (layout::Prepare(fname))
+                fd_ = ::open(fname.c_str(),
+                             O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd_ < 0) {
+                std::cerr << "Failed to create file: " << fname << "\n";
+                return false;
+            }
+            crcs_.push_back(0);
+            part_flags_.push_back(0);
+            uint8_t head[header::MAX_PACKET_HEADER];
+            size_t head_len = header::Encode_Packet_Header(
+                file_id_, part_, packet_size_, compact_, head);
+            if (::write(fd_, head, head_len) !=
+                static_cast<ssize_t>(head_len)) {
+                std::cerr << "Failed to write header: " << fname << "\n";
+                return false;
+            }
         }
 
-        create_packet(file, file_id, i, starting_ptr, end_ptr);
-        starting_ptr = end_ptr;
+        size_t chunk = std::min<size_t>(len, packet_size_ - fill_);
+        throttle::Charge(chunk);
+        ssize_t written;
+        {
+            throttle::Write_Timer timer;
+            written = ::write(fd_, data, chunk);
+        }
+        if (written <= 0) {
+            std::cerr << "Failed to write packet " << part_ << "\n";
+            return false;
+        }
+        crcs_[part_] = manifest::Crc32c(data, written, crcs_[part_]);
+        progress::Add(static_cast<uint64_t>(written));
+        data += written;
+        len -= static_cast<size_t>(written);
+        fill_ += static_cast<uint32_t>(written);
+        total_ += static_cast<uint64_t>(written);
+
+        if (fill_ == packet_size_ && !Close_Packet())
+            return false;
     }
+    return true;
 }
 
-void SPLITTER(const std::string &file, int no_of_splits) {
-    // File selection
-    std::vector<std::string> files = utils::FETCH_FILES(".");
-    // Since the file is already passed in as a parameter, we skip file
-    // selection
-    int splits = no_of_splits;
-
-    // Generate unique file ID
-    auto file_id = utils::Genrate_File_ID();
+inline bool Stream_Splitter::Skip(uint64_t len) {
+    static const uint8_t zeros[64 * 1024] = {};
+    while (len > 0) {
+        if (fd_ < 0 && len >= packet_size_) {
+            if (!Write_Hole_Packet(file_id_, ++part_, packet_size_, compact_))
+                return false;
+            crcs_.push_back(0);
+            part_flags_.push_back(header::PACKET_HOLE);
+            holes_ = true;
+            total_ += packet_size_;
+            progress::Add(packet_size_, 1);
+            len -= packet_size_;
+            continue;
+        }
+        // Up to the end of the open packet, or a hole shorter than a packet
+        uint64_t fill = fd_ < 0 ? len : packet_size_ - fill_;
+        size_t chunk = static_cast<size_t>(
+            std::min<uint64_t>({len, fill, sizeof(zeros)}));
+        if (!Feed(zeros, chunk))
+            return false;
+        len -= chunk;
+    }
+    return true;
+}
 
-    // Get file size
-    auto size = utils::Get_File_Size(file);
-    std::cout << "File size: " << size << std::endl;
+inline bool Stream_Splitter::Finish(uint8_t flags,
+                                    const std::vector<uint8_t> &entries) {
+    if (fd_ >= 0 && !Close_Packet()) {
+        std::cerr << "Failed to finalize packet " << part_ << "\n";
+        return false;
+    }
+    if (compact_)
+        flags |= header::FLAG_COMPACT;
+    if (holes_)
+        flags |= header::FLAG_SPARSE;
+    return full_header(file_id_, part_, name_, packet_size_, total_, flags,
+                       crcs_, entries,
+                       holes_ ? part_flags_ : std::vector<uint8_t>());
+}
 
-    // Calculate split size and leftover bytes
-    auto payload_len = size / splits;
-    auto leftover_bytes = size % splits;
+inline bool SPLITTER_STREAM(int fd, const std::string &name,
+                            uint32_t packet_size, bool compact) {
+    if (packet_size == 0) {
+        std::cerr << "Packet size must be greater than zero\n";
+        return false;
+    }
 
-    // Create full header (split 0)
-    full_header(file_id, splits, file, payload_len, size);
+    Stream_Splitter stream(name, packet_size, compact);
+    std::vector<uint8_t> buffer(1024 * 1024);
 
-    // Splitting logic
-    std::streampos starting_ptr = 0, end_ptr = 0;
+    // Only a regular input tells how much is coming
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        uint64_t left = static_cast<uint64_t>(std::max<off_t>(
+            st.st_size - std::max<off_t>(::lseek(fd, 0, SEEK_CUR), 0), 0));
+        progress::Expect(left, (left + packet_size - 1) / packet_size);
+    }
 
-    for (int i = 1; i <= splits; i++) {
-        if (leftover_bytes > 0) {
-            end_ptr += payload_len + 1;
-            leftover_bytes--;
-        } else {
-            end_ptr += payload_len;
+    // A sparse file is read extent by extent, the holes between are skipped
+    if (sparse::Has_Holes(fd) && fstat(fd, &st) == 0) {
+        uint64_t size = static_cast<uint64_t>(st.st_size);
+        uint64_t pos = static_cast<uint64_t>(std::max<off_t>(
+            ::lseek(fd, 0, SEEK_CUR), 0));
+        uint64_t start, end;
+        while (pos < size) {
+            if (!sparse::Next_Data(fd, pos, size, start, end))
+                start = end = size;
+            if (!stream.Skip(start - pos))
+                return false;
+            for (pos = start; pos < end;) {
+                size_t want = static_cast<size_t>(
+                    std::min<uint64_t>(buffer.size(), end - pos));
+                ssize_t got = ::pread(fd, buffer.data(), want, pos);
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got <= 0) {
+                    std::cerr << "Failed to read input stream\n";
+                    return false;
+                }
+                if (!stream.Feed(buffer.data(), static_cast<size_t>(got)))
+                    return false;
+                pos += static_cast<uint64_t>(got);
+            }
         }
+        return stream.Finish();
+    }
 
-        create_packet(file, file_id, i, starting_ptr, end_ptr);
-        starting_ptr = end_ptr;
+    while (true) {
+        ssize_t got = ::read(fd, buffer.data(), buffer.size());
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Failed to read input stream\n";
+            return false;
+        }
+        if (got == 0)
+            break;
+        if (!stream.Feed(buffer.data(), static_cast<size_t>(got)))
+            return false;
     }
+    return stream.Finish();
 }
 } // namespace splitter
@@ -0,0 +1,215 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+/*
+ * Throttle module namespace: keeps a background job's I/O within bounds on a
+ * shared host. Two token buckets, one for bytes per second and one for
+ * operations per second, are charged by the shared I/O paths (the pipeline
+ * engine, packet writes, range copies, Fetch_Bytes / Append_Bytes); a caller
+ * that overdraws a bucket sleeps until the debt is paid, so concurrent I/O
+ * groups share one budget. With a latency target set, the byte rate also
+ * backs off (halving) while writes take longer than the target and recovers
+ * (by a quarter per window) once they are fast again.
+ * The limits are per process, i.e. per job, set from the command line.
+ */
+namespace throttle {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr double BURST = 0.1;             // seconds of tokens a bucket holds
+constexpr double WINDOW = 0.25;           // seconds between backoff decisions
+constexpr double MIN_RATE = 1024 * 1024;  // backoff floor, bytes per second
+constexpr size_t SLICE = 1024 * 1024;     // largest transfer while limited
+
+struct Limits {
+    uint64_t bytes_per_sec = 0; // 0: unlimited
+    uint64_t ops_per_sec = 0;   // 0: unlimited
+    double latency_target = 0;  // seconds per write, 0: no backoff
+};
+
+/*
+ * Bucket: tokens refill at a fixed rate up to BURST seconds worth. Taking
+ * more than there is leaves a debt, paid by the caller waiting.
+ */
+class Bucket {
+  public:
+    /*
+     * - @rate : tokens per second, 0 for unlimited
+     */
+    void Set_Rate(double rate);
+
+    /*
+     * Takes n tokens.
+     * - @return : seconds the caller must wait before using them
+     */
+    double Take(double n, Clock::time_point now);
+
+  private:
+    double rate_ = 0;
+    double tokens_ = 0;
+    Clock::time_point last_ = Clock::now();
+};
+
+class Limiter {
+  public:
+    void Configure(const Limits &limits);
+
+    bool Enabled() const { return enabled_; }
+
+    /*
+     * Largest piece of a len byte transfer to do at once, so a big copy is
+     * charged a slice at a time instead of in one burst.
+     */
+    size_t Slice(size_t len) const {
+        return enabled_ ? std::min(len, SLICE) : len;
+    }
+
+    /*
+     * Charges I/O about to be done, waiting while the budget is overdrawn.
+     * - @bytes : bytes transferred
+     * - @ops   : I/O operations
+     */
+    void Charge(uint64_t bytes, uint32_t ops = 1);
+
+    /*
+     * Reports how long a write took, for the adaptive backoff.
+     */
+    void Observe(double seconds);
+
+  private:
+    void Apply_Locked();
+
+    std::atomic<bool> enabled_{false};
+    std::mutex lock_;
+    Limits limits_;
+    Bucket bytes_, ops_;
+
+    // Adaptive backoff: byte rate cap while writes are slow, 0 for none
+    double cap_ = 0;
+    Clock::time_point window_start_ = Clock::now();
+    uint64_t window_bytes_ = 0;
+    double window_latency_ = 0;
+    size_t window_writes_ = 0;
+};
+
+/*
+ * Limiter of this process. Unlimited until configured.
+ */
+inline Limiter &Active();
+
+inline void Charge(uint64_t bytes, uint32_t ops = 1) {
+    Active().Charge(bytes, ops);
+}
+
+/*
+ * Write_Timer: reports how long the writes in its scope took.
+ */
+class Write_Timer {
+  public:
+    ~Write_Timer() {
+        Active().Observe(
+            std::chrono::duration<double>(Clock::now() - start_).count());
+    }
+
+  private:
+    Clock::time_point start_ = Clock::now();
+};
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+inline void Bucket::Set_Rate(double rate) {
+    rate_ = rate;
+    tokens_ = std::min(tokens_, rate * BURST);
+}
+
+inline double Bucket::Take(double n, Clock::time_point now) {
+    if (rate_ <= 0)
+        return 0;
+    double elapsed = std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+    tokens_ = std::min(rate_ * BURST, tokens_ + rate_ * elapsed) - n;
+    return tokens_ >= 0 ? 0 : -tokens_ / rate_;
+}
+
+inline void Limiter::Configure(const Limits &limits) {
+    std::lock_guard<std::mutex> guard(lock_);
+    limits_ = limits;
+    cap_ = 0;
+    window_start_ = Clock::now();
+    window_bytes_ = 0;
+    window_latency_ = 0;
+    window_writes_ = 0;
+    ops_.Set_Rate(static_cast<double>(limits.ops_per_sec));
+    Apply_Locked();
+    enabled_ = limits.bytes_per_sec > 0 || limits.ops_per_sec > 0 ||
+               limits.latency_target > 0;
+}
+
+inline void Limiter::Apply_Locked() {
+    double rate = static_cast<double>(limits_.bytes_per_sec);
+    if (cap_ > 0)
+        rate = rate > 0 ? std::min(rate, cap_) : cap_;
+    bytes_.Set_Rate(rate);
+}
+
+inline void Limiter::Charge(uint64_t bytes, uint32_t ops) {
+    if (!enabled_)
+        return;
+    double wait;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        Clock::time_point now = Clock::now();
+        wait = std::max(bytes_.Take(static_cast<double>(bytes), now),
+                        ops_.Take(ops, now));
+        window_bytes_ += bytes;
+    }
+    if (wait > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+}
+
+inline void Limiter::Observe(double seconds) {
+    if (!enabled_)
+        return;
+    // limits_ is written by Configure under the lock, even mid-transfer
+    std::lock_guard<std::mutex> guard(lock_);
+    if (limits_.latency_target <= 0)
+        return;
+    window_latency_ += seconds;
+    window_writes_++;
+    Clock::time_point now = Clock::now();
+    double elapsed = std::chrono::duration<double>(now - window_start_).count();
+    if (elapsed < WINDOW)
+        return;
+
+    // Slow writes: halve what got through; fast ones: give a quarter back,
+    // and drop the cap once it no longer holds anything back
+    double measured = window_bytes_ / elapsed;
+    if (window_latency_ / window_writes_ > limits_.latency_target) {
+        double base = cap_ > 0 ? std::min(cap_, measured) : measured;
+        cap_ = std::max(MIN_RATE, base / 2);
+    } else if (cap_ > 0) {
+        cap_ *= 1.25;
+        if (cap_ > 2 * measured ||
+            (limits_.bytes_per_sec > 0 && cap_ >= limits_.bytes_per_sec))
+            cap_ = 0;
+    }
+    Apply_Locked();
+    window_start_ = now;
+    window_bytes_ = 0;
+    window_latency_ = 0;
+    window_writes_ = 0;
+}
+
+inline Limiter &Active() {
+    static Limiter limiter;
+    return limiter;
+}
+} // namespace throttle
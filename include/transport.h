@@ -0,0 +1,701 @@
+#pragma once
+#include "full_header.h"
+#include "mini_header.h"
+#include "pkt_utils.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <climits>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+/*
+ * Transport module namespace: sends a file as packets straight over the
+ * network to a remote combiner, with no packet files on either side.
+ * Packets keep their on-disk identity: a Full_Header datagram/record starts
+ * the transfer and every payload travels behind its Mini_Header, so the
+ * receiver places it with the same Packet_Start math the combiner uses.
+ *
+ * UDP: payloads are batched with sendmmsg (and UDP GSO where the kernel has
+ *      it) and collected with recvmmsg. The receiver keeps a completion
+ *      bitmap and answers status requests with the missing ranges, which
+ *      the sender retransmits until the receiver reports completion.
+ * TCP: Mini_Header then the payload via sendfile for every packet.
+ */
+namespace transport {
+
+/*
+ * Sends a file to a receiver.
+ * - @file         : file to send
+ * - @address      : HOST:PORT of the receiver
+ * - @payload_size : payload bytes per packet
+ */
+inline bool SEND_UDP(const std::string &file, const std::string &address,
+                     uint32_t payload_size);
+inline bool SEND_TCP(const std::string &file, const std::string &address,
+                     uint32_t payload_size);
+
+/*
+ * Receives one file and writes it to output (the original filename when
+ * output is empty).
+ * - @address : [HOST:]PORT to listen on
+ */
+inline bool RECV_UDP(const std::string &address, const std::string &output);
+inline bool RECV_TCP(const std::string &address, const std::string &output);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+
+// Default UDP payload: one Mini_Header and its payload fit a 1400 byte
+// datagram, below the usual Ethernet MTU
+constexpr uint32_t DEFAULT_UDP_PAYLOAD = 1400 - sizeof(header::Mini_Header);
+constexpr size_t UDP_BATCH = 64;        // datagrams per sendmmsg/recvmmsg
+constexpr size_t MAX_DATAGRAM = 65536;  // receive buffer per datagram
+constexpr size_t GSO_MAX_BYTES = 65000; // UDP GSO super-datagram limit
+constexpr int SOCKET_BUFFER = 8 * 1024 * 1024;
+
+/*
+ * Control datagrams: "PCTL", file_id, type, range count, then
+ * count * (first part, last part).
+ */
+enum Control_Type : uint8_t {
+    CTRL_HELLO_ACK = 1, // receiver got the full header
+    CTRL_STATUS = 2,    // sender asks what is missing
+    CTRL_NACK = 3,      // receiver lists missing ranges
+    CTRL_COMPLETE = 4,  // receiver has every packet
+};
+constexpr size_t CTRL_HEADER = 4 + 5 + 1 + 4;
+constexpr size_t CTRL_MAX_RANGES = (1400 - CTRL_HEADER) / 8;
+
+inline std::vector<uint8_t>
+Control(const std::array<uint8_t, 5> &file_id, Control_Type type,
+        const std::vector<std::pair<uint32_t, uint32_t>> &ranges = {}) {
+    std::vector<uint8_t> msg(CTRL_HEADER + ranges.size() * 8);
+    std::memcpy(msg.data(), "PCTL", 4);
+    std::memcpy(msg.data() + 4, file_id.data(), 5);
+    msg[9] = type;
+    uint32_t count = static_cast<uint32_t>(ranges.size());
+    std::memcpy(msg.data() + 10, &count, 4);
+    for (size_t i = 0; i < ranges.size(); i++) {
+        std::memcpy(msg.data() + CTRL_HEADER + i * 8, &ranges[i].first, 4);
+        std::memcpy(msg.data() + CTRL_HEADER + i * 8 + 4, &ranges[i].second, 4);
+    }
+    return msg;
+}
+
+inline bool Is_Control(const uint8_t *buf, size_t len,
+                       const std::array<uint8_t, 5> &file_id) {
+    return len >= CTRL_HEADER && std::memcmp(buf, "PCTL", 4) == 0 &&
+           std::memcmp(buf + 4, file_id.data(), 5) == 0;
+}
+
+/*
+ * Resolves [HOST:]PORT (IPv6 hosts in brackets). Without a host, a passive
+ * lookup gives the wildcard address to listen on.
+ */
+inline addrinfo *Resolve(const std::string &address, int socktype,
+                         bool passive) {
+    std::string host, port = address;
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos) {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo *result = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints,
+                    &result) != 0) {
+        std::cerr << "Could not resolve address: " << address << "\n";
+        return nullptr;
+    }
+    return result;
+}
+
+/*
+ * Opens a socket connected to (or, when listening, bound to) an address.
+ */
+inline int Open_Socket(const std::string &address, int socktype,
+                       bool listening) {
+    addrinfo *info = Resolve(address, socktype, listening);
+    int fd = -1;
+    for (addrinfo *ai = info; ai && fd < 0; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                      ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        bool ok = listening ? ::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0
+                            : ::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+        if (ok && listening && socktype == SOCK_STREAM)
+            ok = ::listen(fd, 1) == 0;
+        if (!ok) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    if (info)
+        freeaddrinfo(info);
+    if (fd < 0)
+        std::cerr << "Could not " << (listening ? "listen on " : "connect to ")
+                  << address << "\n";
+    return fd;
+}
+
+inline bool Write_All(int fd, const void *data, size_t len, int flags = 0) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    while (len > 0) {
+        ssize_t w = ::send(fd, p, len, flags | MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return false;
+        p += w;
+        len -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+inline bool Read_All(int fd, void *data, size_t len) {
+    uint8_t *p = static_cast<uint8_t *>(data);
+    while (len > 0) {
+        ssize_t got = ::recv(fd, p, len, MSG_WAITALL);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        p += got;
+        len -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+/*
+ * Opens the file to send and describes it with a fixed payload full header.
+ */
+inline int Open_Source(const std::string &file, uint32_t payload_size,
+                       header::Full_Header &full) {
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::cerr << "Could not open file: " << file << "\n";
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    uint32_t packets =
+        static_cast<uint32_t>((size + payload_size - 1) / payload_size);
+    full = header::FULL_HEADER(utils::Genrate_File_ID(), 0, packets, 0,
+                               payload_size, size,
+                               std::filesystem::path(file).filename().string());
+    return fd;
+}
+
+/*
+ * Creates the output of a receiver once the full header is known. Without
+ * an output path the sender's file name is used, in the current directory.
+ */
+inline int Open_Output(const header::Full_Header &full,
+                       const std::string &output) {
+    std::string name = output;
+    if (name.empty()) {
+        std::string sent(reinterpret_cast<const char *>(full.filename.data()),
+                         full.filename.size());
+        name = utils::Safe_File_Name(sent.c_str()); // drop the zero padding
+        if (name.empty()) {
+            std::cerr << "Sender gave no usable file name, pass -o PATH\n";
+            return -1;
+        }
+    }
+    int fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd < 0 || ::ftruncate(fd, header::File_Size_Of(full)) != 0) {
+        std::cerr << "Failed to create file: " << name << "\n";
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Udp_Sender: sends a list of parts in sendmmsg batches. With GSO, runs of
+ * full packets go out as one super-datagram per message and the kernel cuts
+ * them into header + payload datagrams.
+ */
+class Udp_Sender {
+  public:
+    Udp_Sender(int sock, int file_fd, const header::Full_Header &full)
+        : sock_(sock), file_fd_(file_fd), full_(full),
+          payload_(header::Payload_Size_Of(full)),
+          segment_(sizeof(header::Mini_Header) + payload_) {
+#ifdef UDP_SEGMENT
+        segments_ = std::min<size_t>(GSO_MAX_BYTES / segment_, 64);
+        gso_ = segments_ >= 2;
+#endif
+        buffer_.resize(UDP_BATCH * payload_);
+    }
+
+    bool Send(const std::vector<uint32_t> &parts) {
+        size_t per_batch = gso_ ? UDP_BATCH * segments_ : UDP_BATCH;
+        buffer_.resize(per_batch * payload_);
+        for (size_t first = 0; first < parts.size(); first += per_batch) {
+            size_t last = std::min(first + per_batch, parts.size());
+            if (!Send_Batch(parts, first, last))
+                return false;
+        }
+        return true;
+    }
+
+  private:
+    bool Send_Batch(const std::vector<uint32_t> &parts, size_t first,
+                    size_t last) {
+        size_t count = last - first;
+        headers_.clear();
+        iovs_.assign(count * 2, iovec{});
+        for (size_t i = 0; i < count; i++) {
+            uint32_t part = parts[first + i];
+            uint64_t start = header::Packet_Start(full_, part);
+            uint32_t len = static_cast<uint32_t>(
+                header::Packet_Start(full_, part + 1) - start);
+            uint8_t *payload = buffer_.data() + i * payload_;
+            if (::pread(file_fd_, payload, len, start) !=
+                static_cast<ssize_t>(len)) {
+                std::cerr << "Failed to read packet " << part << "\n";
+                return false;
+            }
+            headers_.emplace_back(full_.file_id, part, len);
+            iovs_[2 * i] = {nullptr, sizeof(header::Mini_Header)};
+            iovs_[2 * i + 1] = {payload, len};
+        }
+        for (size_t i = 0; i < count; i++)
+            iovs_[2 * i].iov_base = &headers_[i];
+
+        // Group the datagrams into messages
+        msgs_.clear();
+        size_t per_msg = gso_ ? segments_ : 1;
+        for (size_t i = 0; i < count;) {
+            size_t n = 1;
+            // A GSO message may only end with a short segment
+            while (gso_ && n < per_msg && i + n < count &&
+                   iovs_[2 * (i + n - 1) + 1].iov_len == payload_)
+                n++;
+            mmsghdr m{};
+            m.msg_hdr.msg_iov = &iovs_[2 * i];
+            m.msg_hdr.msg_iovlen = 2 * n;
+            msgs_.push_back(m);
+            i += n;
+        }
+        control_.assign(msgs_.size() * CMSG_SPACE(sizeof(uint16_t)), 0);
+#ifdef UDP_SEGMENT
+        if (gso_) {
+            for (size_t i = 0; i < msgs_.size(); i++) {
+                msghdr &h = msgs_[i].msg_hdr;
+                h.msg_control = control_.data() + i * CMSG_SPACE(sizeof(uint16_t));
+                h.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsghdr *cm = CMSG_FIRSTHDR(&h);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment = static_cast<uint16_t>(segment_);
+                std::memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+            }
+        }
+#endif
+
+        for (size_t sent = 0; sent < msgs_.size();) {
+            int n = ::sendmmsg(sock_, msgs_.data() + sent,
+                               static_cast<unsigned>(msgs_.size() - sent), 0);
+            if (n < 0 && (errno == EINTR || errno == ENOBUFS ||
+                          errno == EAGAIN || errno == ECONNREFUSED))
+                continue; // lost datagrams come back as NACKs
+            if (n < 0 && gso_ && (errno == EIO || errno == EINVAL ||
+                                  errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+                gso_ = false; // no GSO on this path, retry datagram by datagram
+                return Send_Batch(parts, first, last);
+            }
+            if (n < 0) {
+                std::cerr << "sendmmsg failed: " << strerror(errno) << "\n";
+                return false;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    int sock_;
+    int file_fd_;
+    header::Full_Header full_;
+    size_t payload_;
+    size_t segment_;
+    size_t segments_ = 1;
+    bool gso_ = false;
+
+    std::vector<uint8_t> buffer_;
+    std::vector<header::Mini_Header> headers_;
+    std::vector<iovec> iovs_;
+    std::vector<mmsghdr> msgs_;
+    std::vector<uint8_t> control_;
+};
+
+inline bool SEND_UDP(const std::string &file, const std::string &address,
+                     uint32_t payload_size) {
+    if (payload_size == 0 ||
+        payload_size + sizeof(header::Mini_Header) > MAX_DATAGRAM - 64) {
+        std::cerr << "UDP payload size must be between 1 and "
+                  << MAX_DATAGRAM - 64 - sizeof(header::Mini_Header) << "\n";
+        return false;
+    }
+
+    header::Full_Header full;
+    int file_fd = Open_Source(file, payload_size, full);
+    if (file_fd < 0)
+        return false;
+    int sock = Open_Socket(address, SOCK_DGRAM, false);
+    if (sock < 0) {
+        ::close(file_fd);
+        return false;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &SOCKET_BUFFER,
+               sizeof(SOCKET_BUFFER));
+
+    uint8_t reply[1500];
+    auto await = [&](int timeout_ms) -> ssize_t {
+        pollfd p{sock, POLLIN, 0};
+        if (::poll(&p, 1, timeout_ms) <= 0)
+            return -1;
+        ssize_t got = ::recv(sock, reply, sizeof(reply), 0);
+        return Is_Control(reply, got > 0 ? got : 0, full.file_id) ? got : -1;
+    };
+
+    // Handshake: the receiver must have the full header before any payload
+    bool accepted = false;
+    for (int attempt = 0; attempt < 50 && !accepted; attempt++) {
+        ::send(sock, &full, sizeof(full), 0);
+        ssize_t got = await(200);
+        accepted = got > 0 && reply[9] == CTRL_HELLO_ACK;
+    }
+
+    Udp_Sender sender(sock, file_fd, full);
+    std::vector<uint32_t> todo;
+    for (uint32_t i = 1; accepted && i <= header::Packets_Of(full); i++)
+        todo.push_back(i);
+
+    bool complete = false;
+    int silent = 0;
+    while (accepted && !complete && silent < 50) {
+        if (!todo.empty() && !sender.Send(todo))
+            break;
+        todo.clear();
+
+        auto status = Control(full.file_id, CTRL_STATUS);
+        ::send(sock, status.data(), status.size(), 0);
+        ssize_t got = await(200);
+        if (got < 0) {
+            silent++;
+            continue;
+        }
+        silent = 0;
+
+        // Gather every NACK the receiver sent for this status request
+        while (got > 0) {
+            if (reply[9] == CTRL_COMPLETE) {
+                complete = true;
+                break;
+            }
+            uint32_t count;
+            std::memcpy(&count, reply + 10, 4);
+            for (uint32_t r = 0; reply[9] == CTRL_NACK && r < count &&
+                                 CTRL_HEADER + r * 8 + 8 <= (size_t)got;
+                 r++) {
+                uint32_t lo, hi;
+                std::memcpy(&lo, reply + CTRL_HEADER + r * 8, 4);
+                std::memcpy(&hi, reply + CTRL_HEADER + r * 8 + 4, 4);
+                for (uint32_t part = lo; part <= hi && part != 0; part++)
+                    todo.push_back(part);
+            }
+            got = await(20);
+        }
+        std::sort(todo.begin(), todo.end());
+        todo.erase(std::unique(todo.begin(), todo.end()), todo.end());
+    }
+
+    ::close(sock);
+    ::close(file_fd);
+    if (!complete)
+        std::cerr << "Receiver did not confirm the transfer\n";
+    return complete;
+}
+
+inline bool RECV_UDP(const std::string &address, const std::string &output) {
+    int sock = Open_Socket(address, SOCK_DGRAM, true);
+    if (sock < 0)
+        return false;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER,
+               sizeof(SOCKET_BUFFER));
+
+    std::vector<uint8_t> buffers(UDP_BATCH * MAX_DATAGRAM);
+    std::vector<iovec> iovs(UDP_BATCH);
+    std::vector<mmsghdr> msgs(UDP_BATCH);
+    std::vector<sockaddr_storage> peers(UDP_BATCH);
+
+    bool have_header = false, complete = false;
+    header::Full_Header full{};
+    uint32_t packets = 0, received = 0;
+    std::vector<uint64_t> bitmap;
+    int out_fd = -1;
+
+    auto reply = [&](const sockaddr_storage &peer, socklen_t peer_len,
+                     const std::vector<uint8_t> &msg) {
+        ::sendto(sock, msg.data(), msg.size(), 0,
+                 reinterpret_cast<const sockaddr *>(&peer), peer_len);
+    };
+    auto has = [&](uint32_t part) {
+        return (bitmap[part / 64] >> (part % 64)) & 1;
+    };
+
+    while (true) {
+        pollfd p{sock, POLLIN, 0};
+        // Once complete, linger a little to answer a lost COMPLETE again
+        int timeout = complete ? 1000 : have_header ? 30000 : -1;
+        if (::poll(&p, 1, timeout) <= 0)
+            break;
+
+        for (size_t i = 0; i < UDP_BATCH; i++) {
+            iovs[i] = {buffers.data() + i * MAX_DATAGRAM, MAX_DATAGRAM};
+            msgs[i] = mmsghdr{};
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &peers[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+        }
+        int n = ::recvmmsg(sock, msgs.data(), UDP_BATCH, MSG_DONTWAIT, nullptr);
+        if (n <= 0)
+            continue;
+
+        // Payloads that follow each other in the file are written together
+        std::vector<iovec> run;
+        uint64_t run_start = 0, run_end = 0;
+        auto flush = [&] {
+            if (!run.empty() &&
+                ::pwritev(out_fd, run.data(), static_cast<int>(run.size()),
+                          run_start) < 0)
+                std::cerr << "Failed to write output\n";
+            run.clear();
+        };
+
+        for (int i = 0; i < n; i++) {
+            const uint8_t *buf = buffers.data() + i * MAX_DATAGRAM;
+            size_t len = msgs[i].msg_len;
+            const sockaddr_storage &peer = peers[i];
+            socklen_t peer_len = msgs[i].msg_hdr.msg_namelen;
+
+            if (len >= sizeof(header::Full_Header) &&
+                std::memcmp(buf, "PCORE", 5) == 0 &&
+                buf[10] == 0 && buf[11] == 0 && buf[12] == 0 && buf[13] == 0) {
+                header::Full_Header incoming;
+                std::memcpy(&incoming, buf, sizeof(incoming));
+                if (!have_header) {
+                    full = incoming;
+                    out_fd = Open_Output(full, output);
+                    if (out_fd < 0)
+                        return false;
+                    packets = header::Packets_Of(full);
+                    bitmap.assign(packets / 64 + 1, 0);
+                    have_header = true;
+                    complete = packets == 0;
+                }
+                if (incoming.file_id == full.file_id)
+                    reply(peer, peer_len, Control(full.file_id, CTRL_HELLO_ACK));
+                continue;
+            }
+            if (!have_header)
+                continue;
+
+            if (Is_Control(buf, len, full.file_id) && buf[9] == CTRL_STATUS) {
+                flush();
+                if (received == packets) {
+                    reply(peer, peer_len, Control(full.file_id, CTRL_COMPLETE));
+                    continue;
+                }
+                std::vector<std::pair<uint32_t, uint32_t>> missing;
+                for (uint32_t part = 1; part <= packets; part++) {
+                    if (has(part))
+                        continue;
+                    uint32_t lo = part;
+                    while (part < packets && !has(part + 1))
+                        part++;
+                    missing.push_back({lo, part});
+                    if (missing.size() == CTRL_MAX_RANGES) {
+                        reply(peer, peer_len,
+                              Control(full.file_id, CTRL_NACK, missing));
+                        missing.clear();
+                    }
+                }
+                if (!missing.empty())
+                    reply(peer, peer_len, Control(full.file_id, CTRL_NACK, missing));
+                continue;
+            }
+
+            if (len < sizeof(header::Mini_Header) ||
+                std::memcmp(buf, "PCORE", 5) != 0 ||
+                std::memcmp(buf + 5, full.file_id.data(), 5) != 0)
+                continue;
+            uint32_t part, payload_len;
+            part = header::Mini_Fields::Part::Get<uint32_t>(buf);
+            payload_len = header::Mini_Fields::Payload::Get<uint32_t>(buf);
+            if (part == 0 || part > packets || has(part))
+                continue;
+            uint64_t start = header::Packet_Start(full, part);
+            if (payload_len != header::Packet_Start(full, part + 1) - start ||
+                payload_len != len - sizeof(header::Mini_Header))
+                continue;
+
+            if (run.empty() || start != run_end || run.size() == IOV_MAX) {
+                flush();
+                run_start = start;
+            }
+            run.push_back({const_cast<uint8_t *>(buf) + sizeof(header::Mini_Header),
+                           payload_len});
+            run_end = start + payload_len;
+            bitmap[part / 64] |= uint64_t(1) << (part % 64);
+            received++;
+        }
+        flush();
+        if (have_header && received == packets)
+            complete = true;
+    }
+
+    if (out_fd >= 0)
+        ::close(out_fd);
+    ::close(sock);
+    if (!complete)
+        std::cerr << "Transfer incomplete: " << received << " of " << packets
+                  << " packets\n";
+    return complete;
+}
+
+inline bool SEND_TCP(const std::string &file, const std::string &address,
+                     uint32_t payload_size) {
+    if (payload_size == 0) {
+        std::cerr << "Packet size must be greater than zero\n";
+        return false;
+    }
+    header::Full_Header full;
+    int file_fd = Open_Source(file, payload_size, full);
+    if (file_fd < 0)
+        return false;
+    int sock = Open_Socket(address, SOCK_STREAM, false);
+    if (sock < 0) {
+        ::close(file_fd);
+        return false;
+    }
+
+    bool ok = Write_All(sock, &full, sizeof(full), MSG_MORE);
+    for (uint32_t part = 1; ok && part <= header::Packets_Of(full); part++) {
+        off_t start = header::Packet_Start(full, part);
+        size_t len = header::Packet_Start(full, part + 1) - start;
+        header::Mini_Header mini(full.file_id, part, len);
+        ok = Write_All(sock, &mini, sizeof(mini), MSG_MORE);
+
+        while (ok && len > 0) {
+#ifdef __linux__
+            ssize_t moved = ::sendfile(sock, file_fd, &start, len);
+#else
+            ssize_t moved = -1;
+            errno = ENOSYS;
+#endif
+            if (moved < 0 && errno == EINTR)
+                continue;
+            if (moved <= 0) {
+                // No sendfile: copy through a buffer
+                std::vector<uint8_t> buf(len);
+                ok = ::pread(file_fd, buf.data(), len, start) ==
+                         static_cast<ssize_t>(len) &&
+                     Write_All(sock, buf.data(), len);
+                break;
+            }
+            len -= static_cast<size_t>(moved);
+        }
+    }
+
+    // The receiver answers one byte once everything is on its disk
+    char ack = 0;
+    ::shutdown(sock, SHUT_WR);
+    ok = ok && ::recv(sock, &ack, 1, 0) == 1 && ack == 'K';
+    ::close(sock);
+    ::close(file_fd);
+    if (!ok)
+        std::cerr << "Transfer failed\n";
+    return ok;
+}
+
+inline bool RECV_TCP(const std::string &address, const std::string &output) {
+    int listener = Open_Socket(address, SOCK_STREAM, true);
+    if (listener < 0)
+        return false;
+    int sock = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    ::close(listener);
+    if (sock < 0)
+        return false;
+
+    header::Full_Header full;
+    bool ok = Read_All(sock, &full, sizeof(full)) &&
+              std::memcmp(full.PKTCORE.data(), "PCORE", 5) == 0;
+    int out_fd = ok ? Open_Output(full, output) : -1;
+    ok = out_fd >= 0;
+
+    std::vector<uint8_t> buffer;
+    for (uint32_t i = 1; ok && i <= header::Packets_Of(full); i++) {
+        header::Mini_Header mini(full.file_id, 0, 0);
+        ok = Read_All(sock, &mini, sizeof(mini)) && mini.file_id == full.file_id;
+        uint32_t part = header::Part_Of(mini);
+        uint32_t len = header::Payload_Len_Of(mini);
+        ok = ok && part >= 1 && part <= header::Packets_Of(full);
+        if (!ok)
+            break;
+
+        uint64_t start = header::Packet_Start(full, part);
+        ok = len == header::Packet_Start(full, part + 1) - start;
+        buffer.resize(len);
+        ok = ok && Read_All(sock, buffer.data(), len) &&
+             ::pwrite(out_fd, buffer.data(), len, start) ==
+                 static_cast<ssize_t>(len);
+    }
+
+    if (ok)
+        ok = Write_All(sock, "K", 1);
+    if (out_fd >= 0)
+        ::close(out_fd);
+    ::close(sock);
+    if (!ok)
+        std::cerr << "Transfer failed\n";
+    return ok;
+}
+} // namespace transport
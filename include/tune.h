@@ -0,0 +1,423 @@
+#pragma once
+#include "buffer_pool.h"
+#include "combiner.h"
+#include "layout.h"
+#include "manifest.h"
+#include "pkt_utils.h"
+#include "splitter.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Tune module namespace: finds the split and combine settings that run
+ * fastest on the drive holding the packet directory. Too few packets
+ * serialize the work and too many drown in per-file overhead, and where the
+ * balance lies depends on the drive, so `tune` writes a sample file there and
+ * runs short split and combine trials over packet sizes, in-flight depths
+ * and buffered vs direct I/O. The winners are stored per device in the
+ * user's settings file; `split <file>` without a count, and `combine`
+ * without --in-flight, use them.
+ */
+namespace tune {
+
+constexpr uint64_t DEFAULT_SAMPLE = 64ull * 1024 * 1024;
+
+/*
+ * Settings of one device. The defaults are used where nothing was tuned.
+ */
+struct Settings {
+    uint32_t packet_size = 4 * 1024 * 1024;
+    size_t split_in_flight = 16;
+    bool split_direct = false;
+    size_t combine_in_flight = 16;
+    bool combine_direct = false;
+};
+
+/*
+ * Settings file: $PKTCORE_TUNE, else $XDG_CONFIG_HOME/pktcore/tune, else
+ * ~/.config/pktcore/tune.
+ */
+inline std::string Settings_Path();
+
+/*
+ * Device a directory lives on, as "major:minor" (empty if it cannot be
+ * stat'ed).
+ */
+inline std::string Device_Of(const std::string &dir);
+
+/*
+ * Reads the tuned settings of the device holding a directory.
+ * - @return : false when the device was never tuned (found is untouched)
+ */
+inline bool Load(const std::string &dir, Settings &found);
+
+/*
+ * Stores the settings of the device holding a directory, replacing the
+ * ones tuned before.
+ */
+inline bool Save(const std::string &dir, const Settings &best);
+
+/*
+ * Packets to split a file of `size` bytes into so that none carries more
+ * than packet_size bytes.
+ */
+inline int Splits_For(uint64_t size, uint32_t packet_size);
+
+/*
+ * Runs the trials in the first packet directory and saves the winners.
+ * Only the device of that directory gets settings; split and combine apply
+ * them to every directory of a striped layout.
+ * - @sample_bytes : size of the sample file the trials split and combine
+ */
+inline bool TUNE(uint64_t sample_bytes = DEFAULT_SAMPLE);
+
+//=================================================================================
+//=================================================================================
+// function coding here
+//
+constexpr const char *SAMPLE_NAME = ".pktcore-tune-sample";
+constexpr const char *OUTPUT_NAME = ".pktcore-tune-output";
+
+inline std::string Settings_Path() {
+    const char *path = std::getenv("PKTCORE_TUNE");
+    if (path && *path)
+        return path;
+    const char *config = std::getenv("XDG_CONFIG_HOME");
+    if (config && *config)
+        return std::string(config) + "/pktcore/tune";
+    const char *home = std::getenv("HOME");
+    return std::string(home && *home ? home : ".") + "/.config/pktcore/tune";
+}
+
+inline std::string Device_Of(const std::string &dir) {
+    struct stat st;
+    if (::stat(dir.c_str(), &st) != 0)
+        return "";
+    return std::to_string(major(st.st_dev)) + ":" +
+           std::to_string(minor(st.st_dev));
+}
+
+/*
+ * One line of the settings file:
+ *   device 259:1 packet_size N split IN_FLIGHT DIRECT combine IN_FLIGHT
+ *   DIRECT dir PATH
+ */
+inline bool Parse_Line(const std::string &line, std::string &device,
+                       Settings &read) {
+    std::istringstream fields(line);
+    std::string key, split, combine;
+    int split_direct = 0, combine_direct = 0;
+    if (!(fields >> key >> device) || key != "device")
+        return false;
+    if (!(fields >> key >> read.packet_size) || key != "packet_size" ||
+        !(fields >> split >> read.split_in_flight >> split_direct) ||
+        split != "split" ||
+        !(fields >> combine >> read.combine_in_flight >> combine_direct) ||
+        combine != "combine")
+        return false;
+    read.split_direct = split_direct != 0;
+    read.combine_direct = combine_direct != 0;
+    return read.packet_size > 0 && read.split_in_flight > 0 &&
+           read.combine_in_flight > 0;
+}
+
+inline bool Load(const std::string &dir, Settings &found) {
+    std::string device = Device_Of(dir);
+    std::ifstream in(Settings_Path());
+    std::string magic;
+    int version = 0;
+    if (device.empty() || !(in >> magic >> version) || magic != "pktcore-tune")
+        return false;
+
+    std::string line, id;
+    while (std::getline(in, line)) {
+        Settings read;
+        if (Parse_Line(line, id, read) && id == device) {
+            found = read;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool Save(const std::string &dir, const Settings &best) {
+    std::string device = Device_Of(dir);
+    std::string path = Settings_Path();
+    if (device.empty()) {
+        std::cerr << "Could not stat: " << dir << "\n";
+        return false;
+    }
+
+    // Lines of the other devices are kept as they are
+    std::vector<std::string> kept;
+    std::ifstream in(path);
+    std::string line, id;
+    while (std::getline(in, line)) {
+        Settings read;
+        if (Parse_Line(line, id, read) && id != device)
+            kept.push_back(line);
+    }
+    in.close();
+
+    std::error_code ec;
+    std::filesystem::create_directories(
+        std::filesystem::path(path).parent_path(), ec);
+    std::ofstream out(path, std::ios::trunc);
+    out << "pktcore-tune 1\n";
+    for (const auto &other : kept)
+        out << other << "\n";
+    out << "device " << device << " packet_size " << best.packet_size
+        << " split " << best.split_in_flight << " " << best.split_direct
+        << " combine " << best.combine_in_flight << " " << best.combine_direct
+        << " dir " << std::filesystem::weakly_canonical(dir).string() << "\n";
+    if (!out) {
+        std::cerr << "Could not write settings: " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+inline int Splits_For(uint64_t size, uint32_t packet_size) {
+    uint64_t splits = (size + packet_size - 1) / packet_size;
+    if (splits == 0)
+        splits = 1;
+    return static_cast<int>(
+        std::min<uint64_t>(splits, static_cast<uint64_t>(INT32_MAX)));
+}
+
+/*
+ * Keeps std::cout quiet while a trial prints its headers.
+ */
+class Quiet {
+  public:
+    Quiet() : saved_(std::cout.rdbuf(&null_)) {}
+    ~Quiet() { std::cout.rdbuf(saved_); }
+
+  private:
+    struct Null_Buffer : std::streambuf {
+        int overflow(int c) override { return traits_type::not_eof(c); }
+    } null_;
+    std::streambuf *saved_;
+};
+
+/*
+ * Writes `bytes` of incompressible data, flushed and out of the page cache
+ * so the first trial does not find it there.
+ */
+inline bool Write_Sample(const std::string &path, uint64_t bytes) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd < 0) {
+        std::cerr << "Could not create sample: " << path << "\n";
+        return false;
+    }
+    std::vector<uint64_t> block(128 * 1024);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    bool ok = true;
+    for (uint64_t left = bytes; ok && left > 0;) {
+        for (auto &word : block) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            word = state;
+        }
+        size_t len = static_cast<size_t>(
+            std::min<uint64_t>(left, block.size() * sizeof(uint64_t)));
+        ok = ::write(fd, block.data(), len) == static_cast<ssize_t>(len);
+        left -= len;
+    }
+    ok = ok && ::fsync(fd) == 0;
+    buffers::Drop_Cache(fd);
+    ::close(fd);
+    if (!ok)
+        std::cerr << "Could not write sample: " << path << "\n";
+    return ok;
+}
+
+inline void Drop_File(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        buffers::Drop_Cache(fd);
+        ::close(fd);
+    }
+}
+
+/*
+ * Deletes the trial set made from the sample, packets first.
+ */
+inline void Remove_Set(const std::string &file_id) {
+    header::Full_Header full;
+    manifest::Manifest table;
+    combiner::Combine_Plan plan;
+    if (combiner::Plan_Set(file_id, full, table, plan))
+        for (const auto &packet : plan.packets)
+            ::unlink(packet.c_str());
+    ::unlink(utils::Packet_Path(file_id, 0).c_str());
+}
+
+/*
+ * Bytes per second of one run, 0 if it failed.
+ */
+template <typename Run> double Measure(uint64_t bytes, Run run) {
+    auto start = std::chrono::steady_clock::now();
+    if (!run())
+        return 0;
+    std::chrono::duration<double> took =
+        std::chrono::steady_clock::now() - start;
+    return bytes / std::max(took.count(), 1e-6);
+}
+
+inline void Report(const char *what, double rate) {
+    std::cout << "  " << what << (rate > 0 ? "" : "failed");
+    if (rate > 0)
+        std::cout << static_cast<uint64_t>(rate / (1024 * 1024)) << " MiB/s";
+    std::cout << "\n";
+}
+
+/*
+ * Splits the sample with the given settings and times it; the set is left
+ * in place when keep_id is given, else removed.
+ */
+inline double Split_Trial(const std::string &sample, uint64_t bytes,
+                          const Settings &trial,
+                          std::string *keep_id = nullptr) {
+    Drop_File(sample);
+    double rate = Measure(bytes, [&] {
+        Quiet quiet;
+        return splitter::SPLIT_FILE(sample,
+                                    Splits_For(bytes, trial.packet_size),
+                                    trial.split_in_flight, trial.split_direct);
+    });
+    std::string file_id = combiner::Detect_PCORE_Files(sample);
+    if (keep_id && rate > 0)
+        *keep_id = file_id;
+    else if (!file_id.empty())
+        Remove_Set(file_id);
+    std::ostringstream what;
+    what << "split   packet " << trial.packet_size << " in-flight "
+         << trial.split_in_flight << (trial.split_direct ? " direct" : "")
+         << ": ";
+    Report(what.str().c_str(), rate);
+    return rate;
+}
+
+inline double Combine_Trial(const combiner::Combine_Plan &plan,
+                            uint64_t bytes, const Settings &trial) {
+    for (const auto &packet : plan.packets)
+        Drop_File(packet);
+    double rate = Measure(bytes, [&] {
+        Quiet quiet;
+        return combiner::RUN_COMBINE(plan, trial.combine_in_flight,
+                                     trial.combine_direct);
+    });
+    ::unlink(plan.output.c_str());
+    std::ostringstream what;
+    what << "combine in-flight " << trial.combine_in_flight
+         << (trial.combine_direct ? " direct" : "") << ": ";
+    Report(what.str().c_str(), rate);
+    return rate;
+}
+
+inline bool TUNE(uint64_t sample_bytes) {
+    const std::string root = layout::Active().roots[0];
+    const std::string sample =
+        (std::filesystem::path(root) / SAMPLE_NAME).string();
+    if (sample_bytes == 0) {
+        std::cerr << "Sample size must be greater than zero\n";
+        return false;
+    }
+    std::cout << "tuning " << std::filesystem::weakly_canonical(root).string()
+              << " (device " << Device_Of(root) << ") with a "
+              << sample_bytes / (1024 * 1024) << " MiB sample\n";
+    if (!Write_Sample(sample, sample_bytes)) {
+        ::unlink(sample.c_str());
+        return false;
+    }
+
+    // One knob at a time, each trial starting from the best so far: a
+    // handful of runs instead of the whole grid
+    Settings best;
+    double best_rate = 0;
+    auto Try_Split = [&](Settings trial) {
+        double rate = Split_Trial(sample, sample_bytes, trial);
+        if (rate > best_rate) {
+            best_rate = rate;
+            best = trial;
+        }
+    };
+    for (uint32_t size :
+         {256u << 10, 1u << 20, 4u << 20, 16u << 20, 64u << 20}) {
+        if (size > sample_bytes && size != (256u << 10))
+            break;
+        Settings trial = best;
+        trial.packet_size = size;
+        Try_Split(trial);
+    }
+    for (size_t in_flight : {4, 64}) {
+        Settings trial = best;
+        trial.split_in_flight = in_flight;
+        Try_Split(trial);
+    }
+    Settings direct = best;
+    direct.split_direct = true;
+    Try_Split(direct);
+    if (best_rate == 0) {
+        std::cerr << "Every split trial failed in: " << root << "\n";
+        ::unlink(sample.c_str());
+        return false;
+    }
+
+    // Combine trials share one set cut with the winning split settings
+    std::string file_id;
+    header::Full_Header full;
+    manifest::Manifest table;
+    combiner::Combine_Plan plan;
+    bool ok = Split_Trial(sample, sample_bytes, best, &file_id) > 0 &&
+              combiner::Plan_Set(file_id, full, table, plan);
+    ::unlink(sample.c_str());
+    if (!ok) {
+        if (!file_id.empty())
+            Remove_Set(file_id);
+        return false;
+    }
+    plan.output = (std::filesystem::path(root) / OUTPUT_NAME).string();
+    double combine_rate = 0;
+    for (size_t in_flight : {16, 4, 64}) {
+        for (bool use_direct : {false, true}) {
+            Settings trial = best;
+            trial.combine_in_flight = in_flight;
+            trial.combine_direct = use_direct;
+            double rate = Combine_Trial(plan, sample_bytes, trial);
+            if (rate > combine_rate) {
+                combine_rate = rate;
+                best.combine_in_flight = in_flight;
+                best.combine_direct = use_direct;
+            }
+        }
+    }
+    Remove_Set(file_id);
+
+    if (!Save(root, best))
+        return false;
+    std::cout << "best: packet size " << best.packet_size
+              << ", split in-flight " << best.split_in_flight
+              << (best.split_direct ? " direct" : "")
+              << ", combine in-flight " << best.combine_in_flight
+              << (best.combine_direct ? " direct" : "") << "\n"
+              << "saved to " << Settings_Path() << "\n";
+    return true;
+}
+} // namespace tune
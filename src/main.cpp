@@ -1,17 +1,221 @@
+#include "../include/batch.h"
+#include "../include/carve.h"
 #include "../include/combiner.h"
+#include "../include/consume.h"
+#include "../include/daemon.h"
+#include "../include/fsck.h"
+#include "../include/http.h"
+#include "../include/layout.h"
+#include "../include/pack.h"
+#include "../include/progress.h"
+#include "../include/reader.h"
+#include "../include/repack.h"
+#include "../include/shm_ring.h"
 #include "../include/splitter.h"
+#include "../include/throttle.h"
+#include "../include/transport.h"
+#include "../include/tune.h"
+#include <cctype>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <string>
 
+/*
+ * Returns the value that follows an option such as --offset, or an empty
+ * string when the option was not given.
+ */
+static std::string Get_Option(int argc, char *argv[], const std::string &opt) {
+    for (int i = 2; i + 1 < argc; i++) {
+        if (argv[i] == opt)
+            return argv[i + 1];
+    }
+    return "";
+}
+
+/*
+ * Returns true when a flag without a value, such as --direct, was given.
+ */
+static bool Has_Flag(int argc, char *argv[], const std::string &flag) {
+    for (int i = 2; i < argc; i++) {
+        if (argv[i] == flag)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Parses a --packet-size value, an integer from 1 to UINT32_MAX. Throws
+ * std::invalid_argument or std::out_of_range for anything else; std::stoul
+ * alone would take "-1" and wrap values past UINT32_MAX.
+ */
+static uint32_t Packet_Size_Of(const std::string &text) {
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0])))
+        throw std::invalid_argument(text);
+    size_t used = 0;
+    unsigned long long value = std::stoull(text, &used);
+    if (used != text.size() || value == 0 || value > UINT32_MAX)
+        throw std::out_of_range(text);
+    return static_cast<uint32_t>(value);
+}
+
+/*
+ * Whether to use O_DIRECT: --direct or --buffered when given, else what
+ * `tune` picked for the drive.
+ */
+static bool Use_Direct(int argc, char *argv[], bool tuned) {
+    if (Has_Flag(argc, argv, "--direct"))
+        return true;
+    return tuned && !Has_Flag(argc, argv, "--buffered");
+}
+
 int main(int argc, char *argv[]) {
+    // Installed as (or linked to) pktcored, the binary starts the daemon
+    if (std::filesystem::path(argv[0]).filename() == "pktcored")
+        return pktcored::SERVE(pktcored::Default_Socket_Path()) ? 0 : 1;
+
     if (argc > 1) {
         std::string arg1 = argv[1];
 
+        // Packet directories of every command (comma separated to stripe
+        // over several drives); fan-out and striping are remembered there
+        std::string out_dir = Get_Option(argc, argv, "--out-dir");
+        std::string fanout = Get_Option(argc, argv, "--fanout");
+        std::string stripe = Get_Option(argc, argv, "--stripe");
+        if (!out_dir.empty() || !fanout.empty() || !stripe.empty()) {
+            int levels = -1;
+            try {
+                if (!fanout.empty())
+                    levels = std::stoi(fanout);
+                if (!fanout.empty() && levels < 0)
+                    throw std::invalid_argument(fanout);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --fanout must be an integer of 0 or "
+                             "more.\n";
+                return 1;
+            }
+            if (!layout::Select(out_dir.empty() ? "." : out_dir, levels,
+                                stripe))
+                return 1;
+        } else {
+            // No layout flags: the current directory, laid out as its marker
+            // says (a root of a stripe set needs --out-dir naming them all)
+            layout::Marker here;
+            if (layout::Load(".", here) && here.count == 1 &&
+                !layout::Select("."))
+                return 1;
+        }
+
+        // I/O budget of the job, so it can run next to latency sensitive
+        // services: MB/s, operations/s, and a write latency to back off at
+        std::string rate = Get_Option(argc, argv, "--rate");
+        std::string iops = Get_Option(argc, argv, "--iops");
+        std::string latency = Get_Option(argc, argv, "--latency-ms");
+        if (!rate.empty() || !iops.empty() || !latency.empty()) {
+            throttle::Limits limits;
+            // The whole text must be a finite number above zero
+            auto positive = [](const std::string &text) {
+                size_t used = 0;
+                double value = std::stod(text, &used);
+                if (used != text.size() || !std::isfinite(value) ||
+                    value <= 0)
+                    throw std::invalid_argument(text);
+                return value;
+            };
+            try {
+                if (!rate.empty()) {
+                    double bytes = positive(rate) * 1024 * 1024;
+                    // 0 would lift the limit; past 18e18 is no uint64_t
+                    if (bytes < 1 || bytes >= 18e18)
+                        throw std::out_of_range(rate);
+                    limits.bytes_per_sec = static_cast<uint64_t>(bytes);
+                }
+                if (!iops.empty()) {
+                    if (iops.find_first_not_of("0123456789") !=
+                        std::string::npos)
+                        throw std::invalid_argument(iops);
+                    limits.ops_per_sec = std::stoull(iops);
+                    if (limits.ops_per_sec == 0)
+                        throw std::invalid_argument(iops);
+                }
+                if (!latency.empty())
+                    limits.latency_target = positive(latency) / 1000;
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --rate, --iops and --latency-ms must be "
+                             "numbers greater than zero.\n";
+                return 1;
+            }
+            throttle::Active().Configure(limits);
+        }
+
+        // Progress of the bulk commands on stderr: a bar on a terminal, or
+        // protocol lines for front ends (--progress lines)
+        std::unique_ptr<progress::Reporter> reporter;
+        if (arg1 == "combine-all" ||
+            (argc > 2 && (arg1 == "split" || arg1 == "combine" ||
+                          arg1 == "split-all" || arg1 == "repack" ||
+                          arg1 == "carve"))) {
+            progress::Style style;
+            if (!progress::Style_Of(Get_Option(argc, argv, "--progress"),
+                                    style)) {
+                std::cerr << "Error: --progress must be bar, lines or none.\n";
+                return 1;
+            }
+            reporter = std::make_unique<progress::Reporter>(style);
+        }
+
         if (arg1 == "help" || arg1 == "--help") {
             std::cout << "--version" << '\n';
             std::cout << "--split" << '\n';
             std::cout << "--combine" << '\n';
             std::cout << "--show" << '\n';
+            std::cout << "split <file> <splits> [--in-flight K] [--direct] "
+                         "[--compact]"
+                      << '\n';
+            std::cout << "combine <name> [--in-flight K] [--direct|--buffered] "
+                         "[--verify]"
+                      << '\n';
+            std::cout << "split <file> [--in-flight K] [--direct|--buffered] "
+                         "[--compact]"
+                      << '\n';
+            std::cout << "split <file|-> --packet-size N [--name NAME] "
+                         "[--compact]"
+                      << '\n';
+            std::cout << "split <file> --shm SOCKET [--packet-size N] "
+                         "[--slots S]"
+                      << '\n';
+            std::cout << "combine <name> -o <path|->" << '\n';
+            std::cout << "combine <name> --consume [-o PATH]" << '\n';
+            std::cout << "shm-recv SOCKET [-o PATH]" << '\n';
+            std::cout << "split-all <dir> [--packet-size N] [--threads T]"
+                      << '\n';
+            std::cout << "combine-all [--threads T]" << '\n';
+            std::cout << "pack <dir> [--name NAME] [--packet-size N]" << '\n';
+            std::cout << "unpack <name> [--entry E | --list]" << '\n';
+            std::cout << "daemon [--socket PATH] [--threads T]" << '\n';
+            std::cout << "rpc '<json request>' [--socket PATH]" << '\n';
+            std::cout << "http [--listen [HOST:]PORT] [--threads T]" << '\n';
+            std::cout << "cat <name> [--offset X] [--length N]" << '\n';
+            std::cout << "carve <blob> [--combine] [--threads T]" << '\n';
+            std::cout << "repack <name> --packet-size N [--compact] [--keep] "
+                         "[--threads T]"
+                      << '\n';
+            std::cout << "tune [--sample MB]  (trials run in the first "
+                         "--out-dir; every DIR uses its result)"
+                      << '\n';
+            std::cout << "fsck <dir>[,DIR...] [--threads T]" << '\n';
+            std::cout << "send <file> --udp|--tcp HOST:PORT [--packet-size N]"
+                      << '\n';
+            std::cout << "recv --udp|--tcp [HOST:]PORT [-o PATH]" << '\n';
+            std::cout << "any command: [--out-dir DIR[,DIR...]] "
+                         "[--fanout LEVELS] [--stripe rr|space]"
+                      << '\n';
+            std::cout << "any command: [--rate MB/s] [--iops N] "
+                         "[--latency-ms MS]"
+                      << '\n';
+            std::cout << "split, combine, split-all, combine-all, repack, "
+                         "carve: [--progress bar|lines|none]"
+                      << '\n';
             return 0;
 
         } else if (arg1 == "--version" || arg1 == "version" || arg1 == "vr") {
@@ -19,6 +223,93 @@ int main(int argc, char *argv[]) {
             return 0;
 
         } else if (arg1 == "split") {
+            std::string packet_size = Get_Option(argc, argv, "--packet-size");
+            std::string shm_socket = Get_Option(argc, argv, "--shm");
+            if (argc > 2 && !shm_socket.empty()) {
+                // Hand the packets to local consumers through shared memory
+                uint32_t size = shm::DEFAULT_RING_PAYLOAD, slots = 64;
+                try {
+                    if (!packet_size.empty())
+                        size = Packet_Size_Of(packet_size);
+                    std::string opt = Get_Option(argc, argv, "--slots");
+                    if (!opt.empty())
+                        slots = static_cast<uint32_t>(std::stoul(opt));
+                } catch (const std::exception &e) {
+                    std::cerr << "Error: --packet-size must be an integer "
+                                 "from 1 to 4294967295 and --slots an "
+                                 "integer.\n";
+                    return 1;
+                }
+                return shm::SPLIT_TO_RING(argv[2], shm_socket, size, slots) ? 0
+                                                                            : 1;
+            }
+            if (argc > 2 && !packet_size.empty()) {
+                // Fixed packet size: read the input as a stream, so it also
+                // works for pipes ("-" is stdin)
+                std::string file = argv[2];
+                uint32_t size;
+                try {
+                    size = Packet_Size_Of(packet_size);
+                } catch (const std::exception &e) {
+                    std::cerr << "Error: --packet-size must be an integer "
+                                 "from 1 to 4294967295.\n";
+                    return 1;
+                }
+
+                std::string name = Get_Option(argc, argv, "--name");
+                int fd = STDIN_FILENO;
+                if (file != "-") {
+                    fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+                    if (fd < 0) {
+                        std::cerr << "Could not open file: " << file << "\n";
+                        return 1;
+                    }
+                    if (name.empty())
+                        name = file;
+                } else if (name.empty()) {
+                    name = "stdin";
+                }
+                bool ok = splitter::SPLITTER_STREAM(
+                    fd, name, size, Has_Flag(argc, argv, "--compact"));
+                if (fd != STDIN_FILENO)
+                    ::close(fd);
+                return ok ? 0 : 1;
+            }
+
+            if (argc > 2 &&
+                (argc == 3 || std::string(argv[3]).rfind("--", 0) == 0)) {
+                // No split count: packet size and I/O settings tuned for the
+                // drive of the packet directory (`tune`), or the defaults
+                std::string file = argv[2];
+                tune::Settings tuned;
+                if (!tune::Load(layout::Active().roots[0], tuned))
+                    std::cerr << "No tuned settings for this drive, using "
+                                 "defaults (run: pktcore tune)\n";
+                struct stat st;
+                if (::stat(file.c_str(), &st) != 0) {
+                    std::cerr << "Could not open file: " << file << "\n";
+                    return 1;
+                }
+                size_t in_flight = tuned.split_in_flight;
+                try {
+                    std::string opt = Get_Option(argc, argv, "--in-flight");
+                    if (!opt.empty())
+                        in_flight = std::stoul(opt);
+                } catch (const std::exception &e) {
+                    std::cerr << "Error: --in-flight must be an integer.\n";
+                    return 1;
+                }
+                return splitter::SPLIT_FILE(
+                           file,
+                           tune::Splits_For(static_cast<uint64_t>(st.st_size),
+                                            tuned.packet_size),
+                           in_flight,
+                           Use_Direct(argc, argv, tuned.split_direct),
+                           Has_Flag(argc, argv, "--compact"))
+                           ? 0
+                           : 1;
+            }
+
             // Check if there's a second argument (filename)
             if (argc > 2) {
                 std::string file =
@@ -28,8 +319,15 @@ int main(int argc, char *argv[]) {
                         // Try converting the third argument to an integer
                         int x = std::stoi(argv[3]); // Convert the third
                                                     // argument to an integer
-                        splitter::SPLITTER(file, x);
+                        std::string opt = Get_Option(argc, argv, "--in-flight");
+                        size_t in_flight = opt.empty() ? 16 : std::stoul(opt);
                         // Call SPLITTER with file and int x
+                        return splitter::SPLITTER(
+                                   file, x, in_flight,
+                                   Has_Flag(argc, argv, "--direct"),
+                                   Has_Flag(argc, argv, "--compact"))
+                                   ? 0
+                                   : 1;
                     } catch (const std::invalid_argument &e) {
                         // If it's not an integer, show an error
                         std::cerr << "Error: The third argument must be an "
@@ -37,30 +335,87 @@ int main(int argc, char *argv[]) {
                         std::cerr
                             << "Example: ./pcore split <filename> <integer>\n";
                         return 1; // Exit with an error code
+                    } catch (const std::out_of_range &e) {
+                        std::cerr << "Error: The split count or --in-flight "
+                                     "is out of range.\n";
+                        return 1;
                     }
                 }
             } else {
                 // If no filename is provided, just call SPLITTER() without
                 // arguments
-                splitter::SPLITTER();
+                return splitter::SPLITTER() ? 0 : 1;
             }
             return 0;
 
         } else if (arg1 == "combine" || arg1 == "--combine") {
 
+            std::string output = Get_Option(argc, argv, "-o");
+            if (argc > 2 && Has_Flag(argc, argv, "--consume")) {
+                // Give the packets' space back as the output grows
+                std::string file = combiner::Detect_PCORE_Files(argv[2]);
+                if (file.empty()) {
+                    std::cerr << "no PCORE file named " << argv[2] << "\n";
+                    return 1;
+                }
+                if (output == "-") {
+                    std::cerr << "Error: --consume needs a file to write.\n";
+                    return 1;
+                }
+                return consume::CONSUME(file, output) ? 0 : 1;
+            }
+            if (argc > 2 && !output.empty()) {
+                // Stream the payloads in order instead of materializing
+                // the file in the current directory ("-" is stdout)
+                std::string file = combiner::Detect_PCORE_Files(argv[2]);
+                if (file.empty()) {
+                    std::cerr << "no PCORE file named " << argv[2] << "\n";
+                    return 1;
+                }
+                int fd = STDOUT_FILENO;
+                if (output != "-") {
+                    fd = ::open(output.c_str(),
+                                O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                    if (fd < 0) {
+                        std::cerr << "Failed to create file: " << output
+                                  << "\n";
+                        return 1;
+                    }
+                }
+                bool ok = combiner::COMBINE_STREAM(file, fd);
+                if (fd != STDOUT_FILENO)
+                    ::close(fd);
+                return ok ? 0 : 1;
+            }
+
             if (argc > 2) {
                 std::string fname = argv[2];
+                tune::Settings tuned;
+                tune::Load(layout::Active().roots[0], tuned);
+                size_t in_flight = tuned.combine_in_flight;
+                try {
+                    std::string opt = Get_Option(argc, argv, "--in-flight");
+                    if (!opt.empty())
+                        in_flight = std::stoul(opt);
+                } catch (const std::exception &e) {
+                    std::cerr << "Error: --in-flight must be an integer.\n";
+                    return 1;
+                }
 
                 std::string file = combiner::Detect_PCORE_Files(fname);
-                auto var = combiner::BuildMinHeapForFile(file);
-                combiner::COMBINE(var);
-                return 0;
+                if (file.empty()) {
+                    std::cerr << "no PCORE file named " << fname << "\n";
+                    return 1;
+                }
+                bool ok = combiner::COMBINE_SET(
+                    file, in_flight,
+                    Use_Direct(argc, argv, tuned.combine_direct),
+                    Has_Flag(argc, argv, "--verify"));
+                return ok ? 0 : 1;
                 // Get the file name from the second argument
             } else {
                 std::string file = combiner::Detect_PCORE_Files();
-                auto var = combiner::BuildMinHeapForFile(file);
-                combiner::COMBINE(var);
-                return 0;
+                return combiner::COMBINE_SET(file) ? 0 : 1;
             }
 
         } else if (arg1 == "list" || arg1 == "--list") {
@@ -77,6 +432,264 @@ int main(int argc, char *argv[]) {
                 std::cerr << "try : --help to list available commands\n";
                 return 0;
             }
+        } else if (arg1 == "split-all" || arg1 == "combine-all") {
+            uint32_t packet_size = 1024 * 1024;
+            size_t threads = 0;
+            try {
+                std::string opt = Get_Option(argc, argv, "--packet-size");
+                if (!opt.empty())
+                    packet_size = Packet_Size_Of(opt);
+                opt = Get_Option(argc, argv, "--threads");
+                if (!opt.empty())
+                    threads = std::stoul(opt);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --packet-size must be an integer from 1 "
+                             "to 4294967295 and --threads an integer.\n";
+                return 1;
+            }
+
+            if (arg1 == "combine-all")
+                return batch::COMBINE_ALL(threads) ? 0 : 1;
+            if (argc < 3) {
+                std::cerr << "Example: ./pcore split-all <dir> --packet-size N\n";
+                return 1;
+            }
+            return batch::SPLIT_ALL(argv[2], packet_size, threads) ? 0 : 1;
+
+        } else if (arg1 == "pack") {
+            if (argc < 3) {
+                std::cerr << "Example: ./pcore pack <dir> --name NAME\n";
+                return 1;
+            }
+            std::string dir = argv[2];
+            std::string name = Get_Option(argc, argv, "--name");
+            if (name.empty()) {
+                // "dir/" and "." name the set after the directory itself
+                std::filesystem::path path =
+                    std::filesystem::absolute(dir).lexically_normal();
+                if (path.filename().empty())
+                    path = path.parent_path();
+                name = path.filename().string();
+            }
+            uint32_t packet_size = 1024 * 1024;
+            try {
+                std::string opt = Get_Option(argc, argv, "--packet-size");
+                if (!opt.empty())
+                    packet_size = Packet_Size_Of(opt);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --packet-size must be an integer "
+                             "from 1 to 4294967295.\n";
+                return 1;
+            }
+            return pack::PACK(dir, name, packet_size) ? 0 : 1;
+
+        } else if (arg1 == "unpack") {
+            if (argc < 3) {
+                std::cerr << "Example: ./pcore unpack <name> [--entry E]\n";
+                return 1;
+            }
+            std::string file = combiner::Detect_PCORE_Files(argv[2]);
+            if (file.empty()) {
+                std::cerr << "no PCORE file named " << argv[2] << "\n";
+                return 1;
+            }
+            if (argc > 3 && std::string(argv[3]) == "--list") {
+                std::vector<pack::Entry> entries;
+                if (!pack::READ_ENTRIES(file, entries))
+                    return 1;
+                for (const auto &e : entries)
+                    std::cout << e.size << '\t' << e.name << '\n';
+                return 0;
+            }
+            return pack::UNPACK(file, Get_Option(argc, argv, "--entry")) ? 0
+                                                                         : 1;
+
+        } else if (arg1 == "daemon" || arg1 == "rpc") {
+            std::string socket_path = Get_Option(argc, argv, "--socket");
+            if (socket_path.empty())
+                socket_path = pktcored::Default_Socket_Path();
+
+            if (arg1 == "rpc") {
+                if (argc < 3) {
+                    std::cerr << "Example: ./pcore rpc '{\"op\":\"status\"}'\n";
+                    return 1;
+                }
+                return pktcored::RPC_CALL(socket_path, argv[2]) ? 0 : 1;
+            }
+
+            size_t threads = 0;
+            try {
+                std::string opt = Get_Option(argc, argv, "--threads");
+                if (!opt.empty())
+                    threads = std::stoul(opt);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --threads must be an integer.\n";
+                return 1;
+            }
+            return pktcored::SERVE(socket_path, threads) ? 0 : 1;
+
+        } else if (arg1 == "http") {
+            std::string listen = Get_Option(argc, argv, "--listen");
+            if (listen.empty())
+                listen = "8080";
+            size_t threads = 0;
+            try {
+                std::string opt = Get_Option(argc, argv, "--threads");
+                if (!opt.empty())
+                    threads = std::stoul(opt);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --threads must be an integer.\n";
+                return 1;
+            }
+            return http::SERVE(listen, threads) ? 0 : 1;
+
+        } else if (arg1 == "carve") {
+            if (argc < 3) {
+                std::cerr << "Example: ./pcore carve <blob> [--combine]\n";
+                return 1;
+            }
+            size_t threads = 0;
+            try {
+                std::string opt = Get_Option(argc, argv, "--threads");
+                if (!opt.empty())
+                    threads = std::stoul(opt);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --threads must be an integer.\n";
+                return 1;
+            }
+            return carve::CARVE(argv[2], Has_Flag(argc, argv, "--combine"),
+                                threads)
+                       ? 0
+                       : 1;
+
+        } else if (arg1 == "fsck") {
+            size_t threads = 0;
+            try {
+                std::string opt = Get_Option(argc, argv, "--threads");
+                if (!opt.empty())
+                    threads = std::stoul(opt);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --threads must be an integer.\n";
+                return 1;
+            }
+            std::string roots = ".";
+            if (argc > 2 && std::string(argv[2]).rfind("--", 0) != 0)
+                roots = argv[2];
+            return fsck::FSCK(roots, threads) ? 0 : 1;
+
+        } else if (arg1 == "repack") {
+            std::string opt = Get_Option(argc, argv, "--packet-size");
+            if (argc < 3 || opt.empty()) {
+                std::cerr << "Example: ./pcore repack <name> --packet-size N\n";
+                return 1;
+            }
+            uint32_t packet_size;
+            size_t threads = 0;
+            try {
+                packet_size = Packet_Size_Of(opt);
+                opt = Get_Option(argc, argv, "--threads");
+                if (!opt.empty())
+                    threads = std::stoul(opt);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --packet-size must be an integer from 1 "
+                             "to 4294967295 and --threads an integer.\n";
+                return 1;
+            }
+            std::string file = combiner::Detect_PCORE_Files(argv[2]);
+            if (file.empty()) {
+                std::cerr << "no PCORE file named " << argv[2] << "\n";
+                return 1;
+            }
+            return repack::REPACK(file, packet_size,
+                                  Has_Flag(argc, argv, "--compact"),
+                                  Has_Flag(argc, argv, "--keep"), threads)
+                       ? 0
+                       : 1;
+
+        } else if (arg1 == "tune") {
+            uint64_t sample = tune::DEFAULT_SAMPLE;
+            try {
+                std::string opt = Get_Option(argc, argv, "--sample");
+                if (!opt.empty())
+                    sample = std::stoull(opt) * 1024 * 1024;
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --sample must be an integer.\n";
+                return 1;
+            }
+            return tune::TUNE(sample) ? 0 : 1;
+
+        } else if (arg1 == "cat" || arg1 == "--cat") {
+            if (argc < 3) {
+                std::cerr << "Example: ./pcore cat <filename> --offset X "
+                             "--length N\n";
+                return 1;
+            }
+            uint64_t offset = 0;
+            int64_t length = -1;
+            try {
+                std::string opt = Get_Option(argc, argv, "--offset");
+                if (!opt.empty() && opt[0] == '-')
+                    throw std::invalid_argument(opt);
+                if (!opt.empty())
+                    offset = std::stoull(opt);
+                opt = Get_Option(argc, argv, "--length");
+                if (!opt.empty())
+                    length = std::stoll(opt);
+                if (!opt.empty() && length <= 0)
+                    throw std::invalid_argument(opt);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --offset must be a non-negative integer "
+                             "and --length a positive one.\n";
+                return 1;
+            }
+
+            std::string file = combiner::Detect_PCORE_Files(argv[2]);
+            if (file.empty()) {
+                std::cerr << "no PCORE file named " << argv[2] << "\n";
+                return 1;
+            }
+            return reader::CAT(file, offset, length) ? 0 : 1;
+
+        } else if (arg1 == "shm-recv") {
+            if (argc < 3) {
+                std::cerr << "Example: ./pcore shm-recv <socket> -o <path>\n";
+                return 1;
+            }
+            return shm::CONSUME_RING(argv[2], Get_Option(argc, argv, "-o")) ? 0
+                                                                            : 1;
+
+        } else if (arg1 == "send" || arg1 == "recv") {
+            std::string udp = Get_Option(argc, argv, "--udp");
+            std::string tcp = Get_Option(argc, argv, "--tcp");
+            if (arg1 == "recv") {
+                std::string output = Get_Option(argc, argv, "-o");
+                if (!udp.empty())
+                    return transport::RECV_UDP(udp, output) ? 0 : 1;
+                if (!tcp.empty())
+                    return transport::RECV_TCP(tcp, output) ? 0 : 1;
+                std::cerr << "Example: ./pcore recv --udp 9000\n";
+                return 1;
+            }
+
+            if (argc < 3 || (udp.empty() && tcp.empty())) {
+                std::cerr << "Example: ./pcore send <file> --udp host:9000\n";
+                return 1;
+            }
+            uint32_t packet_size = udp.empty() ? 1024 * 1024
+                                               : transport::DEFAULT_UDP_PAYLOAD;
+            try {
+                std::string opt = Get_Option(argc, argv, "--packet-size");
+                if (!opt.empty())
+                    packet_size = Packet_Size_Of(opt);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: --packet-size must be an integer "
+                             "from 1 to 4294967295.\n";
+                return 1;
+            }
+            if (!udp.empty())
+                return transport::SEND_UDP(argv[2], udp, packet_size) ? 0 : 1;
+            return transport::SEND_TCP(argv[2], tcp, packet_size) ? 0 : 1;
+
         } else if (arg1 == "show" || arg1 == "--show") {
             combiner::SHOW_PCORE_FILES();
             return 0;
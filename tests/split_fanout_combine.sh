@@ -0,0 +1,16 @@
+#!/bin/sh
+# A split with --fanout records the layout in the directory; a plain
+# combine run there afterwards must find the packets without being told.
+# usage: split_fanout_combine.sh PKTCORE
+set -e
+pktcore="$1"
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+head -c 3000000 /dev/urandom > data.bin
+cp data.bin expected.bin
+"$pktcore" split data.bin 8 --fanout 2 > /dev/null
+rm data.bin
+"$pktcore" combine data.bin > /dev/null
+cmp expected.bin data.bin